@@ -1,7 +1,11 @@
 CCNDOBJ := \
     android_main.o \
     ccnd.o \
+    ccnd_cspolicy.o \
+    ccnd_cstier.o \
     ccnd_internal_client.o \
+    ccnd_lpm.o \
+    ccnd_nonce.o \
     ccnd_msg.o \
     ccnd_stats.o \
     ccnd_stregistry.o \
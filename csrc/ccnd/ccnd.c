@@ -21,6 +21,10 @@
  * Main program of ccnd - the CCNx Daemon
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    #define _GNU_SOURCE /* for recvmmsg and sendmmsg */
+#endif
+
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
@@ -35,13 +39,24 @@
 #include <time.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <netinet/in.h>
 
+#if defined(__linux__) && !defined(CCND_NO_EPOLL)
+    #define CCND_HAVE_EPOLL 1
+    #include <sys/epoll.h>
+#endif
+
+#if defined(__linux__) && !defined(CCND_NO_MMSG)
+    #define CCND_HAVE_MMSG 1
+#endif
+
 #if defined(NEED_GETADDRINFO_COMPAT)
     #include "getaddrinfo.h"
     #include "dummyin6.h"
@@ -75,6 +90,7 @@ static struct face *record_connection(struct ccnd_handle *h,
 static void process_input_message(struct ccnd_handle *h, struct face *face,
                                   unsigned char *msg, size_t size, int pdu_ok);
 static void process_input(struct ccnd_handle *h, int fd);
+static void dgram_batch_destroy(struct dgram_batch **pb);
 static int ccn_stuff_interest(struct ccnd_handle *h,
                               struct face *face, struct ccn_charbuf *c);
 static void do_deferred_write(struct ccnd_handle *h, int fd);
@@ -89,6 +105,7 @@ static void mark_stale(struct ccnd_handle *h,
 static struct content_entry *content_next(struct ccnd_handle *h,
                                           struct content_entry *content);
 static void reap_needed(struct ccnd_handle *h, int init_delay_usec);
+void content_tree_trim(struct ccnd_handle *h);
 static void check_comm_file(struct ccnd_handle *h);
 static int nameprefix_seek(struct ccnd_handle *h,
                            struct hashtb_enumerator *e,
@@ -98,7 +115,18 @@ static int nameprefix_seek(struct ccnd_handle *h,
 static void register_new_face(struct ccnd_handle *h, struct face *face);
 static void update_forward_to(struct ccnd_handle *h,
                               struct nameprefix_entry *npe);
+static void forwarding_changed(struct ccnd_handle *h,
+                               struct nameprefix_entry *npe);
+static int forward_to_stale(struct ccnd_handle *h,
+                            struct nameprefix_entry *npe);
+static void ccnd_send_pkt(struct ccnd_handle *h, struct face *face,
+                          struct ccnd_pktbuf *pkt,
+                          const void *data, size_t size);
+static void ccnd_send_iov(struct ccnd_handle *h, struct face *face,
+                          struct ccnd_pktbuf *pkt,
+                          const struct iovec *iov, int iovcnt);
 static void stuff_and_send(struct ccnd_handle *h, struct face *face,
+                           struct ccnd_pktbuf *pkt1,
                            const unsigned char *data1, size_t size1,
                            const unsigned char *data2, size_t size2,
                            const char *tag, int lineno);
@@ -106,10 +134,21 @@ static void ccn_link_state_init(struct ccnd_handle *h, struct face *face);
 static void ccn_append_link_stuff(struct ccnd_handle *h,
                                   struct face *face,
                                   struct ccn_charbuf *c);
+static void reasm_destroy(struct ccnd_reasm **pr);
+static void link_arq_destroy(struct ccnd_handle *h, struct ccnd_link_arq **pa);
+static void link_rtx_save(struct ccnd_handle *h, struct face *face,
+                          const unsigned char *data, size_t size);
+static int process_incoming_fragment(struct ccnd_handle *h, struct face *face,
+                                     unsigned char *msg, size_t size);
+static int send_fragments(struct ccnd_handle *h, struct face *face,
+                          const unsigned char *data1, size_t size1,
+                          const unsigned char *data2, size_t size2,
+                          const char *tag, int lineno);
 static int process_incoming_link_message(struct ccnd_handle *h,
                                          struct face *face, enum ccn_dtag dtag,
                                          unsigned char *msg, size_t size);
 static void process_internal_client_buffer(struct ccnd_handle *h);
+static unsigned cq_usec(struct ccnd_handle *h);
 static int nonce_ok(struct ccnd_handle *h, struct face *face,
                     const unsigned char *interest_msg,
                     struct ccn_parsed_interest *pi,
@@ -131,8 +170,10 @@ static int
 pfi_unique_nonce(struct ccnd_handle *h, struct interest_entry *ie,
                  struct pit_face_item *p);
 static int wt_compare(ccn_wrappedtime, ccn_wrappedtime);
+struct fib_change;
 static void
-update_npe_children(struct ccnd_handle *h, struct nameprefix_entry *npe, unsigned faceid);
+update_npe_children(struct ccnd_handle *h,
+                    struct fib_change *chg, int n);
 static void
 pfi_set_expiry_from_lifetime(struct ccnd_handle *h, struct interest_entry *ie,
                              struct pit_face_item *p, intmax_t lifetime);
@@ -171,6 +212,132 @@ static void strategy_callout(struct ccnd_handle *h,
 #define CCND_MAX_MATCH_PROBES 50000
 #endif
 
+#ifndef CCND_CS_TIER_BYTES
+/**
+ * Default size of the on-disk content store tier, if CCND_CS_TIER is set
+ */
+#define CCND_CS_TIER_BYTES (1ULL << 30)
+#endif
+
+#ifndef CCND_SNAPSHOT_SIGNAL
+/**
+ * Signal that asks for a content store snapshot, if CCND_CS_SNAPSHOT is set
+ */
+#define CCND_SNAPSHOT_SIGNAL SIGUSR1
+#endif
+
+#ifndef CCND_DGRAM_BATCH
+/**
+ * Maximum number of datagrams handled by one recvmmsg or sendmmsg call
+ */
+#define CCND_DGRAM_BATCH 32
+#endif
+
+#ifndef CCND_INPUT_QUANTUM
+/**
+ * Bytes of stream input that each face may have processed per pass
+ * through the main loop (deficit round robin quantum)
+ */
+#define CCND_INPUT_QUANTUM CCN_MAX_MESSAGE_BYTES
+#endif
+
+#ifndef CCND_OVERLOAD_MICROSEC
+/**
+ * Default time that input must keep backing up before interests are shed
+ */
+#define CCND_OVERLOAD_MICROSEC 50000
+#endif
+
+#ifndef CCND_HOUSEKEEPING_SLICE
+/**
+ * Table entries that a housekeeping task visits before letting
+ * other work proceed
+ */
+#define CCND_HOUSEKEEPING_SLICE 1000
+#endif
+
+#ifndef CCND_HOUSEKEEPING_PAUSE
+/**
+ * Microseconds between slices of a housekeeping pass
+ */
+#define CCND_HOUSEKEEPING_PAUSE 1000
+#endif
+
+#ifndef CCND_SLAB_BYTES
+/**
+ * Size of each slab carved up by the slab allocator
+ */
+#define CCND_SLAB_BYTES 65536
+#endif
+
+#ifndef CCND_NONCE_LIFETIME
+/**
+ * How long an interest nonce is remembered, in wrapped time ticks
+ */
+#define CCND_NONCE_LIFETIME (6 * WTHZ)
+#endif
+
+#ifndef CCND_OUTQ_CHUNK
+/**
+ * Size of the chunks that hold copied output for a blocked stream face
+ */
+#define CCND_OUTQ_CHUNK 8192
+#endif
+
+#ifndef CCND_OUTQ_LIMIT
+/**
+ * Most output that may be queued for a blocked stream face, in bytes
+ *
+ * Content queues hold back once half of this is in use; beyond the
+ * limit, further messages are dropped.
+ */
+#define CCND_OUTQ_LIMIT (4 * 1024 * 1024)
+#endif
+
+#ifndef CCND_FRAG_MAX
+/**
+ * Most fragments that one message may be split into (at most 32)
+ */
+#define CCND_FRAG_MAX 32
+#endif
+
+#ifndef CCND_REASM_SLOTS
+/**
+ * Number of fragmented messages that a face may be reassembling at once
+ */
+#define CCND_REASM_SLOTS 4
+#endif
+
+#ifndef CCND_LINK_RTX_SLOTS
+/**
+ * Number of sent datagrams a face keeps for link-level retransmission
+ */
+#define CCND_LINK_RTX_SLOTS 64
+#endif
+
+#ifndef CCND_LINK_RETRIES
+/**
+ * Times a datagram is resent before it is given up for lost
+ */
+#define CCND_LINK_RETRIES 2
+#endif
+
+#ifndef CCND_AQM_INTERVAL_MICROSEC
+/**
+ * How long queueing delay must stay above CCND_AQM_TARGET_MICROSEC
+ * before content queue management starts dropping
+ */
+#define CCND_AQM_INTERVAL_MICROSEC 100000
+#endif
+
+#ifndef CCND_PACE_SAMPLE_MICROSEC
+/**
+ * Shortest span over which the drain rate of a backlogged stream face
+ * is measured, for pacing content on point-to-point faces
+ */
+#define CCND_PACE_SAMPLE_MICROSEC 10000
+#endif
+
 /**
  * Name of our unix-domain listener
  *
@@ -259,6 +426,375 @@ charbuf_release(struct ccnd_handle *h, struct ccn_charbuf *c)
         ccn_charbuf_destroy(&c);
 }
 
+/**
+ * Allocate a packet buffer of the given size, with one reference
+ */
+static struct ccnd_pktbuf *
+pktbuf_create(size_t size)
+{
+    struct ccnd_pktbuf *p;
+    
+    p = malloc(offsetof(struct ccnd_pktbuf, buf) + size);
+    if (p == NULL)
+        return(NULL);
+    p->refs = 1;
+    p->size = size;
+    return(p);
+}
+
+/**
+ * Take an additional reference to a packet buffer
+ */
+static struct ccnd_pktbuf *
+pktbuf_ref(struct ccnd_pktbuf *p)
+{
+    p->refs++;
+    return(p);
+}
+
+/**
+ * Drop a reference to a packet buffer, freeing it with the last one
+ */
+static void
+pktbuf_release(struct ccnd_pktbuf **pp)
+{
+    struct ccnd_pktbuf *p = *pp;
+    
+    if (p == NULL)
+        return;
+    *pp = NULL;
+    if (--(p->refs) == 0)
+        free(p);
+}
+
+/**
+ * Object header used by the slab allocator
+ *
+ * While an object is in use this records its size class; while it is
+ * on a free list it holds the link to the next free object.
+ */
+union ccnd_slab_hdr {
+    unsigned cls;               /**< size class, or CCND_SLAB_NCLASS */
+    union ccnd_slab_hdr *link;  /**< next free object */
+    double align;               /**< keep the object suitably aligned */
+};
+
+/** Object sizes (header included) for the slab classes */
+static const unsigned short ccnd_slab_sizes[CCND_SLAB_NCLASS] = {
+    32, 48, 64, 96, 128, 192, 256, 384, 512, 768
+};
+
+/**
+ * Set up the size classes of the slab allocator
+ */
+static void
+ccnd_slab_init(struct ccnd_handle *h)
+{
+    int i;
+    
+    h->slab_bytes = CCND_SLAB_BYTES;
+    for (i = 0; i < CCND_SLAB_NCLASS; i++)
+#ifndef CCND_NO_SLAB
+        h->slab[i].size = ccnd_slab_sizes[i];
+#else
+        h->slab[i].size = 0; /* everything goes to malloc */
+#endif
+}
+
+/**
+ * Allocate an object from the slab pools
+ *
+ * Requests that are too big for the largest class are passed
+ * along to malloc.  The memory is not zeroed.
+ * @returns NULL if no memory.
+ */
+static void *
+ccnd_slab_alloc(struct ccnd_handle *h, size_t size)
+{
+    struct ccnd_slab_class *c;
+    union ccnd_slab_hdr *p;
+    unsigned char *slab;
+    int i;
+    
+    size += sizeof(*p);
+    for (i = 0; i < CCND_SLAB_NCLASS && h->slab[i].size < size; i++)
+        continue;
+    if (i == CCND_SLAB_NCLASS) {
+        p = malloc(size);
+        if (p == NULL)
+            return(NULL);
+        p->cls = CCND_SLAB_NCLASS;
+        h->slab_large++;
+        return(p + 1);
+    }
+    c = &h->slab[i];
+    p = c->freelist;
+    if (p != NULL) {
+        c->freelist = p->link;
+        c->nfree--;
+    }
+    else {
+        if (c->limit - c->next < c->size) {
+            slab = malloc(h->slab_bytes);
+            if (slab == NULL)
+                return(NULL);
+            /* The first header-sized chunk links the slabs together */
+            ((union ccnd_slab_hdr *)slab)->link = h->slabs;
+            h->slabs = slab;
+            c->next = slab + sizeof(*p);
+            c->limit = slab + h->slab_bytes;
+            c->nslabs++;
+        }
+        p = (union ccnd_slab_hdr *)c->next;
+        c->next += c->size;
+    }
+    p->cls = i;
+    c->inuse++;
+    return(p + 1);
+}
+
+/**
+ * Return an object obtained from ccnd_slab_alloc()
+ */
+static void
+ccnd_slab_free(struct ccnd_handle *h, void *obj)
+{
+    struct ccnd_slab_class *c;
+    union ccnd_slab_hdr *p;
+    
+    if (obj == NULL)
+        return;
+    p = ((union ccnd_slab_hdr *)obj) - 1;
+    if (p->cls >= CCND_SLAB_NCLASS) {
+        h->slab_large--;
+        free(p);
+        return;
+    }
+    c = &h->slab[p->cls];
+    p->link = c->freelist;
+    c->freelist = p;
+    c->inuse--;
+    c->nfree++;
+}
+
+/**
+ * Release all of the slabs
+ *
+ * This must not be called until all the objects are gone.
+ */
+static void
+ccnd_slab_destroy(struct ccnd_handle *h)
+{
+    union ccnd_slab_hdr *slab;
+    
+    while (h->slabs != NULL) {
+        slab = h->slabs;
+        h->slabs = slab->link;
+        free(slab);
+    }
+    memset(h->slab, 0, sizeof(h->slab));
+}
+
+/**
+ * One piece of the output queue of a stream face
+ */
+struct ccnd_outseg {
+    struct ccnd_outseg *next;
+    struct ccnd_pktbuf *pkt;    /**< holds the data */
+    size_t start;               /**< offset of the unsent data */
+    size_t end;                 /**< offset just past the data */
+    int chunk;                  /**< nonzero if pkt is ours to append to */
+};
+
+/**
+ * Output waiting for a stream socket to become writable
+ *
+ * Data that already lives in a packet buffer is queued by reference;
+ * anything else is copied into chunks of CCND_OUTQ_CHUNK bytes.  Queued
+ * data is never moved, and the queue is drained with writev(), so a slow
+ * peer costs nothing more than the bytes it has not yet taken.
+ */
+struct ccnd_outq {
+    struct ccnd_outseg *head;
+    struct ccnd_outseg *tail;
+    size_t bytes;               /**< unsent bytes in the queue */
+    size_t drained;             /**< bytes written since the last pace sample */
+    unsigned since;             /**< start of the current pace sample */
+    int unpaced;                /**< filled while connecting, so not sampled */
+};
+
+/** Most queue segments handed to one writev() call */
+#define CCND_OUTQ_IOV 64
+
+/**
+ * Make an empty output queue, starting a pace sample
+ * @returns NULL if no memory.
+ */
+static struct ccnd_outq *
+outq_create(struct ccnd_handle *h)
+{
+    struct ccnd_outq *q = calloc(1, sizeof(*q));
+    
+    if (q != NULL)
+        q->since = cq_usec(h);
+    return(q);
+}
+
+/**
+ * Discard an output queue and whatever is in it
+ */
+static void
+outq_destroy(struct ccnd_handle *h, struct ccnd_outq **pq)
+{
+    struct ccnd_outq *q = *pq;
+    struct ccnd_outseg *s;
+    
+    if (q == NULL)
+        return;
+    while ((s = q->head) != NULL) {
+        q->head = s->next;
+        pktbuf_release(&s->pkt);
+        ccnd_slab_free(h, s);
+    }
+    free(q);
+    *pq = NULL;
+}
+
+/**
+ * Add a message, given in one or more pieces, to an output queue
+ *
+ * The first skip bytes of the message are left out.  If pkt is not NULL,
+ * the first piece lies within it and is queued by reference.
+ * @returns 0 for success, -1 if no memory.
+ */
+static int
+outq_append(struct ccnd_handle *h, struct ccnd_outq *q,
+            struct ccnd_pktbuf *pkt, const struct iovec *iov, int iovcnt,
+            size_t skip)
+{
+    struct ccnd_outseg *s = NULL;
+    const unsigned char *data;
+    size_t size;
+    size_t n;
+    int i;
+    
+    for (i = 0; i < iovcnt; i++, pkt = NULL) {
+        data = iov[i].iov_base;
+        size = iov[i].iov_len;
+        n = (skip < size) ? skip : size;
+        skip -= n;
+        data += n;
+        size -= n;
+        while (size > 0) {
+            s = q->tail;
+            if (pkt == NULL && s != NULL && s->chunk && s->end < s->pkt->size) {
+                n = s->pkt->size - s->end;
+                if (n > size)
+                    n = size;
+                memcpy(s->pkt->buf + s->end, data, n);
+                s->end += n;
+                q->bytes += n;
+                data += n;
+                size -= n;
+                continue;
+            }
+            s = ccnd_slab_alloc(h, sizeof(*s));
+            if (s == NULL)
+                return(-1);
+            s->next = NULL;
+            if (pkt != NULL) {
+                s->pkt = pktbuf_ref(pkt);
+                s->start = data - pkt->buf;
+                s->end = s->start + size;
+                s->chunk = 0;
+                q->bytes += size;
+                size = 0;
+            }
+            else {
+                s->pkt = pktbuf_create(CCND_OUTQ_CHUNK);
+                if (s->pkt == NULL) {
+                    ccnd_slab_free(h, s);
+                    return(-1);
+                }
+                s->start = s->end = 0;
+                s->chunk = 1;
+            }
+            if (q->tail == NULL)
+                q->head = s;
+            else
+                q->tail->next = s;
+            q->tail = s;
+        }
+    }
+    return(0);
+}
+
+/**
+ * Write as much of an output queue as the socket will take
+ * @returns the number of bytes written, or -1 with errno set.
+ */
+static ssize_t
+outq_write(struct ccnd_handle *h, struct ccnd_outq *q, int fd)
+{
+    struct iovec iov[CCND_OUTQ_IOV];
+    struct ccnd_outseg *s;
+    ssize_t res;
+    size_t n;
+    int i;
+    
+    for (i = 0, s = q->head; s != NULL && i < CCND_OUTQ_IOV; s = s->next, i++) {
+        iov[i].iov_base = s->pkt->buf + s->start;
+        iov[i].iov_len = s->end - s->start;
+    }
+    if (i == 0)
+        return(0);
+    res = writev(fd, iov, i);
+    if (res <= 0)
+        return(res);
+    q->bytes -= res;
+    for (n = res; (s = q->head) != NULL && n >= s->end - s->start;) {
+        n -= s->end - s->start;
+        q->head = s->next;
+        pktbuf_release(&s->pkt);
+        ccnd_slab_free(h, s);
+    }
+    if (s == NULL)
+        q->tail = NULL;
+    else
+        s->start += n;
+    return(res);
+}
+
+/**
+ * hashtb node allocator for tables that use the slabs
+ */
+static void *
+ccnd_hashtb_alloc(struct hashtb *ht, size_t size)
+{
+    return(ccnd_slab_alloc(hashtb_get_param(ht, NULL), size));
+}
+
+static void
+ccnd_hashtb_free(struct hashtb *ht, void *p)
+{
+    ccnd_slab_free(hashtb_get_param(ht, NULL), p);
+}
+
+/**
+ * nametree entry allocator for the content store
+ */
+static void *
+content_ccny_alloc(struct ccn_nametree *tree, size_t size)
+{
+    return(ccnd_slab_alloc(tree->data, size));
+}
+
+static void
+content_ccny_free(struct ccn_nametree *tree, void *p)
+{
+    ccnd_slab_free(tree->data, p);
+}
+
 /**
  * Obtain an indexbuf for short-term use
  */
@@ -418,7 +954,10 @@ content_queue_create(struct ccnd_handle *h, struct face *face, enum cq_delay_cla
         q->rand_usec = 2 * usec;
         q->nrun = 0;
         q->send_queue = ccn_indexbuf_create();
-        if (q->send_queue == NULL) {
+        q->enq_usec = ccn_indexbuf_create();
+        if (q->send_queue == NULL || q->enq_usec == NULL) {
+            ccn_indexbuf_destroy(&q->send_queue);
+            ccn_indexbuf_destroy(&q->enq_usec);
             free(q);
             return(NULL);
         }
@@ -449,6 +988,7 @@ content_queue_destroy(struct ccnd_handle *h, struct content_queue **pq)
             }
         }
         ccn_indexbuf_destroy(&q->send_queue);
+        ccn_indexbuf_destroy(&q->enq_usec);
         if (q->sender != NULL) {
             ccn_schedule_cancel(h->sched, q->sender);
             q->sender = NULL;
@@ -699,7 +1239,15 @@ finalize_face(struct hashtb_enumerator *e)
         for (c = 0; c < CCN_CQ_N; c++)
             content_queue_destroy(h, &(face->q[c]));
         ccn_charbuf_destroy(&face->inbuf);
-        ccn_charbuf_destroy(&face->outbuf);
+        outq_destroy(h, &face->outq);
+        dgram_batch_destroy(&face->batch);
+        if (face->pack_ev != NULL) {
+            ccn_schedule_cancel(h->sched, face->pack_ev);
+            face->pack_ev = NULL;
+        }
+        ccn_charbuf_destroy(&face->pack);
+        reasm_destroy(&face->reasm);
+        link_arq_destroy(h, &face->arq);
         ccnd_msg(h, "%s face id %u (slot %u)",
             recycle ? "recycling" : "releasing",
             face->faceid, face->faceid & MAXFACES);
@@ -902,6 +1450,23 @@ content_from_accession(struct ccnd_handle *h, ccn_cookie accession)
     return(ans);
 }
 
+/**
+ * Compile the Exclude of an interest, if it has one
+ *
+ * This pays off when the interest is matched against many content objects.
+ * @returns NULL if there is no Exclude.
+ */
+static struct ccn_exclusion *
+compile_exclude(const unsigned char *interest_msg,
+                const struct ccn_parsed_interest *pi)
+{
+    if (pi->offset[CCN_PI_E_Exclude] <= pi->offset[CCN_PI_B_Exclude])
+        return(NULL);
+    return(ccn_exclusion_compile(interest_msg + pi->offset[CCN_PI_B_Exclude],
+                                 pi->offset[CCN_PI_E_Exclude] -
+                                 pi->offset[CCN_PI_B_Exclude]));
+}
+
 /**
  * Find the first candidate that might match the given interest.
  */
@@ -1135,35 +1700,186 @@ ccnd_n_stale(struct ccnd_handle *h)
 }
 
 /**
- *  Dequeue content from expiry queue when removing it from nametree
+ * Compute the memory that a content store entry is charged for
+ *
+ * This counts the nametree entry with its skiplinks and the content_entry,
+ * plus the packet buffer that holds the ccnb and the key.
  */
-static void
-content_preremove(struct ccn_nametree *ntree, struct ccny *y)
+static size_t
+content_charge(struct ccny *y, struct content_entry *content)
 {
-    struct ccnd_handle *h = NULL;
-    struct content_entry *content = NULL;
+    size_t ans;
     
-    h = ntree->data;
-    content = ccny_payload(y);
-    if (content == NULL)
-        return;
-    if (content->nextx != NULL)
-        content_dequeuex(h, content);
+    ans = ccny_overhead(y) + sizeof(*content);
+    if (content->pkt != NULL)
+        ans += offsetof(struct ccnd_pktbuf, buf) + content->pkt->size;
+    return(ans);
 }
 
 /**
- *  Finalize content, freeing the raw ccnb before the content_entry is freed.
+ * Get the length of the part of a content key before the implicit digest
  */
-static void
-content_finalize(struct ccn_nametree *ntree, struct ccny *y)
+static size_t
+content_name_keylen(struct ccny *y)
 {
-    struct content_entry *content = NULL;
+    const unsigned char *key = ccny_key(y);
+    size_t size = ccny_keylen(y);
+    size_t last = 0;
+    size_t i;
+    int rnc;
+    
+    for (i = 0; i < size; i += CCNFLATSKIP(rnc)) {
+        rnc = ccn_flatname_next_comp(key + i, size - i);
+        if (rnc <= 0)
+            break;
+        last = i;
+    }
+    return(last);
+}
 
-    content = ccny_payload(y);
-    if (content == NULL)
+/**
+ * Add newly accessioned content to the exact-name index
+ */
+static void
+content_name_index_add(struct ccnd_handle *h, struct ccny *y)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct content_name_entry *ne = NULL;
+    int res;
+    
+    hashtb_start(h->content_by_name, e);
+    res = hashtb_seek(e, ccny_key(y), content_name_keylen(y), 0);
+    ne = e->data;
+    if (res == HT_NEW_ENTRY)
+        ne->content = ccny_payload(y);
+    else if (res == HT_OLD_ENTRY)
+        ne->content = NULL;
+    if (ne != NULL)
+        ne->n++;
+    hashtb_end(e);
+}
+
+/**
+ * Remove content from the exact-name index
+ */
+static void
+content_name_index_remove(struct ccnd_handle *h, struct ccny *y)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct content_name_entry *ne = NULL;
+    int res;
+    
+    if (h->content_by_name == NULL)
+        return;
+    hashtb_start(h->content_by_name, e);
+    res = hashtb_seek(e, ccny_key(y), content_name_keylen(y), 0);
+    ne = e->data;
+    if (res == HT_OLD_ENTRY) {
+        if (ne->content == ccny_payload(y))
+            ne->content = NULL;
+        ne->n--;
+    }
+    if (ne != NULL && ne->n == 0)
+        hashtb_delete(e);
+    hashtb_end(e);
+}
+
+/**
+ * Answer an interest for a single exact name from the exact-name index
+ *
+ * This applies when the interest leaves no room for name components
+ * other than the implicit digest, which is the usual case for segmented
+ * content, so that there is at most one candidate in the usual case.
+ *
+ * @returns 1 if the answer is known, in which case *pcontent is set to
+ *          the matching content, or NULL if there is none in memory;
+ *          0 if the content tree needs to be searched.
+ */
+static int
+content_exact_match(struct ccnd_handle *h,
+                    const unsigned char *msg, size_t size,
+                    const struct ccn_parsed_interest *pi,
+                    struct ccn_charbuf *flatname, int s_ok,
+                    struct content_entry **pcontent)
+{
+    struct content_name_entry *ne = NULL;
+    struct content_entry *content = NULL;
+    size_t keylen = flatname->length;
+    size_t i;
+    int rnc;
+    
+    *pcontent = NULL;
+    if (pi->max_suffix_comps == 0 && pi->prefix_comps > 0) {
+        /* The interest name ends with the digest; leave it off the key */
+        for (i = 0; i < flatname->length; i += CCNFLATSKIP(rnc)) {
+            rnc = ccn_flatname_next_comp(flatname->buf + i,
+                                         flatname->length - i);
+            if (rnc <= 0)
+                return(0);
+            keylen = i;
+        }
+    }
+    else if (pi->max_suffix_comps != 1)
+        return(0);
+    ne = hashtb_lookup(h->content_by_name, flatname->buf, keylen);
+    if (ne == NULL)
+        return(1);
+    content = ne->content;
+    if (ne->n != 1 || content == NULL)
+        return(0);
+    if (!s_ok && is_stale(h, content))
+        return(0);
+    if (ccn_content_matches_interest(content->ccnb, content->size, 1, NULL,
+                                     msg, size, pi))
+        *pcontent = content;
+    return(1);
+}
+
+/**
+ *  Dequeue content from expiry queue when removing it from nametree,
+ *  and stop charging the content store for it
+ *
+ * The replacement policy is also told that the content is going.
+ */
+static void
+content_preremove(struct ccn_nametree *ntree, struct ccny *y)
+{
+    struct ccnd_handle *h = NULL;
+    struct content_entry *content = NULL;
+    
+    h = ntree->data;
+    content = ccny_payload(y);
+    if (content == NULL)
+        return;
+    if (content->nextx != NULL)
+        content_dequeuex(h, content);
+    if (content->accession != 0) {
+        h->cs_bytes -= content_charge(y, content);
+        content_name_index_remove(h, y);
+    }
+    ccnd_cs_remove(h, content);
+}
+
+/**
+ *  Finalize content, releasing the raw ccnb before the content_entry is freed.
+ *
+ * The nametree key lives in the same packet buffer as the ccnb, so
+ * it must not be freed by the nametree.
+ */
+static void
+content_finalize(struct ccn_nametree *ntree, struct ccny *y)
+{
+    struct content_entry *content = NULL;
+
+    content = ccny_payload(y);
+    if (content == NULL)
         return;
-    free(content->ccnb);
+    if (content->pkt != NULL)
+        ccny_set_key_fields(y, NULL, 0);
     content->ccnb = NULL;
+    pktbuf_release(&content->pkt);
 }
 
 /**
@@ -1257,11 +1973,13 @@ finalize_interest(struct hashtb_enumerator *e)
             if (face != NULL)
                 face->outstanding_interests -= 1;
         }
-        free(p);
+        ccnd_slab_free(h, p);
     }
     ie->strategy.pfl = NULL;
     ie->strategy.ie = NULL;
+    ccn_exclusion_destroy(&ie->excl);
     ie->interest_msg = NULL; /* part of hashtb, don't free this */
+    pktbuf_release(&ie->pkt);
 }
 
 /**
@@ -1270,8 +1988,8 @@ finalize_interest(struct hashtb_enumerator *e)
  * If nonce is NULL and the interest message has a nonce, the latter will
  * be used.
  *
- * The nonce will be added to the nonce table if it is not already there.
- * Some expired entries may be trimmed.
+ * The nonce will be added to the nonce table if it is not already there,
+ * and is remembered for CCND_NONCE_LIFETIME after it was last seen.
  *
  * @returns 0 if a duplicate, unexpired nonce exists, 1 if nonce is new,
  *          2 if duplicate is from originating face, or 3 if the interest
@@ -1282,12 +2000,6 @@ nonce_ok(struct ccnd_handle *h, struct face *face,
          const unsigned char *interest_msg, struct ccn_parsed_interest *pi,
          const unsigned char *nonce, size_t noncesize)
 {
-    struct hashtb_enumerator ee;
-    struct hashtb_enumerator *e = &ee;
-    struct nonce_entry *nce = NULL;
-    int res;
-    int i;
-    
     if (nonce == NULL) {
         nonce = interest_msg + pi->offset[CCN_PI_B_Nonce];
         noncesize = pi->offset[CCN_PI_E_Nonce] - pi->offset[CCN_PI_B_Nonce];
@@ -1298,68 +2010,8 @@ nonce_ok(struct ccnd_handle *h, struct face *face,
                             pi->offset[CCN_PI_E_Nonce],
                             &nonce, &noncesize);
     }
-    hashtb_start(h->nonce_tab, e);
-    /* Remove a few expired nonces */
-    for (i = 0; i < 10; i++) {
-        if (h->ncehead.next == &h->ncehead)
-            break;
-        nce = (void *)h->ncehead.next;
-        if (wt_compare(nce->expiry, h->wtnow) >= 0)
-            break;
-        res = hashtb_seek(e, nce->key, nce->size, 0);
-        if (res != HT_OLD_ENTRY) abort();
-        hashtb_delete(e);
-    }
-    /* Look up or add the given nonce */
-    res = hashtb_seek(e, nonce, noncesize, 0);
-    if (res < 0)
-        return(res);
-    nce = e->data;
-    if (res == HT_NEW_ENTRY) {
-        nce->ll.next = NULL;
-        nce->faceid = (face != NULL) ? face->faceid : CCN_NO_FACEID;
-        nce->key = e->key;
-        nce->size = e->keysize;
-        res = 1;
-    }
-    else if (face != NULL && face->faceid == nce->faceid) {
-        /* From same face as before, count as a refresh */
-        res = 2;
-    }
-    else {
-        if (wt_compare(nce->expiry, h->wtnow) < 0)
-            res = 1; /* nonce's expiry has passed, count as new */
-        else
-            res = 0; /* nonce is duplicate */
-    }
-    /* Re-insert it at the end of the expiry queue */
-    if (nce->ll.next != NULL) {
-        nce->ll.next->prev = nce->ll.prev;
-        nce->ll.prev->next = nce->ll.next;
-        nce->ll.next = nce->ll.prev = NULL;
-    }
-    nce->ll.next = &h->ncehead;
-    nce->ll.prev = h->ncehead.prev;
-    nce->ll.next->prev = nce->ll.prev->next = &nce->ll;
-    nce->expiry = h->wtnow + 6 * WTHZ; // XXX hardcoded 6 seconds
-    hashtb_end(e);
-    return(res);
-}
-
-/**
- * Clean up a nonce_entry when it is removed from its hash table.
- */
-static void
-finalize_nonce(struct hashtb_enumerator *e)
-{
-    struct nonce_entry *nce = e->data;
-    
-    /* If this entry is in the expiry queue, remove it. */
-    if (nce->ll.next != NULL) {
-        nce->ll.next->prev = nce->ll.prev;
-        nce->ll.prev->next = nce->ll.next;
-        nce->ll.next = nce->ll.prev = NULL;
-    }
+    return(ccnd_nonce_check(h->nonce_tab, h->wtnow, nonce, noncesize,
+                            (face != NULL) ? face->faceid : CCN_NO_FACEID));
 }
 
 /**
@@ -1502,12 +2154,15 @@ record_connection(struct ccnd_handle *h, int fd,
         addrspace = ((unsigned char *)e->key) + e->keysize;
         face->addr = (struct sockaddr *)addrspace;
         memcpy(addrspace, who, e->extsize);
+        face->pollevents = -1;
         init_face_flags(h, face, setflags);
         res = enroll_face(h, face);
         if (res == -1) {
             hashtb_delete(e);
             face = NULL;
         }
+        else
+            ccnd_face_events_changed(h, face);
     }
     hashtb_end(e);
     return(face);
@@ -1600,8 +2255,8 @@ make_connection(struct ccnd_handle *h,
     }
     if ((face->flags & CCN_FACE_CONNECTING) != 0) {
         ccnd_msg(h, "connecting to client fd=%d id=%u", fd, face->faceid);
-        face->outbufindex = 0;
-        face->outbuf = ccn_charbuf_create();
+        face->outq = outq_create(h);
+        ccnd_face_events_changed(h, face);
     }
     else
         ccnd_msg(h, "connected client fd=%d id=%u", fd, face->faceid);
@@ -1737,11 +2392,15 @@ shutdown_client_fd(struct ccnd_handle *h, int fd)
             hashtb_end(e);
             return;
         }
+#ifdef CCND_HAVE_EPOLL
+        if (h->epfd != -1 && face->pollevents != -1)
+            epoll_ctl(h->epfd, EPOLL_CTL_DEL, fd, NULL);
+#endif
         close(fd);
         face->recv_fd = -1;
         ccnd_msg(h, "shutdown client fd=%d id=%u", fd, faceid);
         ccn_charbuf_destroy(&face->inbuf);
-        ccn_charbuf_destroy(&face->outbuf);
+        outq_destroy(h, &face->outq);
         face = NULL;
     }
     hashtb_delete(e);
@@ -1767,7 +2426,8 @@ send_content(struct ccnd_handle *h, struct face *face, struct content_entry *con
     size = content->size;
     if (h->debug & 4)
         ccnd_debug_content(h, __LINE__, "content_to", face, content);
-    stuff_and_send(h, face, content->ccnb, size, NULL, 0, 0, 0);
+    stuff_and_send(h, face, content->pkt, content->ccnb, size, NULL, 0, 0, 0);
+    ccnd_cs_touch(h, content);
     ccnd_meter_bump(h, face->meter[FM_DATO], 1);
     h->content_items_sent += 1;
 }
@@ -1790,6 +2450,22 @@ choose_content_delay_class(struct ccnd_handle *h, unsigned faceid, int content_f
     return(CCN_CQ_NORMAL); /* default */
 }
 
+/**
+ * Decide whether content on a face should be held for duplicate suppression
+ *
+ * On a party line some other node may answer the same interest, and a
+ * short randomized delay gives us the chance to see that and keep quiet.
+ * A point-to-point link has nobody to overhear, so there content goes
+ * out as soon as the link can take it.
+ */
+static int
+face_suppresses_content(struct ccnd_handle *h, struct face *face)
+{
+    if ((face->flags & (CCN_FACE_MCAST | CCN_FACE_BC)) != 0)
+        return(1);
+    return(faceattr_get(h, face, FAI_BROADCAST_CAPABLE) != 0);
+}
+
 /**
  * Pick a randomized delay for sending
  *
@@ -1814,6 +2490,152 @@ randomize_content_delay(struct ccnd_handle *h, struct content_queue *q)
     return(usec);
 }
 
+/**
+ * Microsecond clock for content queue sojourn times
+ *
+ * This wraps every 71 minutes or so, so only differences are meaningful.
+ */
+static unsigned
+cq_usec(struct ccnd_handle *h)
+{
+    return((unsigned)h->sec * 1000000U + (unsigned)h->usec);
+}
+
+/**
+ * Integer square root, for the queue management control law
+ */
+static unsigned
+cq_isqrt(unsigned n)
+{
+    unsigned x = n;
+    unsigned y;
+    
+    if (n < 2)
+        return(n);
+    y = (x + 1) / 2;
+    while (y < x) {
+        x = y;
+        y = (x + n / x) / 2;
+    }
+    return(x);
+}
+
+/**
+ * Decide whether content leaving a queue should be dropped
+ *
+ * This is the CoDel algorithm, applied to the time each item spent
+ * waiting in the queue beyond the delay that the queue imposes on
+ * purpose.  Once that excess has stayed above the target for a whole
+ * interval, items are dropped at a rate that rises with the square root
+ * of the number of drops, until the excess falls below the target again.
+ * The queue keeps its smoothed sojourn time for the status page whether
+ * or not dropping is enabled.
+ *
+ * There is no way to mark a ContentObject as having seen congestion, so
+ * dropping is the only signal; the content stays in the store, so a
+ * retransmitted interest is answered from there.
+ *
+ * @param sojourn is the time in microseconds this item spent queued
+ * @param left is the number of items that remain behind it
+ * @returns 1 if the item should be dropped, 0 to send it.
+ */
+static int
+cq_should_drop(struct ccnd_handle *h, struct content_queue *q,
+               unsigned sojourn, int left)
+{
+    unsigned now = cq_usec(h);
+    unsigned target = h->aqm_target_usec;
+    unsigned interval = CCND_AQM_INTERVAL_MICROSEC;
+    unsigned excess;
+    int ok_to_drop = 0;
+    
+    q->sojourn_usec += ((int)sojourn - (int)q->sojourn_usec) / 8;
+    if (target == 0)
+        return(0);
+    excess = q->min_usec + q->rand_usec;
+    excess = (sojourn > excess) ? sojourn - excess : 0;
+    if (excess < target || left == 0)
+        q->first_above = 0;
+    else if (q->first_above == 0)
+        q->first_above = (now + interval) | 1;
+    else if ((int)(now - q->first_above) >= 0)
+        ok_to_drop = 1;
+    if (q->dropping) {
+        if (!ok_to_drop) {
+            q->dropping = 0;
+            return(0);
+        }
+        if ((int)(now - q->drop_next) < 0)
+            return(0);
+        q->drop_count++;
+        q->drop_next += interval / cq_isqrt(q->drop_count);
+        return(1);
+    }
+    if (!ok_to_drop)
+        return(0);
+    q->dropping = 1;
+    /* Pick up near the old drop rate if we were dropping recently */
+    if (q->drop_count > 2 && (int)(now - q->drop_next) < 16 * (int)interval)
+        q->drop_count -= 2;
+    else
+        q->drop_count = 1;
+    q->drop_next = now + interval / cq_isqrt(q->drop_count);
+    return(1);
+}
+
+/**
+ * Send item i of a content queue, unless queue management drops it
+ *
+ * When the content is sent, the link time it takes at burst_nsec per
+ * KByte is added to *nsec.
+ * @returns 1 if sent, 0 if dropped, -1 if the content is no longer
+ *          in the store, or -2 if the face went away.
+ */
+static int
+content_queue_send_item(struct ccnd_handle *h, struct face *face,
+                        struct content_queue *q, int i,
+                        int burst_nsec, int *nsec)
+{
+    struct content_entry *content = NULL;
+    unsigned faceid = face->faceid;
+    
+    content = content_from_accession(h, q->send_queue->buf[i]);
+    if (content == NULL)
+        return(-1);
+    if (cq_should_drop(h, q, cq_usec(h) - q->enq_usec->buf[i],
+                       q->send_queue->n - i - 1)) {
+        if (h->debug & 8)
+            ccnd_debug_content(h, __LINE__, "content_aqm_drop", face, content);
+        content->refs--;
+        face->cq_drops++;
+        return(0);
+    }
+    send_content(h, face, content);
+    content->refs--;
+    /* face may have vanished, bail out if it did */
+    if (face_from_faceid(h, faceid) == NULL)
+        return(-2);
+    *nsec += burst_nsec * (unsigned)((content->size + 1023) / 1024);
+    return(1);
+}
+
+/**
+ * Remove the first n items of a content queue
+ * @returns the number of items left.
+ */
+static int
+content_queue_trim(struct content_queue *q, int n)
+{
+    int i, j;
+    
+    for (i = n, j = 0; i < q->send_queue->n; i++, j++) {
+        q->send_queue->buf[j] = q->send_queue->buf[i];
+        q->enq_usec->buf[j] = q->enq_usec->buf[i];
+    }
+    q->send_queue->n = q->enq_usec->n = j;
+    return(j);
+}
+
 /**
  * Scheduled event for sending from a queue.
  */
@@ -1824,6 +2646,7 @@ content_sender(struct ccn_schedule *sched,
     int flags)
 {
     int i, j;
+    int res;
     int delay;
     int nsec;
     int burst_nsec;
@@ -1844,6 +2667,34 @@ content_sender(struct ccn_schedule *sched,
         goto Bail;
     if ((face->flags & CCN_FACE_NOSEND) != 0)
         goto Bail;
+    /* Hold back while the socket is not keeping up */
+    if (face->outq != NULL && face->outq->bytes > CCND_OUTQ_LIMIT / 2)
+        return(10000);
+    if (!face_suppresses_content(h, face)) {
+        /*
+         * Point-to-point: everything queued is ready now, paced at a
+         * little more than the rate the link has been seen to drain.
+         */
+        nsec = 0;
+        burst_nsec = q->burst_nsec;
+        if (face->pace_nsec > burst_nsec)
+            burst_nsec = face->pace_nsec - face->pace_nsec / 8;
+        for (i = 0; i < q->send_queue->n && nsec < 1000000; i++) {
+            if (content_queue_send_item(h, face, q, i, burst_nsec, &nsec) == -2)
+                goto Bail;
+        }
+        q->ready = j = content_queue_trim(q, i);
+        q->nrun = 0;
+        if (j == 0)
+            goto Bail;
+        /* The link kept up at this pace, so probe for a faster one */
+        if (face->outq == NULL && face->pace_nsec != 0) {
+            face->pace_nsec -= face->pace_nsec / 16;
+            if (face->pace_nsec <= q->burst_nsec)
+                face->pace_nsec = 0;
+        }
+        return((nsec + 499) / 1000 + 1);
+    }
     /* Send the content at the head of the queue */
     if (q->ready > q->send_queue->n ||
         (q->ready == 0 && q->nrun >= 12 && q->nrun < 120))
@@ -1856,25 +2707,18 @@ content_sender(struct ccn_schedule *sched,
     if (burst_max == 0)
         q->nrun = 0;
     for (i = 0; i < burst_max && nsec < 1000000; i++) {
-        content = content_from_accession(h, q->send_queue->buf[i]);
-        if (content == NULL)
+        res = content_queue_send_item(h, face, q, i, burst_nsec, &nsec);
+        if (res == -2)
+            goto Bail;
+        if (res == -1)
             q->nrun = 0;
-        else {
-            send_content(h, face, content);
-            content->refs--;
-            /* face may have vanished, bail out if it did */
-            if (face_from_faceid(h, faceid) == NULL)
-                goto Bail;
-            nsec += burst_nsec * (unsigned)((content->size + 1023) / 1024);
+        else if (res == 1)
             q->nrun++;
-        }
     }
     if (q->ready < i) abort();
     q->ready -= i;
     /* Update queue */
-    for (j = 0; i < q->send_queue->n; i++, j++)
-        q->send_queue->buf[j] = q->send_queue->buf[i];
-    q->send_queue->n = j;
+    j = content_queue_trim(q, i);
     /* Do a poll before going on to allow others to preempt send. */
     delay = (nsec + 499) / 1000 + 1;
     if (q->ready > 0) {
@@ -1905,7 +2749,7 @@ content_sender(struct ccn_schedule *sched,
             return(delay);
         }
     }
-    q->send_queue->n = q->ready = 0;
+    q->send_queue->n = q->enq_usec->n = q->ready = 0;
 Bail:
     q->sender = NULL;
     return(0);
@@ -1947,10 +2791,18 @@ face_send_queue_insert(struct ccnd_handle *h,
     }
     n = q->send_queue->n;
     ans = ccn_indexbuf_set_insert(q->send_queue, content->accession);
-    if (n != q->send_queue->n)
+    if (n != q->send_queue->n) {
         content->refs++;
+        if (ccn_indexbuf_append_element(q->enq_usec, cq_usec(h)) < 0) {
+            q->send_queue->n = n;
+            content->refs--;
+            return(-1);
+        }
+    }
     if (q->sender == NULL) {
-        delay = randomize_content_delay(h, q);
+        delay = 1;
+        if (face_suppresses_content(h, face))
+            delay = randomize_content_delay(h, q);
         q->ready = q->send_queue->n;
         q->sender = ccn_schedule_event(h->sched, delay,
                                        content_sender, q, face->faceid);
@@ -2013,8 +2865,9 @@ consume_matching_interests(struct ccnd_handle *h,
             continue;
         if (face != NULL && is_pending_on(h, p, face->faceid) == 0)
             continue;
-        if (ccn_content_matches_interest(content_msg, content_size, 1, pc,
-                                         p->interest_msg, p->size, NULL)) {
+        if (ccn_content_matches_interest_excl(content_msg, content_size, 1, pc,
+                                              p->interest_msg, p->size,
+                                              &p->pi, p->excl)) {
             if (content_face != NULL)
                 strategy_callout(h, p, CCNST_SATISFIED, content_face->faceid);
             for (x = p->strategy.pfl; x != NULL; x = x->next) {
@@ -2046,35 +2899,16 @@ match_interests(struct ccnd_handle *h, struct content_entry *content,
 {
     int n_matched = 0;
     int new_matches;
-    int ci;
-    struct ccn_charbuf *name = NULL;
-    struct ccn_indexbuf *namecomps = NULL;
-    unsigned c0 = 0;
-    const unsigned char *key = NULL;
     struct nameprefix_entry *npe = NULL;
     struct ccny *y = NULL;
     
     y = ccny_from_cookie(h->content_tree, content->accession);
     if (y == NULL) abort();
-    name = charbuf_obtain(h);
-    ccn_name_init(name);
-    ccn_name_append_flatname(name, ccny_key(y), ccny_keylen(y), 0, -1);
-    namecomps = indexbuf_obtain(h);
-    ccn_name_split(name, namecomps);
-    c0 = namecomps->buf[0];
-    key = name->buf + c0;
-    for (ci = namecomps->n - 1; ci >= 0; ci--) {
-        int size = namecomps->buf[ci] - c0;
-        npe = hashtb_lookup(h->nameprefix_tab, key, size);
-        if (npe != NULL)
-            break;
-    }
-    charbuf_release(h, name);
-    name = NULL;
-    indexbuf_release(h, namecomps);
-    namecomps = NULL;
+    npe = hashtb_lookup(h->nameprefix_tab, "", 0);
+    npe = ccnd_lpm_match(h->nameprefix_index, npe,
+                         ccny_key(y), ccny_keylen(y), NULL);
     for (; npe != NULL; npe = npe->parent) {
-        if (npe->fgen != h->forward_to_gen)
+        if (forward_to_stale(h, npe))
             update_forward_to(h, npe);
         if (from_face != NULL && (npe->flags & CCN_FORW_LOCAL) != 0 &&
             (from_face->flags & CCN_FACE_GG) == 0)
@@ -2086,66 +2920,275 @@ match_interests(struct ccnd_handle *h, struct content_entry *content,
     return(n_matched);
 }
 
+/** Room to leave in a packed datagram for the PDU wrapper and link stuff */
+#define CCND_PACK_SLOP 16
+
 /**
- * Send a message in a PDU, possibly stuffing other interest messages into it.
- * The message may be in two pieces.
+ * Send whatever is waiting in the packer of a datagram face.
+ *
+ * A lone message goes out just as it would have without the packer.
+ * Two or more are wrapped in a CCNProtocolDataUnit if the other side
+ * is known to accept one, that is, if it has sent us a PDU or told us
+ * its LinkMTU.  Otherwise they just go out one after another, as
+ * stuffed interests always have.
  */
 static void
-stuff_and_send(struct ccnd_handle *h, struct face *face,
-               const unsigned char *data1, size_t size1,
-               const unsigned char *data2, size_t size2,
-               const char *tag, int lineno) {
+pack_flush(struct ccnd_handle *h, struct face *face)
+{
+    struct ccn_charbuf *p = face->pack;
     struct ccn_charbuf *c = NULL;
     
-    if ((face->flags & CCN_FACE_LINK) != 0) {
+    if (face->pack_ev != NULL) {
+        ccn_schedule_cancel(h->sched, face->pack_ev);
+        face->pack_ev = NULL;
+    }
+    if (p == NULL || face->pack_n == 0)
+        return;
+    if ((face->flags & CCN_FACE_LINK) == 0 &&
+        (face->pack_n == 1 || face->frag_mtu == 0)) {
+        ccn_stuff_interest(h, face, p);
+        ccn_append_link_stuff(h, face, p);
+        ccnd_send(h, face, p->buf, p->length);
+    }
+    else {
         c = charbuf_obtain(h);
-        ccn_charbuf_reserve(c, size1 + size2 + 5 + 8);
         ccnb_element_begin(c, CCN_DTAG_CCNProtocolDataUnit);
-        ccn_charbuf_append(c, data1, size1);
-        if (size2 != 0)
-            ccn_charbuf_append(c, data2, size2);
-        if (tag != NULL)
-            ccnd_debug_ccnb(h, lineno, tag, face, c->buf + 4, c->length - 4);
+        ccn_charbuf_append(c, p->buf, p->length);
         ccn_stuff_interest(h, face, c);
         ccn_append_link_stuff(h, face, c);
         ccnb_element_end(c);
+        ccnd_send(h, face, c->buf, c->length);
+        charbuf_release(h, c);
     }
-    else if (size2 != 0 || h->mtu > size1 + size2 ||
-             (face->flags & (CCN_FACE_SEQOK | CCN_FACE_SEQPROBE)) != 0 ||
-             face->recvcount <= 1) {
-        c = charbuf_obtain(h);
-        ccn_charbuf_append(c, data1, size1);
-        if (size2 != 0)
-            ccn_charbuf_append(c, data2, size2);
-        if (tag != NULL)
-            ccnd_debug_ccnb(h, lineno, tag, face, c->buf, c->length);
-        ccn_stuff_interest(h, face, c);
-        ccn_append_link_stuff(h, face, c);
-    }
-    else {
-        /* avoid a copy in this case */
-        if (tag != NULL)
-            ccnd_debug_ccnb(h, lineno, tag, face, data1, size1);
-        ccnd_send(h, face, data1, size1);
-        return;
+    p->length = 0;
+    face->pack_n = 0;
+}
+
+/**
+ * Scheduled event that sends a partly filled packed datagram
+ */
+static int
+pack_sender(struct ccn_schedule *sched,
+            void *clienth,
+            struct ccn_scheduled_event *ev,
+            int flags)
+{
+    struct ccnd_handle *h = clienth;
+    struct face *face = NULL;
+    (void)sched;
+    
+    if ((flags & CCN_SCHEDULE_CANCEL) != 0)
+        return(0);
+    face = face_from_faceid(h, ev->evint);
+    if (face != NULL && face->pack_ev == ev) {
+        face->pack_ev = NULL;
+        pack_flush(h, face);
     }
-    ccnd_send(h, face, c->buf, c->length);
-    charbuf_release(h, c);
-    return;
+    return(0);
 }
 
 /**
- * Append a link-check interest if appropriate.
+ * Add a message to the packer of a datagram face.
  *
- * @returns the number of messages that were stuffed.
+ * The message may be in two pieces.  Whatever is already waiting is
+ * sent first if the new message would overflow the MTU.  The first
+ * message to arrive starts the clock; the datagram goes out no later
+ * than pack_microsec after that.
+ * @returns -1 if the message is too big to be packed, or 0 if it
+ *          has been taken.
  */
 static int
-stuff_link_check(struct ccnd_handle *h,
-                   struct face *face, struct ccn_charbuf *c)
+pack_append(struct ccnd_handle *h, struct face *face,
+            const unsigned char *data1, size_t size1,
+            const unsigned char *data2, size_t size2,
+            const char *tag, int lineno)
 {
-    int checkflags = CCN_FACE_DGRAM | CCN_FACE_MCAST | CCN_FACE_GG | CCN_FACE_LC;
-    int wantflags = CCN_FACE_DGRAM;
-    struct ccn_charbuf *name = NULL;
+    struct ccn_charbuf *p = face->pack;
+    size_t size = size1 + size2;
+    
+    if (size + CCND_PACK_SLOP > h->mtu) {
+        pack_flush(h, face);
+        return(-1);
+    }
+    if (p != NULL && p->length + size + CCND_PACK_SLOP > h->mtu)
+        pack_flush(h, face);
+    if (p == NULL) {
+        p = face->pack = ccn_charbuf_create();
+        if (p == NULL)
+            return(-1);
+    }
+    ccn_charbuf_append(p, data1, size1);
+    if (size2 != 0)
+        ccn_charbuf_append(p, data2, size2);
+    if (tag != NULL)
+        ccnd_debug_ccnb(h, lineno, tag, face, p->buf + p->length - size, size);
+    face->pack_n++;
+    if (face->pack_ev == NULL)
+        face->pack_ev = ccn_schedule_event(h->sched, h->pack_microsec,
+                                           pack_sender, NULL, face->faceid);
+    return(0);
+}
+
+/** Room to leave in a fragment for the PDU wrapper and fragment header */
+#define CCND_FRAG_SLOP 48
+
+/**
+ * Send a message that is too big for the link as a series of fragments.
+ *
+ * This is only done if the other side has told us its MTU, and is
+ * numbering its packets, so we may number ours.  Each fragment goes in
+ * its own PDU, and the sequence numbers of these are consecutive.
+ * @returns 0 if the message has been sent, or -1 if it should be sent
+ *          in the ordinary way.
+ */
+static int
+send_fragments(struct ccnd_handle *h, struct face *face,
+               const unsigned char *data1, size_t size1,
+               const unsigned char *data2, size_t size2,
+               const char *tag, int lineno)
+{
+    struct ccn_charbuf *c = NULL;
+    struct ccn_charbuf *f = NULL;
+    const unsigned char *msg = data1;
+    size_t size = size1 + size2;
+    size_t limit;
+    size_t chunk;
+    size_t len;
+    unsigned i;
+    unsigned n;
+    
+    if (face->frag_mtu == 0 || (face->flags & CCN_FACE_SEQOK) == 0)
+        return(-1);
+    limit = h->mtu;
+    if (face->frag_mtu < limit)
+        limit = face->frag_mtu;
+    if (limit < 256 || size + CCND_PACK_SLOP <= limit)
+        return(-1);
+    chunk = limit - CCND_FRAG_SLOP;
+    n = (size + chunk - 1) / chunk;
+    if (n > CCND_FRAG_MAX)
+        return(-1);
+    if (size2 != 0) {
+        c = charbuf_obtain(h);
+        ccn_charbuf_append(c, data1, size1);
+        ccn_charbuf_append(c, data2, size2);
+        msg = c->buf;
+    }
+    if (tag != NULL)
+        ccnd_debug_ccnb(h, lineno, tag, face, msg, size);
+    f = ccn_charbuf_create();
+    for (i = 0; i < n; i++) {
+        len = (i + 1 < n) ? chunk : size - i * chunk;
+        f->length = 0;
+        ccnb_element_begin(f, CCN_DTAG_CCNProtocolDataUnit);
+        ccn_append_link_stuff(h, face, f);
+        ccnb_element_begin(f, CCN_DTAG_Fragment);
+        ccnb_append_tagged_binary_number(f, CCN_DTAG_FragmentIndex, i);
+        ccnb_append_tagged_binary_number(f, CCN_DTAG_FragmentCount, n);
+        ccn_charbuf_append_tt(f, len, CCN_BLOB);
+        ccn_charbuf_append(f, msg + i * chunk, len);
+        ccnb_element_end(f);
+        ccnb_element_end(f);
+        ccnd_send(h, face, f->buf, f->length);
+    }
+    ccn_charbuf_destroy(&f);
+    if (c != NULL)
+        charbuf_release(h, c);
+    return(0);
+}
+
+/**
+ * Send a message in a PDU, possibly stuffing other interest messages into it.
+ * The message may be in two pieces.
+ *
+ * When an MTU is configured, messages for datagram faces that are small
+ * enough go by way of the packer instead, and those that are too big are
+ * fragmented if the other side can reassemble them.
+ *
+ * If pkt1 is not NULL, it is the packet buffer that holds data1; when the
+ * message goes out unchanged, output queues may then share it instead of
+ * making a copy.
+ */
+static void
+stuff_and_send(struct ccnd_handle *h, struct face *face,
+               struct ccnd_pktbuf *pkt1,
+               const unsigned char *data1, size_t size1,
+               const unsigned char *data2, size_t size2,
+               const char *tag, int lineno) {
+    struct ccn_charbuf *c = NULL;
+    
+    if ((face->flags & CCN_FACE_DGRAM) != 0 && h->mtu > 0) {
+        if (pack_append(h, face, data1, size1, data2, size2, tag, lineno) == 0)
+            return;
+        if (send_fragments(h, face, data1, size1, data2, size2, tag, lineno) == 0)
+            return;
+    }
+    if ((face->flags & CCN_FACE_LINK) != 0) {
+        c = charbuf_obtain(h);
+        ccn_charbuf_reserve(c, size1 + size2 + 5 + 8);
+        ccnb_element_begin(c, CCN_DTAG_CCNProtocolDataUnit);
+        ccn_charbuf_append(c, data1, size1);
+        if (size2 != 0)
+            ccn_charbuf_append(c, data2, size2);
+        if (tag != NULL)
+            ccnd_debug_ccnb(h, lineno, tag, face, c->buf + 4, c->length - 4);
+        ccn_stuff_interest(h, face, c);
+        ccn_append_link_stuff(h, face, c);
+        ccnb_element_end(c);
+    }
+    else if (h->mtu > size1 + size2 ||
+             (face->flags & (CCN_FACE_SEQOK | CCN_FACE_SEQPROBE)) != 0 ||
+             face->recvcount <= 1) {
+        c = charbuf_obtain(h);
+        ccn_charbuf_append(c, data1, size1);
+        if (size2 != 0)
+            ccn_charbuf_append(c, data2, size2);
+        if (tag != NULL)
+            ccnd_debug_ccnb(h, lineno, tag, face, c->buf, c->length);
+        ccn_stuff_interest(h, face, c);
+        ccn_append_link_stuff(h, face, c);
+    }
+    else if (size2 != 0) {
+        /* send the pieces as they are */
+        struct iovec iov[2];
+        if (tag != NULL) {
+            c = charbuf_obtain(h);
+            ccn_charbuf_append(c, data1, size1);
+            ccn_charbuf_append(c, data2, size2);
+            ccnd_debug_ccnb(h, lineno, tag, face, c->buf, c->length);
+            charbuf_release(h, c);
+        }
+        iov[0].iov_base = (void *)data1;
+        iov[0].iov_len = size1;
+        iov[1].iov_base = (void *)data2;
+        iov[1].iov_len = size2;
+        ccnd_send_iov(h, face, pkt1, iov, 2);
+        return;
+    }
+    else {
+        /* avoid a copy in this case */
+        if (tag != NULL)
+            ccnd_debug_ccnb(h, lineno, tag, face, data1, size1);
+        ccnd_send_pkt(h, face, pkt1, data1, size1);
+        return;
+    }
+    ccnd_send(h, face, c->buf, c->length);
+    charbuf_release(h, c);
+    return;
+}
+
+/**
+ * Append a link-check interest if appropriate.
+ *
+ * @returns the number of messages that were stuffed.
+ */
+static int
+stuff_link_check(struct ccnd_handle *h,
+                   struct face *face, struct ccn_charbuf *c)
+{
+    int checkflags = CCN_FACE_DGRAM | CCN_FACE_MCAST | CCN_FACE_GG | CCN_FACE_LC;
+    int wantflags = CCN_FACE_DGRAM;
+    struct ccn_charbuf *name = NULL;
     struct ccn_charbuf *ibuf = NULL;
     int res;
     int ans = 0;
@@ -2194,6 +3237,344 @@ ccn_stuff_interest(struct ccnd_handle *h,
     return(n_stuffed);
 }
 
+/**
+ * A datagram kept for retransmission until the other side acknowledges it
+ */
+struct ccnd_rtx_slot {
+    struct ccn_charbuf *pkt;    /**< the datagram, as sent */
+    unsigned seq;               /**< its SequenceNumber */
+    ccn_wrappedtime sent;       /**< when it was last sent */
+    int tries;                  /**< number of retransmissions */
+    int busy;                   /**< nonzero if waiting for an ack */
+};
+
+#define CCND_LINK_ACK_MICROSEC 2000 /**< longest wait to piggyback an ack */
+#define CCND_LINK_RTO_MIN 4         /**< least retransmit timeout, WTHZ units */
+#define CCND_LINK_SRTT_INIT 50      /**< rtt to assume until measured */
+
+/**
+ * Link-level acknowledgement and retransmission state of a face
+ *
+ * This is only set up when CCND_LINK_ACK is enabled, for unicast datagram
+ * faces that number their packets.
+ */
+struct ccnd_link_arq {
+    /* Receiving side */
+    unsigned ack_high;          /**< highest sequence number received */
+    uint32_t ack_bits;          /**< bit i set if ack_high - i was received */
+    int ack_valid;              /**< set once ack_high is meaningful */
+    int ack_due;                /**< an ack should be sent */
+    unsigned ack_probe;         /**< packets received before peer acks */
+    struct ccn_scheduled_event *ack_ev; /**< sends a bare ack */
+    /* Sending side */
+    unsigned peer_high;         /**< ack_high most recently heard from peer */
+    int peer_valid;             /**< set once peer_high is meaningful */
+    int pending;                /**< next datagram sent carries pending_seq */
+    unsigned pending_seq;       /**< SequenceNumber just appended */
+    unsigned srtt8;             /**< smoothed rtt, WTHZ units times 8 */
+    int nbusy;                  /**< number of busy slots */
+    struct ccn_scheduled_event *rtx_ev; /**< retransmission timer */
+    struct ccnd_rtx_slot slot[CCND_LINK_RTX_SLOTS]; /**< indexed by seq */
+};
+
+/**
+ * Get the link ack state of a face, creating it if need be
+ */
+static struct ccnd_link_arq *
+link_arq_obtain(struct ccnd_handle *h, struct face *face)
+{
+    struct ccnd_link_arq *a = face->arq;
+    
+    if (a == NULL) {
+        a = calloc(1, sizeof(*a));
+        if (a == NULL)
+            return(NULL);
+        a->srtt8 = CCND_LINK_SRTT_INIT * 8;
+        face->arq = a;
+    }
+    return(a);
+}
+
+/**
+ * Free the link ack state of a face
+ */
+static void
+link_arq_destroy(struct ccnd_handle *h, struct ccnd_link_arq **pa)
+{
+    struct ccnd_link_arq *a = *pa;
+    int i;
+    
+    if (a == NULL)
+        return;
+    if (a->ack_ev != NULL)
+        ccn_schedule_cancel(h->sched, a->ack_ev);
+    if (a->rtx_ev != NULL)
+        ccn_schedule_cancel(h->sched, a->rtx_ev);
+    for (i = 0; i < CCND_LINK_RTX_SLOTS; i++)
+        ccn_charbuf_destroy(&a->slot[i].pkt);
+    free(a);
+    *pa = NULL;
+}
+
+/**
+ * Append a LinkAck describing what we have received lately
+ */
+static void
+link_append_ack(struct ccnd_link_arq *a, struct ccn_charbuf *c)
+{
+    unsigned char v[6];
+    
+    v[0] = a->ack_high >> 8;
+    v[1] = a->ack_high;
+    v[2] = a->ack_bits >> 24;
+    v[3] = a->ack_bits >> 16;
+    v[4] = a->ack_bits >> 8;
+    v[5] = a->ack_bits;
+    ccnb_append_tagged_blob(c, CCN_DTAG_LinkAck, v, sizeof(v));
+    a->ack_due = 0;
+}
+
+/**
+ * Send a bare ack if nothing else has carried it
+ *
+ * The LinkAck goes out on its own rather than in a PDU, since the other
+ * side may not take a PDU from us.
+ */
+static int
+link_ack_sender(struct ccn_schedule *sched,
+                void *clienth,
+                struct ccn_scheduled_event *ev,
+                int flags)
+{
+    struct ccnd_handle *h = clienth;
+    struct face *face = NULL;
+    struct ccn_charbuf *c = NULL;
+    
+    if ((flags & CCN_SCHEDULE_CANCEL) != 0)
+        return(0);
+    face = face_from_faceid(h, ev->evint);
+    if (face == NULL || face->arq == NULL || face->arq->ack_ev != ev)
+        return(0);
+    face->arq->ack_ev = NULL;
+    if (!face->arq->ack_due)
+        return(0);
+    c = charbuf_obtain(h);
+    link_append_ack(face->arq, c);
+    ccnd_send(h, face, c->buf, c->length);
+    charbuf_release(h, c);
+    return(0);
+}
+
+/**
+ * Note the arrival of a numbered packet, and arrange to acknowledge it
+ *
+ * Until the other side shows that it understands acks, only an occasional
+ * one is sent, so that older peers are not pestered.
+ */
+static void
+link_ack_note(struct ccnd_handle *h, struct face *face, unsigned seq)
+{
+    struct ccnd_link_arq *a;
+    unsigned d;
+    
+    a = link_arq_obtain(h, face);
+    if (a == NULL)
+        return;
+    seq &= 0xFFFF;
+    d = (seq - a->ack_high) & 0xFFFF;
+    if (!a->ack_valid) {
+        a->ack_high = seq;
+        a->ack_bits = 1;
+        a->ack_valid = 1;
+    }
+    else if (d != 0 && d < 0x8000) {
+        a->ack_bits = (d < 32) ? (a->ack_bits << d) | 1 : 1;
+        a->ack_high = seq;
+    }
+    else if (d != 0 && 0x10000 - d < 32)
+        a->ack_bits |= 1U << (0x10000 - d);
+    if ((face->flags & CCN_FACE_ACKOK) == 0 && (a->ack_probe++ & 63) != 0)
+        return;
+    a->ack_due = 1;
+    if (a->ack_ev == NULL)
+        a->ack_ev = ccn_schedule_event(h->sched, CCND_LINK_ACK_MICROSEC,
+                                       link_ack_sender, NULL, face->faceid);
+}
+
+/**
+ * Current retransmit timeout, in WTHZ units
+ */
+static unsigned
+link_rto(struct ccnd_link_arq *a)
+{
+    unsigned rto = 3 * a->srtt8 / 8;
+    
+    return(rto < CCND_LINK_RTO_MIN ? CCND_LINK_RTO_MIN : rto);
+}
+
+/**
+ * Retransmit the datagrams that appear to have been lost
+ *
+ * A datagram is resent when the retransmit timeout has passed, or sooner
+ * if enough of the packets sent after it have been acknowledged.  Each is
+ * resent at most CCND_LINK_RETRIES times before being given up.
+ */
+static void
+link_retransmit(struct ccnd_handle *h, struct face *face)
+{
+    struct ccnd_link_arq *a = face->arq;
+    struct ccnd_rtx_slot *s;
+    unsigned rto = link_rto(a);
+    unsigned srtt = a->srtt8 / 8;
+    unsigned age;
+    unsigned back;
+    int i;
+    
+    for (i = 0; i < CCND_LINK_RTX_SLOTS && a->nbusy > 0; i++) {
+        s = &a->slot[i];
+        if (!s->busy)
+            continue;
+        age = (ccn_wrappedtime)(h->wtnow - s->sent);
+        back = (a->peer_high - s->seq) & 0xFFFF;
+        if (age < rto && !(a->peer_valid && back >= 3 &&
+                           back < 0x8000 && age >= srtt))
+            continue;
+        if (s->tries >= CCND_LINK_RETRIES) {
+            s->busy = 0;
+            a->nbusy--;
+            face->rtx_lost++;
+            continue;
+        }
+        if (h->debug & 8)
+            ccnd_msg(h, "link_rtx %u seq %u try %d",
+                     face->faceid, s->seq, s->tries + 1);
+        s->tries++;
+        s->sent = h->wtnow;
+        face->rtx_sent++;
+        ccnd_send(h, face, s->pkt->buf, s->pkt->length);
+    }
+}
+
+/**
+ * Retransmit timer
+ */
+static int
+link_rtx_timer(struct ccn_schedule *sched,
+               void *clienth,
+               struct ccn_scheduled_event *ev,
+               int flags)
+{
+    struct ccnd_handle *h = clienth;
+    struct face *face = NULL;
+    
+    if ((flags & CCN_SCHEDULE_CANCEL) != 0)
+        return(0);
+    face = face_from_faceid(h, ev->evint);
+    if (face == NULL || face->arq == NULL || face->arq->rtx_ev != ev)
+        return(0);
+    link_retransmit(h, face);
+    if (face->arq->nbusy == 0) {
+        face->arq->rtx_ev = NULL;
+        return(0);
+    }
+    return(link_rto(face->arq) * (1000000 / WTHZ));
+}
+
+/**
+ * Keep a copy of a numbered datagram until it is acknowledged
+ *
+ * If the slot is still holding an unacknowledged datagram, that one is
+ * given up for lost.
+ */
+static void
+link_rtx_save(struct ccnd_handle *h, struct face *face,
+              const unsigned char *data, size_t size)
+{
+    struct ccnd_link_arq *a = face->arq;
+    struct ccnd_rtx_slot *s;
+    
+    a->pending = 0;
+    s = &a->slot[a->pending_seq % CCND_LINK_RTX_SLOTS];
+    if (s->busy)
+        face->rtx_lost++;
+    else
+        a->nbusy++;
+    if (s->pkt == NULL)
+        s->pkt = ccn_charbuf_create();
+    else
+        s->pkt->length = 0;
+    if (s->pkt == NULL || ccn_charbuf_append(s->pkt, data, size) < 0) {
+        s->busy = 0;
+        a->nbusy--;
+        return;
+    }
+    s->seq = a->pending_seq;
+    s->sent = h->wtnow;
+    s->tries = 0;
+    s->busy = 1;
+    if (a->rtx_ev == NULL)
+        a->rtx_ev = ccn_schedule_event(h->sched,
+                                       link_rto(a) * (1000000 / WTHZ),
+                                       link_rtx_timer, NULL, face->faceid);
+}
+
+/**
+ * Process a LinkAck from the other side
+ *
+ * The first one we hear tells us that the other side acknowledges our
+ * packets, so from then on we keep them for retransmission.
+ */
+static int
+link_ack_received(struct ccnd_handle *h, struct face *face,
+                  const unsigned char *v, size_t size)
+{
+    struct ccnd_link_arq *a;
+    struct ccnd_rtx_slot *s;
+    unsigned high;
+    uint32_t bits;
+    unsigned back;
+    unsigned sample;
+    int i;
+    
+    if (size != 6)
+        return(-1);
+    if ((face->flags & (CCN_FACE_DGRAM | CCN_FACE_MCAST)) != CCN_FACE_DGRAM)
+        return(-1);
+    if (!h->link_ack || (face->flags & CCN_FACE_SEQOK) == 0)
+        return(0);
+    a = link_arq_obtain(h, face);
+    if (a == NULL)
+        return(-1);
+    face->flags |= CCN_FACE_ACKOK;
+    high = (v[0] << 8) | v[1];
+    bits = ((uint32_t)v[2] << 24) | (v[3] << 16) | (v[4] << 8) | v[5];
+    /* Ignore acks for numbers we have not sent lately */
+    back = (face->pktseq - high) & 0xFFFF;
+    if (back == 0 || back > CCND_LINK_RTX_SLOTS * 4)
+        return(0);
+    back = (a->peer_high - high) & 0xFFFF;
+    if (a->peer_valid && back != 0 && back <= CCND_LINK_RTX_SLOTS * 4)
+        return(0); /* stale, perhaps from a retransmission */
+    a->peer_high = high;
+    a->peer_valid = 1;
+    for (i = 0; i < CCND_LINK_RTX_SLOTS && a->nbusy > 0; i++) {
+        s = &a->slot[i];
+        if (!s->busy)
+            continue;
+        back = (high - s->seq) & 0xFFFF;
+        if (back >= 32 || (bits & (1U << back)) == 0)
+            continue;
+        if (s->tries == 0) {
+            sample = (ccn_wrappedtime)(h->wtnow - s->sent);
+            a->srtt8 += sample - a->srtt8 / 8;
+        }
+        s->busy = 0;
+        a->nbusy--;
+    }
+    link_retransmit(h, face);
+    return(0);
+}
+
 /**
  * Set up to send one sequence number to see it the other side wants to play.
  *
@@ -2217,6 +3598,8 @@ ccn_link_state_init(struct ccnd_handle *h, struct face *face)
 
 /**
  * Append a sequence number if appropriate.
+ *
+ * If we have an MTU, this also advertises it from time to time.
  */
 static void
 ccn_append_link_stuff(struct ccnd_handle *h,
@@ -2229,13 +3612,221 @@ ccn_append_link_stuff(struct ccnd_handle *h,
     ccn_charbuf_append_tt(c, 2, CCN_BLOB);
     ccn_charbuf_append_value(c, face->pktseq, 2);
     ccnb_element_end(c);
+    /* Let the other side know, now and then, that we reassemble fragments */
+    if (h->mtu > 0 &&
+        ((face->flags & CCN_FACE_SEQPROBE) != 0 || (face->pktseq & 63) == 0))
+        ccnb_append_tagged_binary_number(c, CCN_DTAG_LinkMTU, h->mtu);
     if (0)
         ccnd_msg(h, "debug.%d pkt_to %u seq %u",
                  __LINE__, face->faceid, (unsigned)face->pktseq);
+    if (face->arq != NULL) {
+        if (face->arq->ack_due)
+            link_append_ack(face->arq, c);
+        if ((face->flags & CCN_FACE_ACKOK) != 0) {
+            face->arq->pending = 1;
+            face->arq->pending_seq = face->pktseq;
+        }
+    }
     face->pktseq++;
     face->flags &= ~CCN_FACE_SEQPROBE;
 }
 
+/**
+ * A message that is being put back together from its fragments
+ */
+struct ccnd_reasm {
+    unsigned id;                /**< sequence number of fragment 0 */
+    unsigned count;             /**< number of fragments, 0 if slot unused */
+    uint32_t have;              /**< fragments that have arrived */
+    size_t fragsize;            /**< size of all but the last, once known */
+    size_t lastsize;            /**< size of the last fragment */
+    struct ccn_charbuf *buf;    /**< the message, with fragments in place */
+    struct ccn_charbuf *tail;   /**< last fragment, if fragsize was unknown */
+};
+
+/**
+ * Free the reassembly slots of a face
+ */
+static void
+reasm_destroy(struct ccnd_reasm **pr)
+{
+    struct ccnd_reasm *r = *pr;
+    int i;
+    
+    if (r == NULL)
+        return;
+    for (i = 0; i < CCND_REASM_SLOTS; i++) {
+        ccn_charbuf_destroy(&r[i].buf);
+        ccn_charbuf_destroy(&r[i].tail);
+    }
+    free(r);
+    *pr = NULL;
+}
+
+/**
+ * Make a reassembly slot available, keeping its buffers for reuse
+ */
+static void
+reasm_clear(struct ccnd_reasm *r)
+{
+    r->count = 0;
+    r->have = 0;
+    r->fragsize = 0;
+    r->lastsize = 0;
+    r->buf->length = 0;
+    r->tail->length = 0;
+}
+
+/**
+ * Copy a fragment into its place in the message
+ */
+static void
+reasm_put(struct ccn_charbuf *c, size_t offset,
+          const unsigned char *data, size_t size)
+{
+    if (c->length < offset + size) {
+        ccn_charbuf_reserve(c, offset + size - c->length);
+        c->length = offset + size;
+    }
+    memcpy(c->buf + offset, data, size);
+}
+
+/**
+ * Find the reassembly slot for a message.
+ *
+ * Messages that started long enough ago that their missing fragments will
+ * not arrive are given up for lost.  If all the slots are busy, the oldest
+ * one is taken over.
+ * @returns NULL if no memory, or if the message is older than all
+ *          of those in progress.
+ */
+static struct ccnd_reasm *
+reasm_lookup(struct face *face, unsigned id, unsigned count)
+{
+    struct ccnd_reasm *r = NULL;
+    struct ccnd_reasm *avail = NULL;
+    struct ccnd_reasm *victim = NULL;
+    unsigned age;
+    unsigned oldest = 0;
+    int i;
+    
+    if (face->reasm == NULL) {
+        face->reasm = calloc(CCND_REASM_SLOTS, sizeof(*face->reasm));
+        if (face->reasm == NULL)
+            return(NULL);
+        for (i = 0; i < CCND_REASM_SLOTS; i++) {
+            face->reasm[i].buf = ccn_charbuf_create();
+            face->reasm[i].tail = ccn_charbuf_create();
+            if (face->reasm[i].buf == NULL || face->reasm[i].tail == NULL) {
+                reasm_destroy(&face->reasm);
+                return(NULL);
+            }
+        }
+    }
+    for (i = 0; i < CCND_REASM_SLOTS; i++) {
+        r = &face->reasm[i];
+        if (r->count != 0 && r->id == id && r->count == count)
+            return(r);
+        age = (id - r->id) & 0xFFFF;
+        if (r->count != 0 && age >= 255 && age < 0x8000) {
+            face->reasm_lost++;
+            reasm_clear(r);
+        }
+        if (r->count == 0) {
+            if (avail == NULL)
+                avail = r;
+        }
+        else if (age < 0x8000 && (victim == NULL || age > oldest)) {
+            victim = r;
+            oldest = age;
+        }
+    }
+    r = (avail != NULL) ? avail : victim;
+    if (r == NULL)
+        return(NULL); /* older than everything in progress */
+    if (r->count != 0) {
+        face->reasm_lost++;
+        reasm_clear(r);
+    }
+    r->id = id;
+    r->count = count;
+    return(r);
+}
+
+/**
+ * Process an incoming Fragment link message.
+ *
+ * When the last missing piece arrives, the reassembled message is
+ * processed just as if it had arrived whole.
+ * @returns 0, or -1 if the fragment is not usable.
+ */
+static int
+process_incoming_fragment(struct ccnd_handle *h, struct face *face,
+                          unsigned char *msg, size_t size)
+{
+    struct ccn_buf_decoder decoder;
+    struct ccn_buf_decoder *d = ccn_buf_decoder_start(&decoder, msg, size);
+    struct ccn_skeleton_decoder sd = {0};
+    struct ccnd_reasm *r = NULL;
+    const unsigned char *data = NULL;
+    size_t len = 0;
+    size_t total;
+    uintmax_t i;
+    uintmax_t n;
+    
+    if (ccn_buf_match_dtag(d, CCN_DTAG_Fragment))
+        ccn_buf_advance(d);
+    i = ccn_parse_required_tagged_binary_number(d, CCN_DTAG_FragmentIndex, 0, 1);
+    n = ccn_parse_required_tagged_binary_number(d, CCN_DTAG_FragmentCount, 1, 1);
+    if (ccn_buf_match_blob(d, &data, &len))
+        ccn_buf_advance(d);
+    ccn_buf_check_close(d);
+    if (d->decoder.state < 0 || !face->pduseq_ok ||
+        n < 2 || n > CCND_FRAG_MAX || i >= n || len == 0)
+        goto Bad;
+    r = reasm_lookup(face, (face->pduseq - i) & 0xFFFF, n);
+    if (r == NULL)
+        return(-1);
+    if ((r->have & (1U << i)) != 0)
+        return(0); /* duplicate */
+    if (i + 1 < n) {
+        if (r->fragsize == 0)
+            r->fragsize = len;
+        if (len != r->fragsize || (n - 1) * len > CCN_MAX_MESSAGE_BYTES)
+            goto Bad;
+        reasm_put(r->buf, i * len, data, len);
+    }
+    else {
+        r->lastsize = len;
+        if (r->fragsize == 0)
+            reasm_put(r->tail, 0, data, len);
+        else
+            reasm_put(r->buf, i * r->fragsize, data, len);
+    }
+    r->have |= 1U << i;
+    if (r->tail->length != 0 && r->fragsize != 0) {
+        reasm_put(r->buf, (n - 1) * r->fragsize, r->tail->buf, r->tail->length);
+        r->tail->length = 0;
+    }
+    if (r->have != (uint32_t)((1ULL << n) - 1))
+        return(0);
+    total = (n - 1) * r->fragsize + r->lastsize;
+    if (total > CCN_MAX_MESSAGE_BYTES ||
+        ccn_skeleton_decode(&sd, r->buf->buf, total) != total ||
+        !CCN_FINAL_DSTATE(sd.state))
+        goto Bad;
+    process_input_message(h, face, r->buf->buf, total, 0);
+    reasm_clear(r);
+    return(0);
+Bad:
+    if (r != NULL) {
+        face->reasm_lost++;
+        reasm_clear(r);
+    }
+    ccnd_msg(h, "bad fragment from face %u", face->faceid);
+    return(-1);
+}
+
 /**
  * Process an incoming link message.
  */
@@ -2245,6 +3836,8 @@ process_incoming_link_message(struct ccnd_handle *h,
                               unsigned char *msg, size_t size)
 {
     uintmax_t s;
+    const unsigned char *v = NULL;
+    size_t vsize = 0;
     int checkflags;
     int matchflags;
     struct ccn_buf_decoder decoder;
@@ -2255,6 +3848,9 @@ process_incoming_link_message(struct ccnd_handle *h,
             s = ccn_parse_required_tagged_binary_number(d, dtag, 1, 6);
             if (d->decoder.state < 0)
                 return(d->decoder.state);
+            /* Fragments in the same PDU are numbered from this */
+            face->pduseq = s;
+            face->pduseq_ok = 1;
             /*
              * If the other side is unicast and sends sequence numbers,
              * then it is OK for us to send numbers as well.
@@ -2263,6 +3859,8 @@ process_incoming_link_message(struct ccnd_handle *h,
             checkflags = matchflags | CCN_FACE_MCAST | CCN_FACE_SEQOK;
             if ((face->flags & checkflags) == matchflags)
                 face->flags |= CCN_FACE_SEQOK;
+            if (h->link_ack && (face->flags & CCN_FACE_SEQOK) != 0)
+                link_ack_note(h, face, s);
             if (face->rrun == 0) {
                 face->rseq = s;
                 face->rrun = 1;
@@ -2277,10 +3875,15 @@ process_incoming_link_message(struct ccnd_handle *h,
             if (s > face->rseq && s - face->rseq < 255) {
                 ccnd_msg(h, "seq_gap %u %ju to %ju",
                          face->faceid, face->rseq, s);
+                face->pkts_lost += s - face->rseq - 1;
                 face->rseq = s;
                 face->rrun = 1;
                 return(0);
             }
+            if (s < face->rseq && face->rseq - s < 255 && face->arq != NULL) {
+                /* A resend of something we acked or already counted lost */
+                return(0);
+            }
             if (s <= face->rseq) {
                 if (face->rseq - s < face->rrun) {
                     ccnd_msg(h, "seq_dup %u %ju", face->faceid, s);
@@ -2298,6 +3901,29 @@ process_incoming_link_message(struct ccnd_handle *h,
             face->rseq = s;
             face->rrun = 1;
             break;
+        case CCN_DTAG_LinkMTU:
+            s = ccn_parse_required_tagged_binary_number(d, dtag, 1, 4);
+            if (d->decoder.state < 0)
+                return(d->decoder.state);
+            if ((face->flags & CCN_FACE_DGRAM) == 0)
+                return(-1);
+            if (s >= 256 && s <= CCN_MAX_MESSAGE_BYTES)
+                face->frag_mtu = s;
+            break;
+        case CCN_DTAG_Fragment:
+            if ((face->flags & CCN_FACE_DGRAM) == 0)
+                return(-1);
+            return(process_incoming_fragment(h, face, msg, size));
+        case CCN_DTAG_LinkAck:
+            if (ccn_buf_match_dtag(d, dtag)) {
+                ccn_buf_advance(d);
+                if (ccn_buf_match_blob(d, &v, &vsize))
+                    ccn_buf_advance(d);
+                ccn_buf_check_close(d);
+            }
+            if (d->decoder.state < 0 || v == NULL)
+                return(-1);
+            return(link_ack_received(h, face, v, vsize));
         default:
             return(-1);
     }
@@ -2306,7 +3932,11 @@ process_incoming_link_message(struct ccnd_handle *h,
 
 /**
  * Checks for inactivity on datagram faces.
- * @returns number of faces that have gone away.
+ *
+ * This visits about CCND_HOUSEKEEPING_SLICE faces, starting where the
+ * previous call left off.  Should a rehash cause a face to be checked
+ * twice in one pass, it may time out one pass early.
+ * @returns 1 if this completes a pass over all the faces, 0 if not.
  */
 static int
 check_dgram_faces(struct ccnd_handle *h)
@@ -2317,15 +3947,19 @@ check_dgram_faces(struct ccnd_handle *h)
     int checkflags = CCN_FACE_DGRAM;
     int wantflags = CCN_FACE_DGRAM;
     int adj_req = 0;
+    int pos;
     
-    hashtb_start(h->dgram_faces, e);
-    while (e->data != NULL) {
+    hashtb_start_at(h->dgram_faces, e, h->dgram_faces_pos);
+    for (pos = hashtb_position(e); pos >= 0; pos = hashtb_position(e)) {
         struct face *face = e->data;
+        if (count >= CCND_HOUSEKEEPING_SLICE && pos != h->dgram_faces_pos)
+            break;
+        h->dgram_faces_pos = pos;
+        count++;
         if (face->addr != NULL && (face->flags & checkflags) == wantflags) {
             face->flags &= ~CCN_FACE_LC; /* Rate limit link check interests */
             if (face->recvcount == 0) {
                 if ((face->flags & (CCN_FACE_PERMANENT | CCN_FACE_ADJ)) == 0) {
-                    count += 1;
                     hashtb_delete(e);
                     continue;
                 }
@@ -2339,11 +3973,12 @@ check_dgram_faces(struct ccnd_handle *h)
         }
         hashtb_next(e);
     }
+    h->dgram_faces_pos = (pos < 0) ? 0 : pos;
     hashtb_end(e);
     if (adj_req) {
         process_internal_client_buffer(h);
     }
-    return(count);
+    return(pos < 0);
 }
 
 /**
@@ -2400,9 +4035,40 @@ check_forward_to(struct ccnd_handle *h, struct ccn_indexbuf **ip)
         ft->n = i;
 }
 
+/**
+ * Removes a nameprefix entry from the child index of its parent.
+ *
+ * The component that leads to it is the last one in its key.
+ */
+static void
+nameprefix_unlink(struct ccnd_handle *h, struct nameprefix_entry *npe,
+                  const unsigned char *key, size_t keysize)
+{
+    struct ccn_charbuf *name = NULL;
+    struct ccn_indexbuf *comps = NULL;
+    const unsigned char *comp = NULL;
+    size_t compsize = 0;
+    int n;
+    
+    name = charbuf_obtain(h);
+    ccnb_element_begin(name, CCN_DTAG_Name);
+    ccn_charbuf_append(name, key, keysize);
+    ccnb_element_end(name);
+    comps = indexbuf_obtain(h);
+    n = ccn_name_split(name, comps);
+    if (n > 0 && ccn_ref_tagged_BLOB(CCN_DTAG_Component, name->buf,
+                                     comps->buf[n - 1], comps->buf[n],
+                                     &comp, &compsize) == 0)
+        ccnd_lpm_unlink(h->nameprefix_index, npe->parent, comp, compsize);
+    indexbuf_release(h, comps);
+    charbuf_release(h, name);
+}
+
 /**
  * Ages src info and retires unused nameprefix entries.
- * @returns number that have gone away.
+ *
+ * Like check_dgram_faces, this does one slice of a pass per call.
+ * @returns 1 if this completes a pass over the table, 0 if not.
  */
 static int
 check_nameprefix_entries(struct ccnd_handle *h)
@@ -2412,17 +4078,23 @@ check_nameprefix_entries(struct ccnd_handle *h)
     struct hashtb_enumerator *e = &ee;
     struct ielinks *head;
     struct nameprefix_entry *npe;
+    int pos;
     
-    hashtb_start(h->nameprefix_tab, e);
-    for (npe = e->data; npe != NULL; npe = e->data) {
+    hashtb_start_at(h->nameprefix_tab, e, h->nameprefix_pos);
+    for (pos = hashtb_position(e); pos >= 0; pos = hashtb_position(e)) {
+        npe = e->data;
+        if (count >= CCND_HOUSEKEEPING_SLICE && pos != h->nameprefix_pos)
+            break;
+        h->nameprefix_pos = pos;
+        count++;
         if ( (npe->sst.s[0] & CCN_AGED) != 0 &&
               npe->children == 0 &&
               npe->forwarding == NULL &&
               npe->si == NULL) {
             head = &npe->ie_head;
             if (head == head->next) {
-                count += 1;
                 if (npe->parent != NULL) {
+                    nameprefix_unlink(h, npe, e->key, e->keysize);
                     npe->parent->children--;
                     npe->parent = NULL;
                 }
@@ -2435,8 +4107,9 @@ check_nameprefix_entries(struct ccnd_handle *h)
         npe->sst.s[0] |= CCN_AGED;
         hashtb_next(e);
     }
+    h->nameprefix_pos = (pos < 0) ? 0 : pos;
     hashtb_end(e);
-    return(count);
+    return(pos < 0);
 }
 
 static void
@@ -2449,8 +4122,42 @@ check_comm_file(struct ccnd_handle *h)
     }
 }
 
+/**
+ * Note the time taken by a slice of housekeeping
+ */
+static void
+housekeeping_stall(struct ccnd_handle *h, const struct timeval *start)
+{
+    struct timeval now;
+    unsigned long usec;
+    
+    gettimeofday(&now, NULL);
+    usec = (now.tv_sec - start->tv_sec) * 1000000 +
+           (now.tv_usec - start->tv_usec);
+    if (usec > h->housekeeping_max_usec)
+        h->housekeeping_max_usec = usec;
+}
+
+/**
+ * Time to wait before starting the next pass of a housekeeping task
+ * @returns microseconds left in period since the pass started at
+ *          wrapped time started.
+ */
+static int
+housekeeping_rest(struct ccnd_handle *h, ccn_wrappedtime started, int period)
+{
+    ccn_wrappedtime elapsed = h->wtnow - started;
+    
+    if (elapsed >= (unsigned)period / (1000000 / WTHZ))
+        return(CCND_HOUSEKEEPING_PAUSE);
+    return(period - elapsed * (1000000 / WTHZ));
+}
+
 /**
  * Scheduled reap event for retiring expired structures.
+ *
+ * Each pass first checks the datagram faces, then the name prefix
+ * table, a slice at a time, so that other work is not held up for long.
  */
 static int
 reap(
@@ -2460,16 +4167,31 @@ reap(
     int flags)
 {
     struct ccnd_handle *h = clienth;
+    struct timeval start;
+    int period = 2 * CCN_INTEREST_LIFETIME_MICROSEC;
+    int done = 0;
     (void)(sched);
     (void)(ev);
     if ((flags & CCN_SCHEDULE_CANCEL) != 0) {
         h->reaper = NULL;
         return(0);
     }
-    check_dgram_faces(h);
-    check_nameprefix_entries(h);
-    check_comm_file(h);
-    return(2 * CCN_INTEREST_LIFETIME_MICROSEC);
+    gettimeofday(&start, NULL);
+    if (h->reap_phase == 0) {
+        h->reap_started = h->wtnow;
+        h->reap_phase = 1;
+    }
+    if (h->reap_phase == 1 && check_dgram_faces(h))
+        h->reap_phase = 2;
+    else if (h->reap_phase == 2 && check_nameprefix_entries(h)) {
+        check_comm_file(h);
+        h->reap_phase = 0;
+        done = 1;
+    }
+    housekeeping_stall(h, &start);
+    if (!done)
+        return(CCND_HOUSEKEEPING_PAUSE);
+    return(housekeeping_rest(h, h->reap_started, period));
 }
 
 static void
@@ -2504,6 +4226,10 @@ remove_content(struct ccnd_handle *h, struct content_entry *content)
 
 /**
  * Age out the old forwarding table entries
+ *
+ * A pass over the name prefix table is made every CCN_FWU_SECS, a slice
+ * at a time.  Entries are stamped with the pass number, so that none is
+ * aged twice in one pass even if the table is rehashed along the way.
  */
 static int
 age_forwarding(struct ccn_schedule *sched,
@@ -2518,13 +4244,37 @@ age_forwarding(struct ccn_schedule *sched,
     struct ccn_forwarding *next;
     struct ccn_forwarding **p;
     struct nameprefix_entry *npe;
+    struct timeval start;
+    int period = CCN_FWU_SECS * 1000000;
+    int count = 0;
+    int pos;
     
     if ((flags & CCN_SCHEDULE_CANCEL) != 0) {
         h->age_forwarding = NULL;
         return(0);
     }
-    hashtb_start(h->nameprefix_tab, e);
-    for (npe = e->data; npe != NULL; npe = e->data) {
+    gettimeofday(&start, NULL);
+    if (h->age_forwarding_pos == 0) {
+        /* Starting a pass; allow for a previous one that ran long */
+        h->age_forwarding_pass++;
+        h->age_forwarding_secs = CCN_FWU_SECS;
+        if (h->age_forwarding_pass > 1 &&
+            h->wtnow - h->age_forwarding_started > CCN_FWU_SECS * WTHZ)
+            h->age_forwarding_secs = (h->wtnow - h->age_forwarding_started) / WTHZ;
+        h->age_forwarding_started = h->wtnow;
+    }
+    hashtb_start_at(h->nameprefix_tab, e, h->age_forwarding_pos);
+    for (pos = hashtb_position(e); pos >= 0; pos = hashtb_position(e)) {
+        npe = e->data;
+        if (count >= CCND_HOUSEKEEPING_SLICE && pos != h->age_forwarding_pos)
+            break;
+        h->age_forwarding_pos = pos;
+        count++;
+        if (npe->age_pass == h->age_forwarding_pass) {
+            hashtb_next(e);
+            continue;
+        }
+        npe->age_pass = h->age_forwarding_pass;
         p = &npe->forwarding;
         for (f = npe->forwarding; f != NULL; f = next) {
             next = f->next;
@@ -2545,9 +4295,10 @@ age_forwarding(struct ccn_schedule *sched,
                 *p = next;
                 free(f);
                 f = NULL;
+                forwarding_changed(h, npe);
                 continue;
             }
-            f->expires -= CCN_FWU_SECS;
+            f->expires -= h->age_forwarding_secs;
             if (f->expires <= 0)
                 f->flags &= ~CCN_FORW_REFRESHED;
             p = &(f->next);
@@ -2555,8 +4306,14 @@ age_forwarding(struct ccn_schedule *sched,
         hashtb_next(e);
     }
     hashtb_end(e);
-    h->forward_to_gen += 1;
-    return(CCN_FWU_SECS*1000000);
+    if (pos >= 0) {
+        h->age_forwarding_pos = pos;
+        housekeeping_stall(h, &start);
+        return(CCND_HOUSEKEEPING_PAUSE);
+    }
+    h->age_forwarding_pos = 0;
+    housekeeping_stall(h, &start);
+    return(housekeeping_rest(h, h->age_forwarding_started, period));
 }
 
 /**
@@ -2596,34 +4353,58 @@ seek_forwarding(struct ccnd_handle *h,
 }
 
 /**
- * Register or update a prefix in the forwarding table (FIB).
+ * A change to the FIB that pending interests may want to know about
+ */
+struct fib_change {
+    struct nameprefix_entry *npe;   /**< entry whose forwarding changed */
+    unsigned faceid;                /**< face that was added or changed */
+};
+
+/**
+ * The changes for one prefix, once a list has been sorted by prefix
+ */
+struct fib_change_run {
+    int first;                      /**< index of the first change */
+    int n;                          /**< number of changes */
+};
+
+/**
+ * Order FIB changes by prefix, for qsort
+ */
+static int
+fib_change_compare(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t)((const struct fib_change *)a)->npe;
+    uintptr_t y = (uintptr_t)((const struct fib_change *)b)->npe;
+    
+    return((x > y) - (x < y));
+}
+
+/**
+ * Register or update a prefix, given an enumerator for the prefix table
  *
- * @param h is the ccnd handle.
- * @param msg is a ccnb-encoded message containing the name prefix somewhere.
- * @param comps contains the delimiting offsets for the name components in msg.
- * @param ncomps is the number of relevant components.
- * @param faceid indicates which face to forward to.
- * @param flags are the forwarding entry flags (CCN_FORW_...), -1 for defaults.
- * @param expires tells the remaining lifetime, in seconds.
- * @returns -1 for error, or new flags upon success; the private flag
- *        CCN_FORW_REFRESHED indicates a previously existing entry.
+ * This does the work of ccnd_reg_prefix, for callers that register many
+ * prefixes at once.  If the forwarding entries of the prefix change, chg
+ * is filled in for update_npe_children; otherwise chg->npe is NULL.
+ * @returns as for ccnd_reg_prefix.
  */
 static int
-ccnd_reg_prefix(struct ccnd_handle *h,
-                const unsigned char *msg,
-                struct ccn_indexbuf *comps,
-                int ncomps,
-                unsigned faceid,
-                int flags,
-                int expires)
+reg_prefix_at(struct ccnd_handle *h,
+              struct hashtb_enumerator *e,
+              const unsigned char *msg,
+              struct ccn_indexbuf *comps,
+              int ncomps,
+              unsigned faceid,
+              int flags,
+              int expires,
+              struct fib_change *chg)
 {
-    struct hashtb_enumerator ee;
-    struct hashtb_enumerator *e = &ee;
     struct ccn_forwarding *f = NULL;
     struct nameprefix_entry *npe = NULL;
     int res;
     struct face *face = NULL;
     
+    chg->npe = NULL;
     if (flags >= 0 &&
         (flags & CCN_FORW_PUBMASK) != flags)
         return(-1);
@@ -2633,17 +4414,22 @@ ccnd_reg_prefix(struct ccnd_handle *h,
     /* This is a bit hacky, but it gives us a way to set CCN_FACE_DC */
     if (flags >= 0 && (flags & CCN_FORW_LAST) != 0)
         face->flags |= CCN_FACE_DC;
-    hashtb_start(h->nameprefix_tab, e);
     res = nameprefix_seek(h, e, msg, comps, ncomps);
     if (res >= 0) {
         res = (res == HT_OLD_ENTRY) ? CCN_FORW_REFRESHED : 0;
         npe = e->data;
         f = seek_forwarding(h, npe, faceid);
         if (f != NULL) {
-            h->forward_to_gen += 1; // XXX - too conservative, should check changes
             f->expires = expires;
             if (flags < 0)
                 flags = f->flags & CCN_FORW_PUBMASK;
+            /* A plain refresh leaves every cached forward_to good */
+            if ((f->flags & CCN_FORW_REFRESHED) == 0 ||
+                (f->flags & CCN_FORW_PUBMASK) != flags) {
+                forwarding_changed(h, npe);
+                chg->npe = npe;
+                chg->faceid = faceid;
+            }
             f->flags = (CCN_FORW_REFRESHED | flags);
             res |= flags;
             if (h->debug & (2 | 4)) {
@@ -2668,9 +4454,42 @@ ccnd_reg_prefix(struct ccnd_handle *h,
         else
             res = -1;
     }
+    return(res);
+}
+
+/**
+ * Register or update a prefix in the forwarding table (FIB).
+ *
+ * @param h is the ccnd handle.
+ * @param msg is a ccnb-encoded message containing the name prefix somewhere.
+ * @param comps contains the delimiting offsets for the name components in msg.
+ * @param ncomps is the number of relevant components.
+ * @param faceid indicates which face to forward to.
+ * @param flags are the forwarding entry flags (CCN_FORW_...), -1 for defaults.
+ * @param expires tells the remaining lifetime, in seconds.
+ * @returns -1 for error, or new flags upon success; the private flag
+ *        CCN_FORW_REFRESHED indicates a previously existing entry.
+ */
+static int
+ccnd_reg_prefix(struct ccnd_handle *h,
+                const unsigned char *msg,
+                struct ccn_indexbuf *comps,
+                int ncomps,
+                unsigned faceid,
+                int flags,
+                int expires)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct fib_change chg;
+    int res;
+    
+    hashtb_start(h->nameprefix_tab, e);
+    res = reg_prefix_at(h, e, msg, comps, ncomps, faceid, flags, expires,
+                        &chg);
     hashtb_end(e);
-    if (res >= 0)
-        update_npe_children(h, npe, faceid);
+    if (res >= 0 && chg.npe != NULL)
+        update_npe_children(h, &chg, 1);
     return(res);
 }
 
@@ -3018,64 +4837,49 @@ Finish:
 }
 
 /**
- * Worker bee for two very similar public functions.
+ * Carry out a prefixreg or selfreg request for one ForwardingEntry
+ *
+ * The caller has checked that the requesting face may register prefixes,
+ * and supplies an enumerator for the prefix table.  On success the entry
+ * is updated to serve as the reply.
+ * @returns 0 for success, -1 for failure.
  */
 static int
-ccnd_req_prefix_or_self_reg(struct ccnd_handle *h,
-                            const unsigned char *msg, size_t size, int selfreg,
-                            struct ccn_charbuf *reply_body)
+prefixreg_entry(struct ccnd_handle *h,
+                struct hashtb_enumerator *e,
+                struct ccn_forwarding_entry *forwarding_entry,
+                int selfreg,
+                struct fib_change *chg)
 {
-    struct ccn_parsed_ContentObject pco = {0};
-    int res;
-    const unsigned char *req;
-    size_t req_size;
-    struct ccn_forwarding_entry *forwarding_entry = NULL;
     struct face *face = NULL;
-    struct face *reqface = NULL;
     struct ccn_indexbuf *comps = NULL;
-    int nackallowed = 0;
-
-    res = ccn_parse_ContentObject(msg, size, &pco, NULL);
-    if (res < 0)
-        goto Finish;
-    res = ccn_content_get_value(msg, size, &pco, &req, &req_size);
-    if (res < 0)
-        goto Finish;
-    res = -1;
-    forwarding_entry = ccn_forwarding_entry_parse(req, req_size);
-    if (forwarding_entry == NULL || forwarding_entry->action == NULL)
-        goto Finish;
-    /* consider the source ... */
-    reqface = face_from_faceid(h, h->interest_faceid);
-    if (reqface == NULL)
-        goto Finish;
-    if ((reqface->flags & (CCN_FACE_GG | CCN_FACE_REGOK)) == 0)
-        goto Finish;
-    nackallowed = 1;
+    int res;
+    
+    chg->npe = NULL;
     if (selfreg) {
         if (strcmp(forwarding_entry->action, "selfreg") != 0)
-            goto Finish;
+            return(-1);
         if (forwarding_entry->faceid == CCN_NOFACEID)
             forwarding_entry->faceid = h->interest_faceid;
         else if (forwarding_entry->faceid != h->interest_faceid)
-            goto Finish;
+            return(-1);
     }
     else {
         if (strcmp(forwarding_entry->action, "prefixreg") != 0)
-        goto Finish;
+            return(-1);
     }
     if (forwarding_entry->name_prefix == NULL)
-        goto Finish;
+        return(-1);
     if (forwarding_entry->ccnd_id_size == sizeof(h->ccnd_id)) {
         if (memcmp(forwarding_entry->ccnd_id,
                    h->ccnd_id, sizeof(h->ccnd_id)) != 0)
-            goto Finish;
+            return(-1);
     }
     else if (forwarding_entry->ccnd_id_size != 0)
-        goto Finish;
+        return(-1);
     face = face_from_faceid(h, forwarding_entry->faceid);
     if (face == NULL)
-        goto Finish;
+        return(-1);
     if (forwarding_entry->lifetime < 0)
         forwarding_entry->lifetime = 2000000000;
     else if (forwarding_entry->lifetime > 3600 &&
@@ -3083,25 +4887,71 @@ ccnd_req_prefix_or_self_reg(struct ccnd_handle *h,
         forwarding_entry->lifetime = 300;
     comps = ccn_indexbuf_create();
     res = ccn_name_split(forwarding_entry->name_prefix, comps);
+    if (res >= 0)
+        res = reg_prefix_at(h, e,
+                            forwarding_entry->name_prefix->buf, comps, res,
+                            face->faceid,
+                            forwarding_entry->flags,
+                            forwarding_entry->lifetime,
+                            chg);
+    ccn_indexbuf_destroy(&comps);
     if (res < 0)
-        goto Finish;
-    res = ccnd_reg_prefix(h,
-                          forwarding_entry->name_prefix->buf, comps, res,
-                          face->faceid,
-                          forwarding_entry->flags,
-                          forwarding_entry->lifetime);
-    if (res < 0)
-        goto Finish;
+        return(-1);
     forwarding_entry->flags = res;
     forwarding_entry->action = NULL;
     forwarding_entry->ccnd_id = h->ccnd_id;
     forwarding_entry->ccnd_id_size = sizeof(h->ccnd_id);
+    return(0);
+}
+
+/**
+ * Worker bee for two very similar public functions.
+ */
+static int
+ccnd_req_prefix_or_self_reg(struct ccnd_handle *h,
+                            const unsigned char *msg, size_t size, int selfreg,
+                            struct ccn_charbuf *reply_body)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct ccn_parsed_ContentObject pco = {0};
+    int res;
+    const unsigned char *req;
+    size_t req_size;
+    struct ccn_forwarding_entry *forwarding_entry = NULL;
+    struct face *reqface = NULL;
+    struct fib_change chg;
+    int nackallowed = 0;
+
+    res = ccn_parse_ContentObject(msg, size, &pco, NULL);
+    if (res < 0)
+        goto Finish;
+    res = ccn_content_get_value(msg, size, &pco, &req, &req_size);
+    if (res < 0)
+        goto Finish;
+    res = -1;
+    forwarding_entry = ccn_forwarding_entry_parse(req, req_size);
+    if (forwarding_entry == NULL || forwarding_entry->action == NULL)
+        goto Finish;
+    /* consider the source ... */
+    reqface = face_from_faceid(h, h->interest_faceid);
+    if (reqface == NULL)
+        goto Finish;
+    if ((reqface->flags & (CCN_FACE_GG | CCN_FACE_REGOK)) == 0)
+        goto Finish;
+    nackallowed = 1;
+    hashtb_start(h->nameprefix_tab, e);
+    res = prefixreg_entry(h, e, forwarding_entry, selfreg, &chg);
+    hashtb_end(e);
+    if (res < 0)
+        goto Finish;
+    if (chg.npe != NULL)
+        update_npe_children(h, &chg, 1);
     res = ccnb_append_forwarding_entry(reply_body, forwarding_entry);
     if (res > 0)
         res = 0;
 Finish:
     ccn_forwarding_entry_destroy(&forwarding_entry);
-    ccn_indexbuf_destroy(&comps);
     if (nackallowed && res < 0)
         res = ccnd_nack(h, reply_body, 450, "could not register prefix");
     return((nackallowed || res <= 0) ? res : -1);
@@ -3147,6 +4997,72 @@ ccnd_req_selfreg(struct ccnd_handle *h,
     return(ccnd_req_prefix_or_self_reg(h, msg, size, 1, reply_body));
 }
 
+/**
+ * Remove the registration described by an unreg ForwardingEntry
+ *
+ * The caller has checked the request.  On success the entry is updated
+ * to serve as the reply.
+ * @returns 0 for success, -1 for failure.
+ */
+static int
+unreg_entry(struct ccnd_handle *h,
+            struct ccn_forwarding_entry *forwarding_entry)
+{
+    int n_name_comp = 0;
+    int res = -1;
+    size_t start;
+    size_t stop;
+    int found;
+    struct face *face = NULL;
+    struct ccn_indexbuf *comps = NULL;
+    struct ccn_forwarding **p = NULL;
+    struct ccn_forwarding *f = NULL;
+    struct nameprefix_entry *npe = NULL;
+    
+    face = face_from_faceid(h, forwarding_entry->faceid);
+    if (face == NULL)
+        goto Bail;
+    comps = ccn_indexbuf_create();
+    n_name_comp = ccn_name_split(forwarding_entry->name_prefix, comps);
+    if (n_name_comp < 0)
+        goto Bail;
+    if (n_name_comp + 1 > comps->n)
+        goto Bail;
+    start = comps->buf[0];
+    stop = comps->buf[n_name_comp];
+    npe = hashtb_lookup(h->nameprefix_tab,
+                        forwarding_entry->name_prefix->buf + start,
+                        stop - start);
+    if (npe == NULL)
+        goto Bail;
+    found = 0;
+    p = &npe->forwarding;
+    for (f = npe->forwarding; f != NULL; f = f->next) {
+        if (f->faceid == forwarding_entry->faceid) {
+            found = 1;
+            if (h->debug & (2 | 4))
+                ccnd_debug_ccnb(h, __LINE__, "prefix_unreg", face,
+                                forwarding_entry->name_prefix->buf,
+                                forwarding_entry->name_prefix->length);
+            *p = f->next;
+            free(f);
+            f = NULL;
+            forwarding_changed(h, npe);
+            break;
+        }
+        p = &(f->next);
+    }
+    if (!found)
+        goto Bail;
+    forwarding_entry->action = NULL;
+    forwarding_entry->ccnd_id = h->ccnd_id;
+    forwarding_entry->ccnd_id_size = sizeof(h->ccnd_id);
+    res = 0;
+Bail:
+    ccn_indexbuf_destroy(&comps);
+    return(res);
+}
+
 /**
  * @brief Process an unreg request for the ccnd internal client.
  * @param h is the ccnd handle
@@ -3165,20 +5081,11 @@ ccnd_req_unreg(struct ccnd_handle *h,
                struct ccn_charbuf *reply_body)
 {
     struct ccn_parsed_ContentObject pco = {0};
-    int n_name_comp = 0;
     int res;
     const unsigned char *req;
     size_t req_size;
-    size_t start;
-    size_t stop;
-    int found;
     struct ccn_forwarding_entry *forwarding_entry = NULL;
-    struct face *face = NULL;
     struct face *reqface = NULL;
-    struct ccn_indexbuf *comps = NULL;
-    struct ccn_forwarding **p = NULL;
-    struct ccn_forwarding *f = NULL;
-    struct nameprefix_entry *npe = NULL;
     int nackallowed = 0;
     
     res = ccn_parse_ContentObject(msg, size, &pco, NULL);
@@ -3205,53 +5112,145 @@ ccnd_req_unreg(struct ccnd_handle *h,
     res = check_forwarding_entry_ccndid(h, forwarding_entry, reply_body);
     if (res != 0)
         goto Finish;
-    res = -1;
-    face = face_from_faceid(h, forwarding_entry->faceid);
-    if (face == NULL)
+    res = unreg_entry(h, forwarding_entry);
+    if (res < 0)
         goto Finish;
-    comps = ccn_indexbuf_create();
-    n_name_comp = ccn_name_split(forwarding_entry->name_prefix, comps);
-    if (n_name_comp < 0)
+    res = ccnb_append_forwarding_entry(reply_body, forwarding_entry);
+    if (res > 0)
+        res = 0;
+Finish:
+    ccn_forwarding_entry_destroy(&forwarding_entry);
+    if (nackallowed && res < 0)
+        res = ccnd_nack(h, reply_body, 450, "could not unregister prefix");
+    return((nackallowed || res <= 0) ? res : -1);
+}
+
+/**
+ * @brief Process a bulkreg request for the ccnd internal client.
+ *
+ * This carries many registration changes in one signed request.  Each
+ * ForwardingEntry has its own Action (prefixreg, selfreg, or unreg), and
+ * they are carried out in order, in one pass over the prefix table.
+ * Pending interests are then revisited once for all of the changes.
+ *
+ * @param h is the ccnd handle
+ * @param msg points to a ccnd-encoded ContentObject containing a
+ *          Collection of ForwardingEntry elements in its Content.
+ * @param size is its size in bytes
+ * @param reply_body is a buffer to hold the Content of the reply, as a
+ *         Collection holding a ForwardingEntry (without the Name) or a
+ *         StatusResponse for each entry of the request, in order
+ * @returns 0 for success, negative for no response, or CCN_CONTENT_NACK to
+ *         set the response type to NACK.
+ */
+int
+ccnd_req_bulkreg(struct ccnd_handle *h,
+                 const unsigned char *msg, size_t size,
+                 struct ccn_charbuf *reply_body)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct ccn_parsed_ContentObject pco = {0};
+    struct ccn_buf_decoder decoder;
+    struct ccn_buf_decoder *d = NULL;
+    const unsigned char *req;
+    size_t req_size;
+    size_t start;
+    struct ccn_forwarding_entry *forwarding_entry = NULL;
+    struct face *reqface = NULL;
+    struct fib_change *chg = NULL;
+    struct fib_change *more = NULL;
+    int nchg = 0;
+    int limit = 0;
+    int n = 0;
+    int failed = 0;
+    int unreg;
+    int nackallowed = 0;
+    int res;
+    
+    res = ccn_parse_ContentObject(msg, size, &pco, NULL);
+    if (res < 0)
         goto Finish;
-    if (n_name_comp + 1 > comps->n)
+    res = ccn_content_get_value(msg, size, &pco, &req, &req_size);
+    if (res < 0)
         goto Finish;
-    start = comps->buf[0];
-    stop = comps->buf[n_name_comp];
-    npe = hashtb_lookup(h->nameprefix_tab,
-                        forwarding_entry->name_prefix->buf + start,
-                        stop - start);
-    if (npe == NULL)
+    res = -1;
+    /* consider the source ... */
+    reqface = face_from_faceid(h, h->interest_faceid);
+    if (reqface == NULL)
         goto Finish;
-    found = 0;
-    p = &npe->forwarding;
-    for (f = npe->forwarding; f != NULL; f = f->next) {
-        if (f->faceid == forwarding_entry->faceid) {
-            found = 1;
-            if (h->debug & (2 | 4))
-                ccnd_debug_ccnb(h, __LINE__, "prefix_unreg", face,
-                                forwarding_entry->name_prefix->buf,
-                                forwarding_entry->name_prefix->length);
-            *p = f->next;
-            free(f);
-            f = NULL;
-            h->forward_to_gen += 1;
+    if ((reqface->flags & (CCN_FACE_GG | CCN_FACE_REGOK)) == 0)
+        goto Finish;
+    nackallowed = 1;
+    d = ccn_buf_decoder_start(&decoder, req, req_size);
+    if (!ccn_buf_match_dtag(d, CCN_DTAG_Collection))
+        goto Finish;
+    ccn_buf_advance(d);
+    ccnb_element_begin(reply_body, CCN_DTAG_Collection);
+    hashtb_start(h->nameprefix_tab, e);
+    while (ccn_buf_match_dtag(d, CCN_DTAG_ForwardingEntry)) {
+        start = d->decoder.token_index;
+        ccn_buf_advance_past_element(d);
+        if (d->decoder.state < 0)
             break;
+        if (nchg == limit) {
+            more = realloc(chg, (2 * limit + 16) * sizeof(*chg));
+            if (more == NULL)
+                break;
+            chg = more;
+            limit = 2 * limit + 16;
         }
-        p = &(f->next);
+        forwarding_entry = ccn_forwarding_entry_parse(req + start,
+                                            d->decoder.token_index - start);
+        res = -1;
+        unreg = 0;
+        chg[nchg].npe = NULL;
+        if (forwarding_entry == NULL || forwarding_entry->action == NULL)
+            res = -1;
+        else if (strcmp(forwarding_entry->action, "prefixreg") == 0)
+            res = prefixreg_entry(h, e, forwarding_entry, 0, &chg[nchg]);
+        else if (strcmp(forwarding_entry->action, "selfreg") == 0)
+            res = prefixreg_entry(h, e, forwarding_entry, 1, &chg[nchg]);
+        else if (strcmp(forwarding_entry->action, "unreg") == 0) {
+            unreg = 1;
+            if ((reqface->flags & CCN_FACE_GG) != 0 &&
+                forwarding_entry->faceid != CCN_NOFACEID &&
+                forwarding_entry->name_prefix != NULL &&
+                forwarding_entry->ccnd_id_size == sizeof(h->ccnd_id) &&
+                memcmp(forwarding_entry->ccnd_id, h->ccnd_id,
+                       sizeof(h->ccnd_id)) == 0)
+                res = unreg_entry(h, forwarding_entry);
+        }
+        if (res == 0) {
+            /* The requester knows what it asked for, so keep the reply small */
+            forwarding_entry->name_prefix->length = 0;
+            forwarding_entry->ccnd_id_size = 0;
+            ccnb_append_forwarding_entry(reply_body, forwarding_entry);
+            if (chg[nchg].npe != NULL)
+                nchg++;
+        }
+        else {
+            ccn_encode_StatusResponse(reply_body, 450, unreg ?
+                                      "could not unregister prefix" :
+                                      "could not register prefix");
+            failed++;
+        }
+        ccn_forwarding_entry_destroy(&forwarding_entry);
+        n++;
     }
-    if (!found)
-        goto Finish;    
-    forwarding_entry->action = NULL;
-    forwarding_entry->ccnd_id = h->ccnd_id;
-    forwarding_entry->ccnd_id_size = sizeof(h->ccnd_id);
-    res = ccnb_append_forwarding_entry(reply_body, forwarding_entry);
-    if (res > 0)
-        res = 0;
+    hashtb_end(e);
+    ccn_buf_check_close(d);
+    if (d->decoder.state < 0)
+        ccnd_msg(h, "bulkreg: request malformed after %d entries", n);
+    if (nchg > 0)
+        update_npe_children(h, chg, nchg);
+    if (h->debug & (2 | 4))
+        ccnd_msg(h, "bulkreg: %d entries, %d failed", n, failed);
+    res = ccnb_element_end(reply_body);
 Finish:
-    ccn_forwarding_entry_destroy(&forwarding_entry);
-    ccn_indexbuf_destroy(&comps);
+    free(chg);
     if (nackallowed && res < 0)
-        res = ccnd_nack(h, reply_body, 450, "could not unregister prefix");
+        res = ccnd_nack(h, reply_body, 450, "could not process bulkreg");
     return((nackallowed || res <= 0) ? res : -1);
 }
 
@@ -3333,7 +5332,7 @@ ccnd_req_strategy(struct ccnd_handle *h,
     reason = __LINE__;
     hashtb_start(h->nameprefix_tab, e);
     res = nameprefix_seek(h, e, strategy_selection->name_prefix->buf, comps, n);
-    npe = e->data;
+    npe = (res < 0) ? NULL : e->data;
     hashtb_end(e);
     if (npe == NULL || res < 0) {
         reason = __LINE__;
@@ -3421,6 +5420,41 @@ strategy_init_error(struct ccnd_handle *h,
     ccn_charbuf_putf(h->errbuf, "%s", message);
 }
 
+/**
+ * Note a change to the forwarding entries of npe
+ *
+ * Only npe and the entries below it need to recompute forward_to; the
+ * cached results elsewhere in the table remain good.
+ */
+static void
+forwarding_changed(struct ccnd_handle *h, struct nameprefix_entry *npe)
+{
+    h->forward_to_gen += 1;
+    npe->fchg = h->forward_to_gen;
+}
+
+/**
+ * Check whether the cached forward_to of npe may be out of date
+ *
+ * It is if npe or any of its ancestors has had its forwarding entries
+ * changed since forward_to was computed.  If nothing has changed, the
+ * entry is brought up to the current generation so that the next check
+ * is quick.
+ */
+static int
+forward_to_stale(struct ccnd_handle *h, struct nameprefix_entry *npe)
+{
+    struct nameprefix_entry *p;
+    
+    if (npe->fgen == h->forward_to_gen)
+        return(0);
+    for (p = npe; p != NULL; p = p->parent)
+        if ((int)(p->fchg - npe->fgen) > 0)
+            return(1);
+    npe->fgen = h->forward_to_gen;
+    return(0);
+}
+
 /**
  * Set up forward_to list for a name prefix entry.
  *
@@ -3511,7 +5545,7 @@ get_outbound_faces(struct ccnd_handle *h,
     
     while (npe->parent != NULL && npe->forwarding == NULL)
         npe = npe->parent;
-    if (npe->fgen != h->forward_to_gen)
+    if (forward_to_stale(h, npe))
         update_forward_to(h, npe);
     x = ccn_indexbuf_create();
     if (pi->scope == 0)
@@ -3644,7 +5678,15 @@ send_interest(struct ccnd_handle *h, struct interest_entry *ie,
     }
     p->pfi_flags &= ~(CCND_PFI_SENDUPST | CCND_PFI_UPHUNGRY);
     ccnd_meter_bump(h, face->meter[FM_INTO], 1);
-    stuff_and_send(h, face, ie->interest_msg, ie->size - 1, c->buf, c->length, (h->debug & 2) ? "interest_to" : NULL, __LINE__);
+    if (face->outq != NULL && ie->pkt == NULL) {
+        /* Blocked, so let output queues share one copy of the interest */
+        ie->pkt = pktbuf_create(ie->size - 1);
+        if (ie->pkt != NULL)
+            memcpy(ie->pkt->buf, ie->interest_msg, ie->size - 1);
+    }
+    stuff_and_send(h, face, ie->pkt,
+                   (ie->pkt != NULL) ? ie->pkt->buf : ie->interest_msg,
+                   ie->size - 1, c->buf, c->length, (h->debug & 2) ? "interest_to" : NULL, __LINE__);
     return(p);
 }
 
@@ -3949,8 +5991,9 @@ pfi_create(struct ccnd_handle *h,
     if (noncesize > CCND_PFI_NONCESZ) return(NULL);
     if (noncesize > nsize)
         nsize = noncesize;
-    p = calloc(1, sizeof(*p) + nsize - TYPICAL_NONCE_SIZE);
+    p = ccnd_slab_alloc(h, sizeof(*p) + nsize - TYPICAL_NONCE_SIZE);
     if (p == NULL) return(NULL);
+    memset(p, 0, sizeof(*p) + nsize - TYPICAL_NONCE_SIZE);
     p->faceid = faceid;
     p->renewed = h->wtnow;
     p->expiry = h->wtnow;
@@ -3985,7 +6028,7 @@ pfi_destroy(struct ccnd_handle *h, struct interest_entry *ie,
             face->outstanding_interests -= 1;
     }
     *pp = p->next;
-    free(p);
+    ccnd_slab_free(h, p);
 }
 
 /**
@@ -4005,8 +6048,9 @@ pfi_seek(struct ccnd_handle *h, struct interest_entry *ie,
         if (p->faceid == faceid && (p->pfi_flags & pfi_flag) != 0)
             return(p);
     }
-    p = calloc(1, sizeof(*p));
+    p = ccnd_slab_alloc(h, sizeof(*p));
     if (p != NULL) {
+        memset(p, 0, sizeof(*p));
         p->faceid = faceid;
         p->pfi_flags = pfi_flag;
         p->expiry = h->wtnow;
@@ -4208,15 +6252,16 @@ propagate_interest(struct ccnd_handle *h,
         ie->strategy.ie = ie;
     }
     if (ie->interest_msg == NULL) {
-        struct ccn_parsed_interest xpi = {0};
         int xres;
         link_interest_entry_to_nameprefix(h, ie, npe);
         ie->interest_msg = e->key;
         ie->size = pi->offset[CCN_PI_B_InterestLifetime] + 1;
         /* Ugly bit, this.  Clear the extension byte. */
         ((unsigned char *)(intptr_t)ie->interest_msg)[ie->size - 1] = 0;
-        xres = ccn_parse_interest(ie->interest_msg, ie->size, &xpi, NULL);
+        /* Keep the parse, so matching content need not redo it */
+        xres = ccn_parse_interest(ie->interest_msg, ie->size, &ie->pi, NULL);
         if (xres < 0) abort();
+        ie->excl = compile_exclude(ie->interest_msg, &ie->pi);
     }
     lifetime = ccn_interest_lifetime(msg, pi);
     outbound = get_outbound_faces(h, face, msg, pi, npe);
@@ -4274,70 +6319,130 @@ Bail:
 }
 
 /**
- * We have a FIB change - accelerate forwarding of existing interests
+ * Arrange to send a pending interest to a newly registered face
+ *
+ * Nothing is done if the interest has already gone there, or if the
+ * face is not among the outbound faces for the interest.
  */
 static void
-update_npe_children(struct ccnd_handle *h, struct nameprefix_entry *npe, unsigned faceid)
+ie_new_upstream(struct ccnd_handle *h, struct interest_entry *ie,
+                unsigned faceid, unsigned *usec)
 {
-    struct hashtb_enumerator ee;
-    struct hashtb_enumerator *e = &ee;
     struct face *fface = NULL;
-    struct ccn_parsed_interest pi;
     struct pit_face_item *p = NULL;
-    struct interest_entry *ie = NULL;
-    struct nameprefix_entry *x = NULL;
     struct ccn_indexbuf *ob = NULL;
     int i;
+    
+    for (fface = NULL, p = ie->strategy.pfl; p != NULL; p = p->next) {
+        if (p->faceid == faceid) {
+            if ((p->pfi_flags & CCND_PFI_UPSTREAM) != 0) {
+                fface = NULL;
+                break;
+            }
+        }
+        else if ((p->pfi_flags & CCND_PFI_DNSTREAM) != 0) {
+            if (fface == NULL || (fface->flags & CCN_FACE_GG) == 0)
+                fface = face_from_faceid(h, p->faceid);
+        }
+    }
+    if (fface == NULL)
+        return;
+    ob = get_outbound_faces(h, fface, ie->interest_msg, &ie->pi, ie->ll.npe);
+    for (i = 0; i < ob->n; i++) {
+        if (ob->buf[i] == faceid) {
+            p = pfi_seek(h, ie, faceid, CCND_PFI_UPSTREAM);
+            // XXX - strategy callout should be able to control what happens next.
+            if ((p->pfi_flags & CCND_PFI_UPENDING) == 0) {
+                p->expiry = h->wtnow + *usec / (1000000 / WTHZ);
+                *usec += 200;
+                if (ie->ev != NULL && wt_compare(p->expiry + 4, ie->ev->evint) < 0)
+                    ccn_schedule_cancel(h->sched, ie->ev);
+                if (ie->ev == NULL)
+                    ie->ev = ccn_schedule_event(h->sched, *usec, do_propagate, ie, p->expiry);
+            }
+            break;
+        }
+    }
+    ccn_indexbuf_destroy(&ob);
+}
+
+/**
+ * We have FIB changes - accelerate forwarding of existing interests
+ *
+ * One pass over the interest table serves for the whole list of changes.
+ * Every prefix in the list was stamped by forwarding_changed, so the
+ * ancestors that were not are passed over quickly.  For a longer list,
+ * the changes are sorted by prefix and indexed by a side table, so a
+ * stamped ancestor finds its own changes with one lookup.  The list may
+ * be reordered.
+ */
+static void
+update_npe_children(struct ccnd_handle *h,
+                    struct fib_change *chg, int n)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct hashtb *runs = NULL;
+    struct fib_change_run *run = NULL;
+    struct fib_change_run one = {0, 1};
+    struct interest_entry *ie = NULL;
+    struct nameprefix_entry *x = NULL;
     unsigned usec = 6000; /*  a bit of time for prefix reg  */
+    int oldest;
+    int j, k;
 
+    if (n <= 0)
+        return;
+    oldest = chg[0].npe->fchg;
+    for (k = 1; k < n; k++)
+        if ((int)(chg[k].npe->fchg - oldest) < 0)
+            oldest = chg[k].npe->fchg;
+    if (n > 1) {
+        qsort(chg, n, sizeof(chg[0]), &fib_change_compare);
+        runs = hashtb_create(sizeof(struct fib_change_run), NULL);
+        if (runs == NULL)
+            return;
+        hashtb_start(runs, e);
+        for (k = 0; k < n; k = j) {
+            for (j = k + 1; j < n && chg[j].npe == chg[k].npe; j++)
+                continue;
+            if (hashtb_seek(e, &chg[k].npe, sizeof(chg[k].npe), 0) < 0)
+                break;
+            run = e->data;
+            run->first = k;
+            run->n = j - k;
+        }
+        hashtb_end(e);
+    }
     hashtb_start(h->interest_tab, e);
     for (ie = e->data; ie != NULL; ie = e->data) {
         for (x = ie->ll.npe; x != NULL; x = x->parent) {
-            if (x == npe) {
-                for (fface = NULL, p = ie->strategy.pfl; p != NULL; p = p->next) {
-                    if (p->faceid == faceid) {
-                        if ((p->pfi_flags & CCND_PFI_UPSTREAM) != 0) {
-                            fface = NULL;
-                            break;
-                        }
-                    }
-                    else if ((p->pfi_flags & CCND_PFI_DNSTREAM) != 0) {
-                        if (fface == NULL || (fface->flags & CCN_FACE_GG) == 0)
-                            fface = face_from_faceid(h, p->faceid);
-                    }
-                }
-                if (fface != NULL) {
-                    ccn_parse_interest(ie->interest_msg, ie->size, &pi, NULL);
-                    ob = get_outbound_faces(h, fface, ie->interest_msg,
-                                            &pi, ie->ll.npe);
-                    for (i = 0; i < ob->n; i++) {
-                        if (ob->buf[i] == faceid) {
-                            p = pfi_seek(h, ie, faceid, CCND_PFI_UPSTREAM);
-                            // XXX - strategy callout should be able to control what happens next.
-                            if ((p->pfi_flags & CCND_PFI_UPENDING) == 0) {
-                                p->expiry = h->wtnow + usec / (1000000 / WTHZ);
-                                usec += 200;
-                                if (ie->ev != NULL && wt_compare(p->expiry + 4, ie->ev->evint) < 0)
-                                    ccn_schedule_cancel(h->sched, ie->ev);
-                                if (ie->ev == NULL)
-                                    ie->ev = ccn_schedule_event(h->sched, usec, do_propagate, ie, p->expiry);
-                            }
-                            break;
-                        }
-                    }
-                    ccn_indexbuf_destroy(&ob);
-                }
-                break;
-            }
+            if ((int)(x->fchg - oldest) < 0)
+                continue;
+            if (runs != NULL)
+                run = hashtb_lookup(runs, &x, sizeof(x));
+            else
+                run = (x == chg[0].npe) ? &one : NULL;
+            if (run == NULL)
+                continue;
+            for (k = run->first; k < run->first + run->n; k++)
+                ie_new_upstream(h, ie, chg[k].faceid, &usec);
         }
         hashtb_next(e);
     }
     hashtb_end(e);
+    hashtb_destroy(&runs);
 }
 
 /**
  * Creates a nameprefix entry if it does not already exist, together
  * with all of its parents.
+ *
+ * The levels that already exist are found by following the child index
+ * from the root, so only the new levels need a hash table seek.
+ * @returns as for hashtb_seek, with e positioned at the entry, or -1
+ *          if the entry could not be made, in which case e->data must
+ *          not be used.
  */
 static int
 nameprefix_seek(struct ccnd_handle *h, struct hashtb_enumerator *e,
@@ -4350,11 +6455,26 @@ nameprefix_seek(struct ccnd_handle *h, struct hashtb_enumerator *e,
     struct nameprefix_entry *parent = NULL;
     struct nameprefix_entry *npe = NULL;
     struct ielinks *head = NULL;
+    const unsigned char *comp = NULL;
+    size_t compsize = 0;
 
     if (ncomps + 1 > comps->n)
         return(-1);
     base = comps->buf[0];
-    for (i = 0; i <= ncomps; i++) {
+    /* Skip over the levels that are already present */
+    npe = hashtb_lookup(h->nameprefix_tab, msg + base, 0);
+    for (i = 0; npe != NULL; i++) {
+        parent = npe;
+        if (i == ncomps)
+            break;
+        res = ccn_ref_tagged_BLOB(CCN_DTAG_Component, msg,
+                                  comps->buf[i], comps->buf[i + 1],
+                                  &comp, &compsize);
+        if (res < 0)
+            return(-1);
+        npe = ccnd_lpm_child(h->nameprefix_index, parent, comp, compsize);
+    }
+    for (; i <= ncomps; i++) {
         res = hashtb_seek(e, msg + base, comps->buf[i] - base, 0);
         if (res < 0)
             break;
@@ -4367,6 +6487,7 @@ nameprefix_seek(struct ccnd_handle *h, struct hashtb_enumerator *e,
             npe->parent = parent;
             npe->forwarding = NULL;
             npe->fgen = h->forward_to_gen - 1;
+            npe->fchg = h->forward_to_gen;
             npe->forward_to = NULL;
             npe->si = NULL;
             if (parent != NULL) {
@@ -4374,6 +6495,17 @@ nameprefix_seek(struct ccnd_handle *h, struct hashtb_enumerator *e,
                 npe->flags = parent->flags;
                 npe->sst = parent->sst;
                 // XXX - it might be a good idea to flag the copy
+                ccn_ref_tagged_BLOB(CCN_DTAG_Component, msg,
+                                    comps->buf[i - 1], comps->buf[i],
+                                    &comp, &compsize);
+                if (ccnd_lpm_link(h->nameprefix_index, parent,
+                                  comp, compsize, npe) < 0) {
+                    /* ccnd_lpm_match could not find it, so do not keep it */
+                    parent->children--;
+                    hashtb_delete(e);
+                    res = -1;
+                    break;
+                }
             }
             else {
                 for (j = 0; j < CCND_STRATEGY_STATE_N; j++)
@@ -4438,7 +6570,7 @@ drop_nonlocal_interest(struct ccnd_handle *h, struct nameprefix_entry *npe,
                        struct face *face,
                        unsigned char *msg, size_t size)
 {
-    if (npe->fgen != h->forward_to_gen)
+    if (forward_to_stale(h, npe))
         update_forward_to(h, npe);
     if ((npe->flags & CCN_FORW_LOCAL) != 0 &&
         (face->flags & CCN_FACE_GG) == 0) {
@@ -4449,6 +6581,59 @@ drop_nonlocal_interest(struct ccnd_handle *h, struct nameprefix_entry *npe,
     return(0);
 }
 
+/**
+ * Bring content found in the on-disk tier back into the content store
+ *
+ * The tier's copy is dropped, since the content is in memory again.
+ * @returns the new content entry, or NULL.
+ */
+static struct content_entry *
+content_promote(struct ccnd_handle *h, const struct cs_tier_hit *hit)
+{
+    struct content_entry *content = NULL;
+    struct ccnd_pktbuf *pkt = NULL;
+    struct ccny *y = NULL;
+    int now;
+    
+    if (h->content_tree->n >= h->content_tree->limit)
+        ccn_nametree_grow(h->content_tree);
+    pkt = pktbuf_create(hit->size + hit->keysize);
+    y = ccny_create_in(h->content_tree, nrand48(h->seed), sizeof(*content));
+    if (pkt == NULL || y == NULL) {
+        pktbuf_release(&pkt);
+        ccny_destroy(h->content_tree, &y);
+        return(NULL);
+    }
+    memcpy(pkt->buf, hit->ccnb, hit->size);
+    memcpy(pkt->buf + hit->size, hit->key, hit->keysize);
+    ccny_set_key_fields(y, pkt->buf + hit->size, hit->keysize);
+    content = ccny_payload(y);
+    content->pkt = pkt;
+    content->ccnb = pkt->buf;
+    if (ccny_enroll(h->content_tree, y) != 0 || ccny_cookie(y) == 0) {
+        /* A copy is already in memory, perhaps stale */
+        ccny_destroy(h->content_tree, &y);
+        return(NULL);
+    }
+    content->accession = ccny_cookie(y);
+    content->arrival_faceid = CCN_NOFACEID;
+    content->ncomps = ccn_flatname_ncomps(hit->key, hit->keysize);
+    content->size = hit->size;
+    h->cs_bytes += content_charge(y, content);
+    if (h->cs_bytes > h->cs_bytes_peak)
+        h->cs_bytes_peak = h->cs_bytes;
+    now = h->sec - h->starttime;
+    content->staletime = now + (hit->freshness > 0 ? hit->freshness : 0);
+    content_enqueuex(h, content);
+    h->accessioned++;
+    ccnd_cs_insert(h, content);
+    content_name_index_add(h, y);
+    ccnd_cs_tier_drop(h, hit);
+    if (h->debug & 4)
+        ccnd_debug_content(h, __LINE__, "promote", NULL, content);
+    return(content);
+}
+
 /**
  * Process an incoming interest message.
  *
@@ -4482,6 +6667,9 @@ process_incoming_interest(struct ccnd_handle *h, struct face *face,
     struct content_entry *last_match = NULL;
     struct content_entry *next = NULL;
     struct ccn_charbuf *flatname = NULL;
+    struct ccn_exclusion *excl = NULL;
+    struct cs_tier_hit hit;
+    int promoted = 0;
     struct ccn_indexbuf *comps = indexbuf_obtain(h);
     if (size > 65535)
         res = -__LINE__;
@@ -4542,14 +6730,21 @@ process_incoming_interest(struct ccnd_handle *h, struct face *face,
         matched = 0;
         hashtb_start(h->nameprefix_tab, e);
         res = nameprefix_seek(h, e, msg, comps, pi->prefix_comps);
-        npe = e->data;
+        npe = (res < 0) ? NULL : e->data;
         if (npe == NULL || drop_nonlocal_interest(h, npe, face, msg, size))
             goto Bail;
         if ((pi->answerfrom & CCN_AOK_CS) != 0) {
             flatname = ccn_charbuf_create();
             ccn_flatname_append_from_ccnb(flatname, msg, size, 0, -1);
-            last_match = NULL;
-            content = find_first_match_candidate(h, msg, pi);
+            h->cs_lookups++;
+            ccnd_cs_record(h, flatname->buf, flatname->length);
+            if (content_exact_match(h, msg, size, pi, flatname, s_ok,
+                                    &last_match))
+                content = NULL;
+            else {
+                content = find_first_match_candidate(h, msg, pi);
+                excl = compile_exclude(msg, pi);
+            }
             if (content != NULL && (h->debug & 8))
                 ccnd_debug_content(h, __LINE__, "first_candidate", NULL,
                                    content);
@@ -4570,9 +6765,9 @@ process_incoming_interest(struct ccnd_handle *h, struct face *face,
                     content = next;
                     goto check_next_prefix;
                 }
-                if (ccn_content_matches_interest(content->ccnb,
+                if (ccn_content_matches_interest_excl(content->ccnb,
                                        content->size,
-                                       1, NULL, msg, size, pi)) {
+                                       1, NULL, msg, size, pi, excl)) {
                     if (h->debug & 8)
                         ccnd_debug_content(h, __LINE__, "matches", NULL,
                                            content);
@@ -4596,9 +6791,19 @@ process_incoming_interest(struct ccnd_handle *h, struct face *face,
             }
             if (last_match != NULL)
                 content = last_match;
+            if (content == NULL && h->cs_tier != NULL &&
+                ccnd_cs_tier_lookup(h, msg, size, pi, excl, flatname, &hit) == 0) {
+                content = content_promote(h, &hit);
+                if (content != NULL) {
+                    h->cs_tier_hits++;
+                    promoted = 1;
+                }
+            }
             if (content != NULL) {
                 /* Check to see if we are planning to send already */
                 enum cq_delay_class c;
+                h->cs_hits++;
+                ccnd_cs_hit(h, content);
                 for (c = 0, k = -1; c < CCN_CQ_N && k == -1; c++)
                     if (face->q[c] != NULL)
                         k = ccn_indexbuf_member(face->q[c]->send_queue, content->accession);
@@ -4614,6 +6819,8 @@ process_incoming_interest(struct ccnd_handle *h, struct face *face,
                 if ((pi->answerfrom & CCN_AOK_EXPIRE) != 0)
                     mark_stale(h, content);
                 matched = 1;
+                if (promoted)
+                    content_tree_trim(h);
             }
         }
         if (!matched && npe != NULL && (pi->answerfrom & CCN_AOK_EXPIRE) == 0)
@@ -4623,6 +6830,7 @@ process_incoming_interest(struct ccnd_handle *h, struct face *face,
     }
     indexbuf_release(h, comps);
     ccn_charbuf_destroy(&flatname);
+    ccn_exclusion_destroy(&excl);
 }
 
 const struct strategy_class *
@@ -4754,7 +6962,7 @@ set_content_timer(struct ccnd_handle *h, struct content_entry *content,
     int seconds = 0;
     size_t start = pco->offset[CCN_PCO_B_FreshnessSeconds];
     size_t stop  = pco->offset[CCN_PCO_E_FreshnessSeconds];
-    if (h->capacity == 0)
+    if (h->capacity == 0 || h->cap_bytes == 0)
         goto Finish;        /* force zero freshness */
     if (start == stop)
         seconds = h->tts_default;
@@ -4772,7 +6980,94 @@ Finish:
 }
 
 /**
- * Discard content as needed to enforce capacity limit
+ * Remove content to make room in the store
+ *
+ * If there is an on-disk tier, content that is still fresh is copied
+ * there first.
+ */
+static void
+evict_content(struct ccnd_handle *h, struct content_entry *content)
+{
+    struct ccny *y = NULL;
+    
+    if (h->cs_tier != NULL && !is_stale(h, content)) {
+        y = ccny_from_cookie(h->content_tree, content->accession);
+        if (y != NULL && ccnd_cs_tier_spill(h, ccny_key(y), ccny_keylen(y),
+                             content->ccnb, content->size,
+                             content->staletime - (h->sec - h->starttime)) == 0)
+            h->cs_spilled++;
+    }
+    remove_content(h, content);
+}
+
+/**
+ * Test whether the content store is within its count and byte limits
+ */
+static int
+content_tree_fits(struct ccnd_handle *h)
+{
+    return(h->content_tree->n <= h->capacity && h->cs_bytes <= h->cap_bytes);
+}
+
+/**
+ * Enforce the capacity limits using the replacement policy
+ *
+ * Stale content goes first, whatever the policy.  Stale content that is
+ * still queued for sending (for instance, a newcomer that was refused
+ * admission) will go on a later pass, so it is not made up for by
+ * evicting something else now.
+ */
+static void
+content_tree_trim_policy(struct ccnd_handle *h)
+{
+    struct content_entry *c;
+    struct content_entry *nextx;
+    unsigned n_pending = 0;
+    unsigned long long b_pending = 0;
+    int tries;
+    
+    tries = 30;
+    for (c = h->headx->nextx; c != h->headx && is_stale(h, c); c = nextx) {
+        nextx = c->nextx;
+        if (c->refs == 0) {
+            remove_content(h, c);
+            if (content_tree_fits(h))
+                return;
+        }
+        else {
+            n_pending++;
+            b_pending += content_charge(ccny_from_cookie(h->content_tree,
+                                                         c->accession), c);
+            if (--tries <= 0)
+                break;
+        }
+    }
+    for (tries = 30; tries > 0; tries--) {
+        if (h->content_tree->n - n_pending <= h->capacity &&
+            h->cs_bytes - b_pending <= h->cap_bytes)
+            return;
+        c = ccnd_cs_victim(h);
+        if (c == NULL)
+            break;
+        if (h->debug & 4)
+            ccnd_debug_content(h, __LINE__, "evict", NULL, c);
+        h->cs_evicted++;
+        evict_content(h, c);
+    }
+    if (h->content_tree->n > h->content_tree->limit) {
+        c = h->headx->nextx;
+        if (c != h->headx)
+            evict_content(h, c); /* logs remove_queued_content */
+    }
+}
+
+/**
+ * Discard content as needed to enforce capacity limits
+ *
+ * Both the count limit (CCND_CAP) and the byte budget (CCND_CAP_BYTES)
+ * are enforced.  Without a replacement policy, the content that is
+ * soonest to go stale is discarded first.  Fresh content that is
+ * discarded goes to the on-disk tier, if there is one.
  */
 void
 content_tree_trim(struct ccnd_handle *h) {
@@ -4780,14 +7075,18 @@ content_tree_trim(struct ccnd_handle *h) {
     struct content_entry *c;
     struct content_entry *nextx;
     
-    if (h->content_tree->n <= h->capacity)
+    if (content_tree_fits(h))
         return;
+    if (h->cs_policy != NULL) {
+        content_tree_trim_policy(h);
+        return;
+    }
     tries = 30;
     for (c = h->headx->nextx; c != h->headx; c = nextx) {
         nextx = c->nextx;
         if (c->refs == 0) {
-            remove_content(h, c);
-            if (h->content_tree->n <= h->capacity)
+            evict_content(h, c);
+            if (content_tree_fits(h))
                 return;
         }
         else if (!is_stale(h, c)) {
@@ -4804,7 +7103,7 @@ content_tree_trim(struct ccnd_handle *h) {
         /* we've tried and failed to preserve queued content */
         c = h->headx->nextx;
         if (c != h->headx)
-            remove_content(h, c); /* logs remove_queued_content */
+            evict_content(h, c); /* logs remove_queued_content */
     }
 }
 
@@ -4839,6 +7138,7 @@ process_incoming_content(struct ccnd_handle *h, struct face *face,
     struct ccn_indexbuf *comps = indexbuf_obtain(h);
     struct ccn_charbuf *f = charbuf_obtain(h);
     struct ccny *y = NULL;
+    struct ccnd_pktbuf *pkt = NULL;
     ccn_cookie ocookie;
     
     msg = wire_msg;
@@ -4870,13 +7170,19 @@ process_incoming_content(struct ccnd_handle *h, struct face *face,
     }
     ccn_flatname_append_from_ccnb(f, msg, size, 0, -1);
     ccn_flatname_append_component(f, obj.digest, obj.digest_bytes);
-    y = ccny_create(nrand48(h->seed), sizeof(*content));
-    res = ccny_set_key(y, f->buf, f->length);
-    if (res < 0) {
+    /* One buffer holds the ccnb followed by the key; ccnb is filled later */
+    pkt = pktbuf_create(size + f->length);
+    y = ccny_create_in(h->content_tree, nrand48(h->seed), sizeof(*content));
+    if (pkt == NULL || y == NULL) {
+        pktbuf_release(&pkt);
         res = -__LINE__;
         goto Bail;
     }
-    content = ccny_payload(y); /* Allocated by ccny_create */
+    memcpy(pkt->buf + size, f->buf, f->length);
+    ccny_set_key_fields(y, pkt->buf + size, f->length);
+    content = ccny_payload(y); /* Allocated by ccny_create_in */
+    content->pkt = pkt; /* Now released by content_finalize */
+    content->ccnb = pkt->buf;
     ocookie = ccny_enroll(h->content_tree, y);
     if (ocookie != 0) {
         /* An entry was already present */
@@ -4909,13 +7215,20 @@ process_incoming_content(struct ccnd_handle *h, struct face *face,
         content->accession = ccny_cookie(y);
         content->arrival_faceid = face->faceid;
         content->ncomps = comps->n + 1;
-        content->ccnb = malloc(size);
-        if (content->ccnb == NULL)
-            goto Bail;
         content->size = size;
         memcpy(content->ccnb, msg, size);
+        h->cs_bytes += content_charge(y, content);
+        if (h->cs_bytes > h->cs_bytes_peak)
+            h->cs_bytes_peak = h->cs_bytes;
         set_content_timer(h, content, &obj);
         h->accessioned++;
+        ccnd_cs_insert(h, content);
+        content_name_index_add(h, y);
+        if (!content_tree_fits(h) && !ccnd_cs_admit(h, content)) {
+            /* Forward it, but do not keep it */
+            mark_stale(h, content);
+            h->cs_rejected++;
+        }
         if (h->debug & 4)
             ccnd_debug_content(h, __LINE__, "content_from", face, content);
         res = 1;
@@ -4967,6 +7280,45 @@ Bail:
     }
 }
 
+/**
+ * Classify a face for the purpose of shedding load
+ *
+ * @returns 0 for local applications, 1 for configured or negotiated
+ *          neighbors, and 2 for anyone else.
+ */
+static int
+face_input_class(struct ccnd_handle *h, struct face *face)
+{
+    if (face == h->face0 || (face->flags & CCN_FACE_GG) != 0)
+        return(0);
+    if ((face->flags & (CCN_FACE_PERMANENT | CCN_FACE_ADJ)) != 0)
+        return(1);
+    return(2);
+}
+
+/**
+ * Decide whether to shed an incoming interest because we are overloaded
+ *
+ * Once input has kept backing up for overload_usec (CCND_OVERLOAD_MICROSEC),
+ * interests from unknown faces are dropped; if that goes on four times as
+ * long, interests from neighbors are dropped as well.  Interests from
+ * local applications are never shed.
+ */
+static int
+shed_interest(struct ccnd_handle *h, struct face *face)
+{
+    int cls;
+    
+    if (h->overload == 0)
+        return(0);
+    cls = face_input_class(h, face);
+    if (cls == 2 || (cls == 1 && h->overload >= 2)) {
+        h->interests_shed++;
+        return(1);
+    }
+    return(0);
+}
+
 /**
  * Process an incoming message.
  *
@@ -5012,6 +7364,7 @@ process_input_message(struct ccnd_handle *h, struct face *face,
                 face->flags &= ~CCN_FACE_GG;
                 register_new_face(h, face);
             }
+            face->pduseq_ok = 0;
             memset(d, 0, sizeof(*d));
             while (d->index < size) {
                 dres = ccn_skeleton_decode(d, msg + d->index, size - d->index);
@@ -5020,14 +7373,25 @@ process_input_message(struct ccnd_handle *h, struct face *face,
                 /* The pdu_ok parameter limits the recursion depth */
                 process_input_message(h, face, msg + d->index - dres, dres, 0);
             }
+            face->pduseq_ok = 0;
             return;
         case CCN_DTAG_Interest:
+            if (shed_interest(h, face))
+                return;
             process_incoming_interest(h, face, msg, size);
             return;
         case CCN_DTAG_ContentObject:
             process_incoming_content(h, face, msg, size);
             return;
         case CCN_DTAG_SequenceNumber:
+        case CCN_DTAG_LinkMTU:
+        case CCN_DTAG_LinkAck:
+            process_incoming_link_message(h, face, dtag, msg, size);
+            return;
+        case CCN_DTAG_Fragment:
+            /* Only makes sense within a PDU */
+            if (pdu_ok)
+                break;
             process_incoming_link_message(h, face, dtag, msg, size);
             return;
         default:
@@ -5177,6 +7541,306 @@ process_input_buffer(struct ccnd_handle *h, struct face *face)
     memset(d, 0, sizeof(*d));
 }
 
+#ifdef CCND_HAVE_MMSG
+/**
+ * State for batched datagram i/o on a socket that we own.
+ *
+ * The receive side is a ring of CCND_DGRAM_BATCH buffers that is filled
+ * by one recvmmsg() call per wakeup.  The send side accumulates outbound
+ * datagrams during one pass through the main loop, to be handed to the
+ * kernel with sendmmsg() just before we wait for more work.
+ */
+struct dgram_batch {
+    unsigned char *rbuf;                /**< receive ring storage */
+    struct mmsghdr rmsg[CCND_DGRAM_BATCH];
+    struct iovec riov[CCND_DGRAM_BATCH];
+    struct sockaddr_storage raddr[CCND_DGRAM_BATCH];
+    int nq;                             /**< number of queued sends */
+    struct ccn_charbuf *qdata;          /**< copied datagram contents */
+    size_t qstart[CCND_DGRAM_BATCH];    /**< offset into qdata or qpkt */
+    struct ccnd_pktbuf *qpkt[CCND_DGRAM_BATCH]; /**< shared contents */
+    size_t qsize[CCND_DGRAM_BATCH];     /**< size of queued datagram */
+    unsigned qfaceid[CCND_DGRAM_BATCH]; /**< face it is being sent to */
+    socklen_t qaddrlen[CCND_DGRAM_BATCH];
+    struct sockaddr_storage qaddr[CCND_DGRAM_BATCH];
+};
+
+/**
+ * Get the batching state for a socket-owning face, creating it if needed.
+ * @returns NULL if no memory.
+ */
+static struct dgram_batch *
+dgram_batch_obtain(struct ccnd_handle *h, struct face *face)
+{
+    struct dgram_batch *b = face->batch;
+    
+    if (b != NULL)
+        return(b);
+    b = calloc(1, sizeof(*b));
+    if (b == NULL)
+        return(NULL);
+    b->rbuf = malloc(CCND_DGRAM_BATCH * CCN_MAX_MESSAGE_BYTES);
+    b->qdata = ccn_charbuf_create();
+    if (b->rbuf == NULL || b->qdata == NULL) {
+        dgram_batch_destroy(&b);
+        return(NULL);
+    }
+    face->batch = b;
+    return(b);
+}
+#endif
+
+/**
+ * Release the datagram batching state of a face.
+ *
+ * Any datagrams still queued for sending are dropped.
+ */
+static void
+dgram_batch_destroy(struct dgram_batch **pb)
+{
+#ifdef CCND_HAVE_MMSG
+    struct dgram_batch *b = *pb;
+    
+    if (b == NULL)
+        return;
+    while (b->nq > 0)
+        pktbuf_release(&b->qpkt[--(b->nq)]);
+    free(b->rbuf);
+    ccn_charbuf_destroy(&b->qdata);
+    free(b);
+    *pb = NULL;
+#endif
+}
+
+/**
+ * Process one datagram that has arrived on the socket of face.
+ */
+static void
+process_input_dgram(struct ccnd_handle *h, struct face *face,
+                    unsigned char *buf, size_t size,
+                    struct sockaddr *addr, socklen_t addrlen)
+{
+    struct ccn_skeleton_decoder decoder = {0};
+    struct ccn_skeleton_decoder *d = &decoder;
+    struct face *source = NULL;
+    size_t msgstart;
+    
+    source = get_dgram_source(h, face, addr, addrlen, (size == 1) ? 1 : 2);
+    ccnd_meter_bump(h, source->meter[FM_BYTI], size);
+    source->recvcount++;
+    source->surplus = 0; // XXX - we don't actually use this, except for some obscure messages.
+    if (size <= 1 && (source->flags & CCN_FACE_DGRAM) != 0) {
+        // XXX - If the initial heartbeat gets missed, we don't realize the locality of the face.
+        if (h->debug & 128)
+            ccnd_msg(h, "%d-byte heartbeat on %d", (int)size, source->faceid);
+        return;
+    }
+    msgstart = 0;
+    ccn_skeleton_decode(d, buf, size);
+    while (d->state == 0) {
+        /* A PDU is allowed once the peer has told us its LinkMTU */
+        process_input_message(h, source,
+                              buf + msgstart,
+                              d->index - msgstart,
+                              (face->flags & CCN_FACE_LOCAL) != 0 ||
+                              source->frag_mtu != 0);
+        msgstart = d->index;
+        if (msgstart == size)
+            return;
+        ccn_skeleton_decode(d, buf + msgstart, size - msgstart);
+    }
+    ccnd_msg(h, "protocol error on face %u, discarding %u bytes",
+        source->faceid, (unsigned)(size - msgstart));
+    /* XXX - should probably ignore this source for a while */
+}
+
+/**
+ * Read and process the datagrams that are waiting on the socket of face.
+ *
+ * Where recvmmsg() is available, up to CCND_DGRAM_BATCH datagrams are
+ * picked up with a single system call.
+ */
+static void
+process_dgram_input(struct ccnd_handle *h, struct face *face)
+{
+    struct sockaddr_storage sstor;
+    socklen_t addrlen = sizeof(sstor);
+    unsigned char *buf;
+    ssize_t res;
+    int fd = face->recv_fd;
+#ifdef CCND_HAVE_MMSG
+    struct dgram_batch *b;
+    int i;
+    
+    b = dgram_batch_obtain(h, face);
+    if (b != NULL) {
+        for (i = 0; i < CCND_DGRAM_BATCH; i++) {
+            b->riov[i].iov_base = b->rbuf + i * CCN_MAX_MESSAGE_BYTES;
+            b->riov[i].iov_len = CCN_MAX_MESSAGE_BYTES;
+            memset(&b->rmsg[i], 0, sizeof(b->rmsg[i]));
+            b->rmsg[i].msg_hdr.msg_name = &b->raddr[i];
+            b->rmsg[i].msg_hdr.msg_namelen = sizeof(b->raddr[i]);
+            b->rmsg[i].msg_hdr.msg_iov = &b->riov[i];
+            b->rmsg[i].msg_hdr.msg_iovlen = 1;
+        }
+        res = recvmmsg(fd, b->rmsg, CCND_DGRAM_BATCH, MSG_DONTWAIT, NULL);
+        if (res == -1) {
+            ccnd_msg(h, "recvmmsg face %u :%s (errno = %d)",
+                        face->faceid, strerror(errno), errno);
+            return;
+        }
+        if (res == CCND_DGRAM_BATCH)
+            h->input_busy = 1; /* there may be more waiting */
+        for (i = 0; i < res; i++) {
+            process_input_dgram(h, face, b->riov[i].iov_base,
+                                b->rmsg[i].msg_len,
+                                (struct sockaddr *)&b->raddr[i],
+                                b->rmsg[i].msg_hdr.msg_namelen);
+            /* Processing might have caused the face to go away */
+            if (hashtb_lookup(h->faces_by_fd, &fd, sizeof(fd)) != face)
+                return;
+        }
+        return;
+    }
+#endif
+    if (face->inbuf == NULL)
+        face->inbuf = ccn_charbuf_create();
+    face->inbuf->length = 0;
+    buf = ccn_charbuf_reserve(face->inbuf, CCN_MAX_MESSAGE_BYTES);
+    memset(&sstor, 0, sizeof(sstor));
+    res = recvfrom(fd, buf, face->inbuf->limit - face->inbuf->length,
+            /* flags */ 0, (struct sockaddr *)&sstor, &addrlen);
+    if (res == -1)
+        ccnd_msg(h, "recvfrom face %u :%s (errno = %d)",
+                    face->faceid, strerror(errno), errno);
+    else
+        process_input_dgram(h, face, buf, res,
+                            (struct sockaddr *)&sstor, addrlen);
+}
+
+/**
+ * Process the complete messages buffered for a stream face
+ *
+ * Each face gets a quantum of CCND_INPUT_QUANTUM bytes per pass through
+ * the main loop (deficit round robin), so that one busy client cannot
+ * starve the others.  Whole messages that do not fit are left in the
+ * buffer, and the face goes onto the input backlog to be resumed on the
+ * next pass.  No more is read from the socket until the backlog is
+ * cleared, so a fast sender is held back by its own connection.
+ */
+static void
+process_stream_input(struct ccnd_handle *h, struct face *face)
+{
+    struct ccn_skeleton_decoder *d = &face->decoder;
+    struct ccn_charbuf *inbuf = face->inbuf;
+    int fd = face->recv_fd;
+    size_t msgstart = 0;
+    size_t size;
+    
+    if (face->input_pass != h->input_pass) {
+        face->input_pass = h->input_pass;
+        face->deficit += CCND_INPUT_QUANTUM;
+    }
+    ccn_skeleton_decode(d, inbuf->buf + d->index, inbuf->length - d->index);
+    while (d->state == 0) {
+        size = d->index - msgstart;
+        if (size > face->deficit) {
+            /* Resume at this message boundary next time */
+            memmove(inbuf->buf, inbuf->buf + msgstart,
+                    inbuf->length - msgstart);
+            inbuf->length -= msgstart;
+            memset(d, 0, sizeof(*d));
+            if (!face->backlogged) {
+                face->backlogged = 1;
+                ccn_indexbuf_append_element(h->input_backlog, face->faceid);
+            }
+            return;
+        }
+        face->deficit -= size;
+        process_input_message(h, face, inbuf->buf + msgstart, size,
+                              (face->flags & CCN_FACE_LOCAL) != 0);
+        msgstart = d->index;
+        if (msgstart == inbuf->length) {
+            inbuf->length = 0;
+            face->deficit = 0;
+            face->backlogged = 0;
+            return;
+        }
+        ccn_skeleton_decode(d, inbuf->buf + msgstart, inbuf->length - msgstart);
+    }
+    face->deficit = 0;
+    face->backlogged = 0;
+    if (d->state < 0) {
+        ccnd_msg(h, "protocol error on face %u", face->faceid);
+        shutdown_client_fd(h, fd);
+        return;
+    }
+    if (msgstart < inbuf->length && msgstart > 0) {
+        /* move partial message to start of buffer */
+        memmove(inbuf->buf, inbuf->buf + msgstart, inbuf->length - msgstart);
+        inbuf->length -= msgstart;
+        d->index -= msgstart;
+    }
+    /*
+     * If after processing any complete messages the remaining message is
+     * larger than our limit we should boot this client
+     */
+    if (inbuf->length >= CCN_MAX_MESSAGE_BYTES) {
+        ccnd_msg(h, "protocol error on face %u", face->faceid);
+        shutdown_client_fd(h, fd);
+    }
+}
+
+/**
+ * Resume the faces that still have input buffered from earlier passes
+ *
+ * This also keeps track of how long we have been unable to keep up.
+ * A single backlogged face is just a busy client being held to its
+ * share, so it takes more than one, or a full datagram batch, to count.
+ */
+static void
+process_input_backlog(struct ccnd_handle *h)
+{
+    struct ccn_indexbuf *b = h->input_backlog;
+    struct face *face;
+    unsigned now;
+    unsigned elapsed;
+    int level;
+    int i, j;
+    
+    for (i = 0, j = 0; i < b->n; i++) {
+        face = face_from_faceid(h, b->buf[i]);
+        if (face == NULL || !face->backlogged)
+            continue;
+        if (face->input_pass != h->input_pass)
+            process_stream_input(h, face);
+        face = face_from_faceid(h, b->buf[i]);
+        if (face != NULL && face->backlogged)
+            b->buf[j++] = b->buf[i];
+    }
+    b->n = j;
+    if (b->n > 1 || h->input_busy) {
+        now = cq_usec(h);
+        if (!h->input_behind) {
+            h->input_behind = 1;
+            h->input_behind_since = now;
+        }
+        elapsed = now - h->input_behind_since;
+        level = 0;
+        if (elapsed >= 4 * h->overload_usec)
+            level = 2;
+        else if (elapsed >= h->overload_usec)
+            level = 1;
+        if (level > 0 && h->overload == 0)
+            ccnd_msg(h, "overloaded - shedding interests");
+        h->overload = level;
+    }
+    else
+        h->input_behind = h->overload = 0;
+    h->input_busy = 0;
+    h->input_pass++;
+}
+
 /**
  * Process the input from a socket.
  *
@@ -5191,7 +7855,6 @@ process_input(struct ccnd_handle *h, int fd)
     struct face *face = NULL;
     struct face *source = NULL;
     ssize_t res;
-    ssize_t msgstart;
     unsigned char *buf;
     struct ccn_skeleton_decoder *d;
     struct sockaddr_storage sstor;
@@ -5217,6 +7880,16 @@ process_input(struct ccnd_handle *h, int fd)
             return;
         }
     }
+    if ((face->flags & CCN_FACE_DGRAM) != 0) {
+        process_dgram_input(h, face);
+        return;
+    }
+    if (face->backlogged) {
+        /* Don't read more until what we have is used up */
+        if (face->input_pass != h->input_pass)
+            process_stream_input(h, face);
+        return;
+    }
     d = &face->decoder;
     if (face->inbuf == NULL)
         face->inbuf = ccn_charbuf_create();
@@ -5229,70 +7902,21 @@ process_input(struct ccnd_handle *h, int fd)
     if (res == -1)
         ccnd_msg(h, "recvfrom face %u :%s (errno = %d)",
                     face->faceid, strerror(errno), errno);
-    else if (res == 0 && (face->flags & CCN_FACE_DGRAM) == 0)
+    else if (res == 0)
         shutdown_client_fd(h, fd);
     else {
         source = get_dgram_source(h, face, addr, addrlen, (res == 1) ? 1 : 2);
         ccnd_meter_bump(h, source->meter[FM_BYTI], res);
         source->recvcount++;
         source->surplus = 0; // XXX - we don't actually use this, except for some obscure messages.
-        if (res <= 1 && (source->flags & CCN_FACE_DGRAM) != 0) {
-            // XXX - If the initial heartbeat gets missed, we don't realize the locality of the face.
-            if (h->debug & 128)
-                ccnd_msg(h, "%d-byte heartbeat on %d", (int)res, source->faceid);
-            return;
-        }
         face->inbuf->length += res;
-        msgstart = 0;
         if (((face->flags & CCN_FACE_UNDECIDED) != 0 &&
              face->inbuf->length >= 6 &&
              0 == memcmp(face->inbuf->buf, "GET ", 4))) {
             ccnd_stats_handle_http_connection(h, face);
             return;
         }
-        ccn_skeleton_decode(d, buf, res);
-        while (d->state == 0) {
-            process_input_message(h, source,
-                                  face->inbuf->buf + msgstart,
-                                  d->index - msgstart,
-                                  (face->flags & CCN_FACE_LOCAL) != 0);
-            msgstart = d->index;
-            if (msgstart == face->inbuf->length) {
-                face->inbuf->length = 0;
-                return;
-            }
-            ccn_skeleton_decode(d,
-                                face->inbuf->buf + msgstart,
-                                face->inbuf->length - msgstart);
-        }
-        if ((face->flags & CCN_FACE_DGRAM) != 0) {
-            ccnd_msg(h, "protocol error on face %u, discarding %u bytes",
-                source->faceid,
-                (unsigned)(face->inbuf->length - msgstart));
-            face->inbuf->length = 0;
-            /* XXX - should probably ignore this source for a while */
-            return;
-        }
-        else if (d->state < 0) {
-            ccnd_msg(h, "protocol error on face %u", source->faceid);
-            shutdown_client_fd(h, fd);
-            return;
-        }
-        if (msgstart < face->inbuf->length && msgstart > 0) {
-            /* move partial message to start of buffer */
-            memmove(face->inbuf->buf, face->inbuf->buf + msgstart,
-                face->inbuf->length - msgstart);
-            face->inbuf->length -= msgstart;
-            d->index -= msgstart;
-        }
-        /*
-         * If after processing any complete messages the remaining message is
-         * larger than our limit we should boot this client
-         */
-        if (face->inbuf->length >= CCN_MAX_MESSAGE_BYTES) {
-            ccnd_msg(h, "protocol error on face %u", source->faceid);
-            shutdown_client_fd(h, fd);
-        }
+        process_stream_input(h, face);
     }
 }
 
@@ -5359,8 +7983,8 @@ handle_send_error(struct ccnd_handle *h, int errnum, struct face *face,
     }
     else if (errnum == EPIPE) {
         face->flags |= CCN_FACE_NOSEND;
-        face->outbufindex = 0;
-        ccn_charbuf_destroy(&face->outbuf);
+        outq_destroy(h, &face->outq);
+        ccnd_face_events_changed(h, face);
     }
     else {
         ccnd_msg(h, "send to face %u failed: %s (errno = %d)",
@@ -5382,32 +8006,191 @@ handle_send_error(struct ccnd_handle *h, int errnum, struct face *face,
  * This is not as smart as it should be for situations where
  * CCND_LISTEN_ON has been specified.
  */
-static int
-sending_fd(struct ccnd_handle *h, struct face *face)
+static int
+sending_fd(struct ccnd_handle *h, struct face *face)
+{
+    struct face *out = NULL;
+    if (face->sendface == face->faceid)
+        return(face->recv_fd);
+    out = face_from_faceid(h, face->sendface);
+    if (out != NULL)
+        return(out->recv_fd);
+    face->sendface = CCN_NOFACEID;
+    if (face->addr != NULL) {
+        switch (face->addr->sa_family) {
+            case AF_INET:
+                face->sendface = h->ipv4_faceid;
+                break;
+            case AF_INET6:
+                face->sendface = h->ipv6_faceid;
+                break;
+            default:
+                break;
+        }
+    }
+    out = face_from_faceid(h, face->sendface);
+    if (out != NULL)
+        return(out->recv_fd);
+    return(-1);
+}
+
+/**
+ * Send a datagram to the face using the given socket.
+ *
+ * This takes care of setting SO_BROADCAST when it is needed, and
+ * remembering in the face flags whether it was.
+ * @returns the result of sendto().
+ */
+static ssize_t
+dgram_sendto(struct ccnd_handle *h, struct face *face, int fd,
+             const void *data, size_t size)
+{
+    ssize_t res;
+    int bcast = 0;
+    
+    if ((face->flags & CCN_FACE_BC) != 0) {
+        bcast = 1;
+        setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &bcast, sizeof(bcast));
+    }
+    res = sendto(fd, data, size, 0, face->addr, face->addrlen);
+    if (res == -1 && errno == EACCES &&
+        (face->flags & (CCN_FACE_BC | CCN_FACE_NBC)) == 0) {
+        bcast = 1;
+        setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &bcast, sizeof(bcast));
+        res = sendto(fd, data, size, 0, face->addr, face->addrlen);
+        if (res == -1)
+            face->flags |= CCN_FACE_NBC; /* did not work, do not try */
+        else
+            face->flags |= CCN_FACE_BC; /* remember for next time */
+    }
+    if (bcast != 0) {
+        bcast = 0;
+        setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &bcast, sizeof(bcast));
+    }
+    return(res);
+}
+
+#ifdef CCND_HAVE_MMSG
+/**
+ * Send the datagrams that have been queued on the socket owned by face.
+ *
+ * If the kernel refuses one of them, that one is retried by itself
+ * using dgram_sendto(), so the broadcast and error handling is the
+ * same as for an unbatched send.
+ */
+static void
+dgram_flush(struct ccnd_handle *h, struct face *owner)
+{
+    struct dgram_batch *b = owner->batch;
+    struct mmsghdr msg[CCND_DGRAM_BATCH];
+    struct iovec iov[CCND_DGRAM_BATCH];
+    struct face *face;
+    ssize_t res;
+    int i, k;
+    
+    if (b == NULL || b->nq == 0)
+        return;
+    memset(msg, 0, b->nq * sizeof(msg[0]));
+    for (i = 0; i < b->nq; i++) {
+        if (b->qpkt[i] != NULL)
+            iov[i].iov_base = b->qpkt[i]->buf + b->qstart[i];
+        else
+            iov[i].iov_base = b->qdata->buf + b->qstart[i];
+        iov[i].iov_len = b->qsize[i];
+        msg[i].msg_hdr.msg_name = &b->qaddr[i];
+        msg[i].msg_hdr.msg_namelen = b->qaddrlen[i];
+        msg[i].msg_hdr.msg_iov = &iov[i];
+        msg[i].msg_hdr.msg_iovlen = 1;
+    }
+    for (i = 0; i < b->nq;) {
+        res = sendmmsg(owner->recv_fd, msg + i, b->nq - i, 0);
+        if (res > 0) {
+            for (k = i; k < i + res; k++) {
+                face = face_from_faceid(h, b->qfaceid[k]);
+                if (face != NULL)
+                    ccnd_meter_bump(h, face->meter[FM_BYTO], msg[k].msg_len);
+            }
+            i += res;
+            continue;
+        }
+        face = face_from_faceid(h, b->qfaceid[i]);
+        if (face != NULL && face->addr != NULL) {
+            res = dgram_sendto(h, face, owner->recv_fd,
+                               iov[i].iov_base, iov[i].iov_len);
+            if (res > 0)
+                ccnd_meter_bump(h, face->meter[FM_BYTO], res);
+            else if (res == -1)
+                handle_send_error(h, errno, face,
+                                  iov[i].iov_base, iov[i].iov_len);
+        }
+        i++;
+    }
+    for (i = 0; i < b->nq; i++)
+        pktbuf_release(&b->qpkt[i]);
+    b->nq = 0;
+    b->qdata->length = 0;
+}
+
+/**
+ * Queue a datagram to be sent on the socket fd at the end of this pass.
+ *
+ * If pkt is not NULL, the data lies within it and is not copied.
+ * @returns 0 if queued, or -1 if the caller should send it directly.
+ */
+static int
+dgram_enqueue(struct ccnd_handle *h, struct face *face, int fd,
+              struct ccnd_pktbuf *pkt, const void *data, size_t size)
+{
+    struct dgram_batch *b;
+    struct face *owner;
+    int i;
+    
+    if (fd == -1 || face->addr == NULL)
+        return(-1);
+    owner = hashtb_lookup(h->faces_by_fd, &fd, sizeof(fd));
+    if (owner == NULL || face->addrlen > sizeof(b->qaddr[0]))
+        return(-1);
+    b = dgram_batch_obtain(h, owner);
+    if (b == NULL)
+        return(-1);
+    if (b->nq == CCND_DGRAM_BATCH)
+        dgram_flush(h, owner);
+    if (b->nq == 0)
+        ccn_indexbuf_append_element(h->dgram_flush, owner->faceid);
+    i = b->nq++;
+    if (pkt != NULL) {
+        b->qpkt[i] = pktbuf_ref(pkt);
+        b->qstart[i] = (const unsigned char *)data - pkt->buf;
+    }
+    else {
+        b->qstart[i] = b->qdata->length;
+        ccn_charbuf_append(b->qdata, data, size);
+    }
+    b->qsize[i] = size;
+    b->qfaceid[i] = face->faceid;
+    b->qaddrlen[i] = face->addrlen;
+    memcpy(&b->qaddr[i], face->addr, face->addrlen);
+    return(0);
+}
+#endif
+
+/**
+ * Send any datagrams that have been queued during this pass.
+ */
+static void
+ccnd_flush_dgrams(struct ccnd_handle *h)
 {
-    struct face *out = NULL;
-    if (face->sendface == face->faceid)
-        return(face->recv_fd);
-    out = face_from_faceid(h, face->sendface);
-    if (out != NULL)
-        return(out->recv_fd);
-    face->sendface = CCN_NOFACEID;
-    if (face->addr != NULL) {
-        switch (face->addr->sa_family) {
-            case AF_INET:
-                face->sendface = h->ipv4_faceid;
-                break;
-            case AF_INET6:
-                face->sendface = h->ipv6_faceid;
-                break;
-            default:
-                break;
-        }
+#ifdef CCND_HAVE_MMSG
+    struct face *owner;
+    int i;
+    
+    for (i = 0; i < h->dgram_flush->n; i++) {
+        owner = face_from_faceid(h, h->dgram_flush->buf[i]);
+        if (owner != NULL)
+            dgram_flush(h, owner);
     }
-    out = face_from_faceid(h, face->sendface);
-    if (out != NULL)
-        return(out->recv_fd);
-    return(-1);
+    h->dgram_flush->n = 0;
+#endif
 }
 
 /**
@@ -5420,71 +8203,157 @@ ccnd_send(struct ccnd_handle *h,
           struct face *face,
           const void *data, size_t size)
 {
+    ccnd_send_pkt(h, face, NULL, data, size);
+}
+
+/**
+ * Send data to the face, where the data may be held in a packet buffer.
+ *
+ * If pkt is not NULL, the data lies within it, and a reference may be
+ * kept in place of a copy if the send is deferred.
+ */
+static void
+ccnd_send_pkt(struct ccnd_handle *h, struct face *face,
+              struct ccnd_pktbuf *pkt, const void *data, size_t size)
+{
+    struct iovec iov;
+    
+    iov.iov_base = (void *)data;
+    iov.iov_len = size;
+    ccnd_send_iov(h, face, pkt, &iov, 1);
+}
+
+/**
+ * Send a message, given in one or more pieces, to the face.
+ *
+ * Stream faces take the pieces with a single writev(); whatever the
+ * socket does not accept goes onto the output queue of the face.  Other
+ * faces need the message in one piece, so multiple pieces are copied.
+ *
+ * If pkt is not NULL, the first piece lies within it, and a reference may
+ * be kept in place of a copy if the send is deferred.
+ */
+static void
+ccnd_send_iov(struct ccnd_handle *h, struct face *face,
+              struct ccnd_pktbuf *pkt, const struct iovec *iov, int iovcnt)
+{
+    struct ccn_charbuf *c = NULL;
+    struct iovec one;
     ssize_t res;
+    size_t size = 0;
     int fd;
-    int bcast = 0;
+    int i;
     
     if ((face->flags & CCN_FACE_NOSEND) != 0)
         return;
     face->surplus++;
-    if (face->outbuf != NULL) {
-        ccn_charbuf_append(face->outbuf, data, size);
+    for (i = 0; i < iovcnt; i++)
+        size += iov[i].iov_len;
+    if (face->outq != NULL) {
+        if (face->outq->bytes + size > CCND_OUTQ_LIMIT) {
+            if (h->debug & 8)
+                ccnd_msg(h, "output_dropped %u bytes=%jd queued=%jd",
+                         face->faceid, (intmax_t)size,
+                         (intmax_t)face->outq->bytes);
+            return;
+        }
+        if (outq_append(h, face->outq, pkt, iov, iovcnt, 0) < 0)
+            goto NoMemory;
         return;
     }
+    if (iovcnt > 1 && (face == h->face0 || (face->flags & CCN_FACE_DGRAM) != 0)) {
+        c = charbuf_obtain(h);
+        for (i = 0; i < iovcnt; i++)
+            ccn_charbuf_append(c, iov[i].iov_base, iov[i].iov_len);
+        one.iov_base = c->buf;
+        one.iov_len = c->length;
+        iov = &one;
+        iovcnt = 1;
+        pkt = NULL;
+    }
     if (face == h->face0) {
         ccnd_meter_bump(h, face->meter[FM_BYTO], size);
-        ccn_dispatch_message(h->internal_client, (void *)data, size);
+        ccn_dispatch_message(h->internal_client, iov[0].iov_base, size);
         ccnd_internal_client_has_somthing_to_say(h);
-        return;
+        goto Finish;
     }
     if ((face->flags & CCN_FACE_DGRAM) == 0)
-        res = send(face->recv_fd, data, size, 0);
+        res = writev(face->recv_fd, iov, iovcnt);
     else {
+        if (face->arq != NULL && face->arq->pending)
+            link_rtx_save(h, face, iov[0].iov_base, size);
         fd = sending_fd(h, face);
-        if ((face->flags & CCN_FACE_BC) != 0) {
-            bcast = 1;
-            setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &bcast, sizeof(bcast));
-        }
-        res = sendto(fd, data, size, 0, face->addr, face->addrlen);
-        if (res == -1 && errno == EACCES &&
-            (face->flags & (CCN_FACE_BC | CCN_FACE_NBC)) == 0) {
-            bcast = 1;
-            setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &bcast, sizeof(bcast));
-            res = sendto(fd, data, size, 0, face->addr, face->addrlen);
-            if (res == -1)
-                face->flags |= CCN_FACE_NBC; /* did not work, do not try */
-            else
-                face->flags |= CCN_FACE_BC; /* remember for next time */
-        }
-        if (bcast != 0) {
-            bcast = 0;
-            setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &bcast, sizeof(bcast));
-        }
+#ifdef CCND_HAVE_MMSG
+        if ((face->flags & CCN_FACE_BC) == 0 &&
+            dgram_enqueue(h, face, fd, pkt, iov[0].iov_base, size) == 0)
+            goto Finish;
+#endif
+        res = dgram_sendto(h, face, fd, iov[0].iov_base, size);
     }
     if (res > 0)
         ccnd_meter_bump(h, face->meter[FM_BYTO], res);
     if (res == size)
-        return;
+        goto Finish;
     if (res == -1) {
-        res = handle_send_error(h, errno, face, data, size);
+        res = handle_send_error(h, errno, face, iov[0].iov_base, size);
         if (res == -1)
-            return;
+            goto Finish;
     }
     if ((face->flags & CCN_FACE_DGRAM) != 0) {
         ccnd_msg(h, "sendto short");
-        return;
+        goto Finish;
     }
     if (h->debug & 8)
         ccnd_msg(h, "output_blocked %u residual=%jd",
                  face->faceid, (intmax_t)(size - res));
-    face->outbufindex = 0;
-    face->outbuf = ccn_charbuf_create();
-    if (face->outbuf == NULL) {
-        ccnd_msg(h, "do_write: %s", strerror(errno));
+    face->outq = outq_create(h);
+    if (face->outq == NULL ||
+        outq_append(h, face->outq, pkt, iov, iovcnt, res) < 0)
+        goto NoMemory;
+    ccnd_face_events_changed(h, face);
+    goto Finish;
+NoMemory:
+    /* A stream with a gap in it can not be resynchronized */
+    ccnd_msg(h, "do_write: %s", strerror(ENOMEM));
+    face->flags |= CCN_FACE_NOSEND;
+    outq_destroy(h, &face->outq);
+    ccnd_face_events_changed(h, face);
+Finish:
+    if (c != NULL)
+        charbuf_release(h, c);
+}
+
+/**
+ * Measure how fast a backlogged stream face drains
+ *
+ * While the output queue is non-empty the socket is the bottleneck, so
+ * the bytes it takes over a span of at least CCND_PACE_SAMPLE_MICROSEC
+ * (or until the queue empties) give the rate of the link.  The result is
+ * smoothed into face->pace_nsec, in nanoseconds per KByte, and is used to
+ * pace content on point-to-point faces.
+ */
+static void
+outq_pace_sample(struct ccnd_handle *h, struct face *face, size_t bytes)
+{
+    struct ccnd_outq *q = face->outq;
+    unsigned now = cq_usec(h);
+    unsigned elapsed = now - q->since;
+    unsigned sample;
+    
+    q->drained += bytes;
+    if (elapsed < CCND_PACE_SAMPLE_MICROSEC && q->bytes > 0)
         return;
+    if (q->drained >= 1024 && elapsed > 0) {
+        sample = (unsigned long long)elapsed * 1000 * 1024 / q->drained;
+        if (sample > 100000000)
+            sample = 100000000; /* 10 KBytes per second */
+        if (face->pace_nsec == 0)
+            face->pace_nsec = sample;
+        else
+            face->pace_nsec += ((int)sample - (int)face->pace_nsec) / 4;
     }
-    ccn_charbuf_append(face->outbuf,
-                       ((const unsigned char *)data) + res, size - res);
+    q->drained = 0;
+    q->since = now;
 }
 
 /**
@@ -5500,46 +8369,112 @@ do_deferred_write(struct ccnd_handle *h, int fd)
     struct face *face = hashtb_lookup(h->faces_by_fd, &fd, sizeof(fd));
     if (face == NULL)
         return;
-    if (face->outbuf != NULL) {
-        ssize_t sendlen = face->outbuf->length - face->outbufindex;
-        if (sendlen > 0) {
-            res = send(fd, face->outbuf->buf + face->outbufindex, sendlen, 0);
+    if (face->outq != NULL) {
+        if (face->outq->bytes > 0) {
+            if ((face->flags & CCN_FACE_CONNECTING) != 0) {
+                /* Connected, with output queued up in the meantime */
+                face->flags &= ~CCN_FACE_CONNECTING;
+                face->outq->unpaced = 1;
+                ccnd_face_status_change(h, face->faceid);
+            }
+            res = outq_write(h, face->outq, fd);
             if (res == -1) {
                 if (errno == EPIPE) {
                     face->flags |= CCN_FACE_NOSEND;
-                    face->outbufindex = 0;
-                    ccn_charbuf_destroy(&face->outbuf);
+                    outq_destroy(h, &face->outq);
+                    ccnd_face_events_changed(h, face);
                     return;
                 }
                 ccnd_msg(h, "send: %s (errno = %d)", strerror(errno), errno);
                 shutdown_client_fd(h, fd);
                 return;
             }
+            if (!face->outq->unpaced)
+                outq_pace_sample(h, face, res);
             if (h->debug & 8)
                ccnd_msg(h, "deferred_send %u bytes=%jd", face->faceid, (intmax_t)res);
-            if (res == sendlen) {
-                face->outbufindex = 0;
-                ccn_charbuf_destroy(&face->outbuf);
+            if (face->outq->bytes == 0) {
+                outq_destroy(h, &face->outq);
                 if ((face->flags & CCN_FACE_CLOSING) != 0)
                     shutdown_client_fd(h, fd);
-                return;
+                else
+                    ccnd_face_events_changed(h, face);
             }
-            face->outbufindex += res;
             return;
         }
-        face->outbufindex = 0;
-        ccn_charbuf_destroy(&face->outbuf);
+        outq_destroy(h, &face->outq);
     }
     if ((face->flags & CCN_FACE_CLOSING) != 0)
         shutdown_client_fd(h, fd);
     else if ((face->flags & CCN_FACE_CONNECTING) != 0) {
         face->flags &= ~CCN_FACE_CONNECTING;
+        ccnd_face_events_changed(h, face);
         ccnd_face_status_change(h, face->faceid);
     }
     else
         ccnd_msg(h, "ccnd:do_deferred_write: something fishy on %d", fd);
 }
 
+/**
+ * Compute the poll events that are wanted for the socket of a face.
+ */
+static short
+face_poll_events(struct face *face)
+{
+    short events = 0;
+    
+    if ((face->flags & CCN_FACE_NORECV) == 0)
+        events |= POLLIN;
+    if (face->outq != NULL || (face->flags & CCN_FACE_CLOSING) != 0)
+        events |= POLLOUT;
+    return(events);
+}
+
+/**
+ * Note that the set of events wanted for a face's socket may have changed.
+ *
+ * This should be called whenever the output queue of a face appears or goes
+ * away, or the face is marked as closing.  With the poll backend the
+ * events are recomputed on every pass, so there is nothing to do.  With
+ * epoll, the kernel registration is adjusted only when the wanted set
+ * actually differs from what is already registered.
+ *
+ * Datagram faces that share a socket with a listener are not in the
+ * faces_by_fd table, and do not own their socket, so they are ignored.
+ */
+void
+ccnd_face_events_changed(struct ccnd_handle *h, struct face *face)
+{
+#ifdef CCND_HAVE_EPOLL
+    struct epoll_event ev = {0};
+    short events;
+    int op;
+    int res;
+    
+    if (h->epfd == -1 || face->recv_fd == -1)
+        return;
+    if (hashtb_lookup(h->faces_by_fd, &face->recv_fd,
+                      sizeof(face->recv_fd)) != face)
+        return;
+    events = face_poll_events(face);
+    if (events == face->pollevents)
+        return;
+    op = (face->pollevents == -1) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+    ev.events = ((events & POLLIN) ? EPOLLIN : 0) |
+                ((events & POLLOUT) ? EPOLLOUT : 0);
+    ev.data.fd = face->recv_fd;
+    res = epoll_ctl(h->epfd, op, face->recv_fd, &ev);
+    if (res == -1) {
+        ccnd_msg(h, "epoll_ctl: %s (errno = %d)", strerror(errno), errno);
+        return;
+    }
+    if (h->debug & 8)
+        ccnd_msg(h, "epoll_ctl %u fd=%d events=0x%x",
+                 face->faceid, face->recv_fd, (unsigned)events);
+    face->pollevents = events;
+#endif
+}
+
 /**
  * Set up the array of fd descriptors for the poll(2) call.
  *
@@ -5566,63 +8501,401 @@ prepare_poll_fds(struct ccnd_handle *h)
         else
             j = --k;
         h->fds[j].fd = face->recv_fd;
-        h->fds[j].events = ((face->flags & CCN_FACE_NORECV) == 0) ? POLLIN : 0;
-        if ((face->outbuf != NULL || (face->flags & CCN_FACE_CLOSING) != 0))
-            h->fds[j].events |= POLLOUT;
+        h->fds[j].events = face_poll_events(face);
     }
     hashtb_end(e);
     if (i < k)
         abort();
 }
 
+/**
+ * Dispatch on the readiness of one socket.
+ */
+static void
+process_ready_fd(struct ccnd_handle *h, int fd, int revents)
+{
+    if (revents & (POLLERR | POLLNVAL | POLLHUP)) {
+        if (revents & (POLLIN))
+            process_input(h, fd);
+        else
+            shutdown_client_fd(h, fd);
+        return;
+    }
+    if (revents & (POLLOUT))
+        do_deferred_write(h, fd);
+    else if (revents & (POLLIN))
+        process_input(h, fd);
+}
+
+/**
+ * Wait for socket readiness using poll(2), and dispatch.
+ *
+ * Every registered socket is visited on every pass.
+ * @returns the poll result.
+ */
+static int
+ccnd_poll_once(struct ccnd_handle *h, int timeout_ms)
+{
+    struct ccn_timeval dummy;
+    int i;
+    int res;
+    int n;
+    
+    prepare_poll_fds(h);
+    if (0) ccnd_msg(h, "at ccnd.c:%d poll(h->fds, %d, %d)", __LINE__, h->nfds, timeout_ms);
+    res = poll(h->fds, h->nfds, timeout_ms);
+    if (res <= 0)
+        return(res);
+    /* we need a fresh current time for setting interest expiries */
+    h->ticktock.gettime(&h->ticktock, &dummy);
+    for (i = 0, n = res; n > 0 && i < h->nfds; i++) {
+        if (h->fds[i].revents != 0) {
+            n--;
+            process_ready_fd(h, h->fds[i].fd, h->fds[i].revents);
+        }
+    }
+    return(res);
+}
+
+#ifdef CCND_HAVE_EPOLL
+/**
+ * Wait for socket readiness using epoll, and dispatch.
+ *
+ * Only the sockets that are actually ready are visited.  As with the
+ * poll backend, multicast receivers are handled first.
+ * @returns the epoll_wait result.
+ */
+static int
+ccnd_epoll_once(struct ccnd_handle *h, int timeout_ms)
+{
+    struct ccn_timeval dummy;
+    struct epoll_event tmp;
+    struct face *face;
+    int i, k;
+    int res;
+    int revents;
+    
+    if (h->nevents < hashtb_n(h->faces_by_fd) || h->events == NULL) {
+        h->nevents = hashtb_n(h->faces_by_fd) + 8;
+        h->events = realloc(h->events, h->nevents * sizeof(h->events[0]));
+        if (h->events == NULL)
+            abort();
+    }
+    res = epoll_wait(h->epfd, h->events, h->nevents, timeout_ms);
+    if (res <= 0)
+        return(res);
+    /* we need a fresh current time for setting interest expiries */
+    h->ticktock.gettime(&h->ticktock, &dummy);
+    for (i = 0, k = 0; i < res; i++) {
+        face = hashtb_lookup(h->faces_by_fd, &h->events[i].data.fd,
+                             sizeof(h->events[i].data.fd));
+        if (face != NULL && (face->flags & CCN_FACE_MCAST) != 0) {
+            tmp = h->events[k];
+            h->events[k++] = h->events[i];
+            h->events[i] = tmp;
+        }
+    }
+    for (i = 0; i < res; i++) {
+        revents = 0;
+        if (h->events[i].events & EPOLLIN)  revents |= POLLIN;
+        if (h->events[i].events & EPOLLOUT) revents |= POLLOUT;
+        if (h->events[i].events & EPOLLERR) revents |= POLLERR;
+        if (h->events[i].events & EPOLLHUP) revents |= POLLHUP;
+        process_ready_fd(h, h->events[i].data.fd, revents);
+    }
+    return(res);
+}
+#endif
+
+/**
+ * Header of a content store snapshot file
+ *
+ * The records follow, in name order.  Each is a cs_snapshot_rec, then
+ * the ccnb, then the flatname key.  The file is written and read on the
+ * same host, so native byte order is used, and checked.
+ */
+struct cs_snapshot_hdr {
+    char magic[8];                  /**< CS_SNAPSHOT_MAGIC */
+    uint32_t order;                 /**< CS_SNAPSHOT_ORDER */
+    uint32_t count;                 /**< number of records */
+};
+
+struct cs_snapshot_rec {
+    uint32_t size;                  /**< size of ccnb */
+    uint32_t keysize;               /**< size of key */
+    int64_t staleat;                /**< wall-clock seconds */
+};
+
+#define CS_SNAPSHOT_MAGIC "CCNDCS1\n"
+#define CS_SNAPSHOT_ORDER 0x01020304
+
+/**
+ * Set by the CCND_SNAPSHOT_SIGNAL handler; checked in ccnd_run()
+ */
+static volatile sig_atomic_t snapshot_requested = 0;
+
+static void
+handle_snapshot_signal(int sig)
+{
+    snapshot_requested = 1;
+}
+
+/**
+ * Write the fresh content in the store to the snapshot file
+ *
+ * The snapshot is written to a temporary file that is then renamed, so
+ * a partial snapshot is never left in place.
+ * @returns the number of objects written, or -1 for error.
+ */
+static int
+cs_snapshot_save(struct ccnd_handle *h)
+{
+    struct cs_snapshot_hdr hdr = {{0}};
+    struct cs_snapshot_rec rec;
+    struct content_entry *content;
+    struct ccn_charbuf *tmp = NULL;
+    struct ccny *y;
+    FILE *fp;
+    unsigned n = 0;
+    int res = -1;
+    
+    if (h->cs_snapshot == NULL || h->content_tree == NULL)
+        return(-1);
+    tmp = ccn_charbuf_create();
+    ccn_charbuf_putf(tmp, "%s.%d", h->cs_snapshot, (int)getpid());
+    fp = fopen(ccn_charbuf_as_string(tmp), "w");
+    if (fp == NULL)
+        goto Bail;
+    memcpy(hdr.magic, CS_SNAPSHOT_MAGIC, sizeof(hdr.magic));
+    hdr.order = CS_SNAPSHOT_ORDER;
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    for (y = ccn_nametree_first(h->content_tree); y != NULL; y = ccny_next(y)) {
+        content = ccny_payload(y);
+        if (is_stale(h, content))
+            continue;
+        rec.size = content->size;
+        rec.keysize = ccny_keylen(y);
+        rec.staleat = (int64_t)h->starttime + content->staletime;
+        fwrite(&rec, sizeof(rec), 1, fp);
+        fwrite(content->ccnb, 1, content->size, fp);
+        fwrite(ccny_key(y), 1, ccny_keylen(y), fp);
+        n++;
+    }
+    hdr.count = n;
+    if (fseek(fp, 0, SEEK_SET) == 0)
+        fwrite(&hdr, sizeof(hdr), 1, fp);
+    if (ferror(fp) != 0) {
+        fclose(fp);
+        goto Bail;
+    }
+    if (fclose(fp) != 0)
+        goto Bail;
+    if (rename(ccn_charbuf_as_string(tmp), h->cs_snapshot) == -1)
+        goto Bail;
+    ccnd_msg(h, "content store snapshot: %u objects saved to %s",
+             n, h->cs_snapshot);
+    res = n;
+Bail:
+    if (res < 0) {
+        ccnd_msg(h, "content store snapshot %s: %s",
+                 ccn_charbuf_as_string(tmp), strerror(errno));
+        unlink(ccn_charbuf_as_string(tmp));
+    }
+    ccn_charbuf_destroy(&tmp);
+    return(res);
+}
+
+/**
+ * Check a content store snapshot record
+ *
+ * The ContentObject must parse, and the key must be the flatname,
+ * including the implicit digest, that it would get coming off the wire.
+ * @returns 1 if the record is good, 0 if not.
+ */
+static int
+cs_snapshot_rec_ok(struct ccnd_handle *h,
+                   const unsigned char *msg, size_t size,
+                   const unsigned char *key, size_t keysize)
+{
+    struct ccn_parsed_ContentObject obj = {0};
+    struct ccn_charbuf *f = NULL;
+    int ok = 0;
+    
+    if (ccn_parse_ContentObject(msg, size, &obj, NULL) < 0)
+        return(0);
+    ccn_digest_ContentObject(msg, &obj);
+    if (obj.digest_bytes != 32)
+        return(0);
+    f = charbuf_obtain(h);
+    if (ccn_flatname_append_from_ccnb(f, msg, size, 0, -1) >= 0 &&
+        ccn_flatname_append_component(f, obj.digest, obj.digest_bytes) >= 0)
+        ok = (f->length == keysize && memcmp(f->buf, key, keysize) == 0);
+    charbuf_release(h, f);
+    return(ok);
+}
+
+/**
+ * Load the content store from the snapshot file, if there is one
+ *
+ * This is done at startup, while the store is still empty.  Since the
+ * snapshot is in name order, the entries are enrolled in bulk with
+ * ccn_nametree_append().  Content that has gone stale since the snapshot
+ * was taken is skipped, as is anything beyond the capacity limits.
+ * Each record is parsed and its digest checked, as for content arriving
+ * from a face; a record that fails is skipped.
+ * @returns the number of objects loaded, or -1 for error.
+ */
+static int
+cs_snapshot_load(struct ccnd_handle *h)
+{
+    struct cs_snapshot_hdr hdr;
+    struct cs_snapshot_rec rec;
+    struct content_entry *content;
+    struct ccnd_pktbuf *pkt;
+    struct ccny **v = NULL;
+    struct ccny *y;
+    struct stat st;
+    const unsigned char *base = MAP_FAILED;
+    const unsigned char *rp;
+    size_t pos;
+    unsigned long long bytes = 0;
+    int now;
+    int nv = 0;
+    int n = 0;
+    int bad = 0;
+    int i;
+    int fd;
+    
+    fd = open(h->cs_snapshot, O_RDONLY);
+    if (fd == -1) {
+        if (errno != ENOENT)
+            ccnd_msg(h, "content store snapshot %s: %s",
+                     h->cs_snapshot, strerror(errno));
+        return(-1);
+    }
+    if (fstat(fd, &st) == -1 || st.st_size < sizeof(hdr))
+        goto Bail;
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED)
+        goto Bail;
+    memcpy(&hdr, base, sizeof(hdr));
+    if (memcmp(hdr.magic, CS_SNAPSHOT_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.order != CS_SNAPSHOT_ORDER) {
+        ccnd_msg(h, "content store snapshot %s: not recognized",
+                 h->cs_snapshot);
+        goto Bail;
+    }
+    if (hdr.count > h->capacity)
+        hdr.count = h->capacity;
+    v = calloc(hdr.count + 1, sizeof(v[0]));
+    if (v == NULL)
+        goto Bail;
+    now = h->sec - h->starttime;
+    for (pos = sizeof(hdr); nv < hdr.count && pos + sizeof(rec) <= st.st_size;) {
+        memcpy(&rec, base + pos, sizeof(rec));
+        pos += sizeof(rec);
+        if (rec.size > st.st_size - pos ||
+            rec.keysize > st.st_size - pos - rec.size)
+            break;
+        pos += rec.size + rec.keysize;
+        if (rec.staleat - h->starttime <= now ||
+            rec.staleat - h->starttime > INT_MAX)
+            continue;
+        rp = base + pos - rec.size - rec.keysize;
+        if (!cs_snapshot_rec_ok(h, rp, rec.size, rp + rec.size, rec.keysize)) {
+            bad++;
+            continue;
+        }
+        pkt = pktbuf_create(rec.size + rec.keysize);
+        y = ccny_create_in(h->content_tree, nrand48(h->seed), sizeof(*content));
+        if (pkt == NULL || y == NULL) {
+            pktbuf_release(&pkt);
+            ccny_destroy(h->content_tree, &y);
+            break;
+        }
+        memcpy(pkt->buf, rp, rec.size + rec.keysize);
+        ccny_set_key_fields(y, pkt->buf + rec.size, rec.keysize);
+        content = ccny_payload(y);
+        content->pkt = pkt;
+        content->ccnb = pkt->buf;
+        content->size = rec.size;
+        content->staletime = rec.staleat - h->starttime;
+        bytes += content_charge(y, content);
+        v[nv++] = y;
+        if (h->cs_bytes + bytes > h->cap_bytes)
+            break;
+    }
+    while (h->content_tree->limit < nv)
+        if (ccn_nametree_grow(h->content_tree) < 0)
+            break;
+    n = ccn_nametree_append(h->content_tree, v, nv);
+    for (i = 0; i < n; i++) {
+        content = ccny_payload(v[i]);
+        content->accession = ccny_cookie(v[i]);
+        content->arrival_faceid = CCN_NOFACEID;
+        content->ncomps = ccn_flatname_ncomps(ccny_key(v[i]),
+                                              ccny_keylen(v[i]));
+        h->cs_bytes += content_charge(v[i], content);
+        content_enqueuex(h, content);
+        h->accessioned++;
+        ccnd_cs_insert(h, content);
+        content_name_index_add(h, v[i]);
+    }
+    if (h->cs_bytes > h->cs_bytes_peak)
+        h->cs_bytes_peak = h->cs_bytes;
+    for (i = n; i < nv; i++)
+        ccny_destroy(h->content_tree, &v[i]);
+    ccnd_msg(h, "content store snapshot: %d of %u objects loaded from %s",
+             n, hdr.count, h->cs_snapshot);
+    if (bad > 0)
+        ccnd_msg(h, "content store snapshot: %d bad records skipped", bad);
+Bail:
+    free(v);
+    if (base != MAP_FAILED)
+        munmap((void *)base, st.st_size);
+    close(fd);
+    return(n);
+}
+
 /**
  * Run the main loop of the ccnd
  */
 void
 ccnd_run(struct ccnd_handle *h)
 {
-    int i;
     int res;
     int timeout_ms = -1;
     int prev_timeout_ms = -1;
     int usec;
     for (h->running = 1; h->running;) {
+        if (snapshot_requested) {
+            snapshot_requested = 0;
+            cs_snapshot_save(h);
+        }
         process_internal_client_buffer(h);
         usec = ccn_schedule_run(h->sched);
         timeout_ms = (usec < 0) ? -1 : ((usec + 960) / 1000);
         if (timeout_ms == 0 && prev_timeout_ms == 0)
             timeout_ms = 1;
+        if (h->input_backlog->n > 0)
+            timeout_ms = 0;
         process_internal_client_buffer(h);
-        prepare_poll_fds(h);
-        if (0) ccnd_msg(h, "at ccnd.c:%d poll(h->fds, %d, %d)", __LINE__, h->nfds, timeout_ms);
-        res = poll(h->fds, h->nfds, timeout_ms);
+        ccnd_flush_dgrams(h);
+#ifdef CCND_HAVE_EPOLL
+        if (h->epfd != -1)
+            res = ccnd_epoll_once(h, timeout_ms);
+        else
+#endif
+            res = ccnd_poll_once(h, timeout_ms);
         prev_timeout_ms = ((res == 0) ? timeout_ms : 1);
+        process_input_backlog(h);
         if (-1 == res) {
+            if (errno == EINTR)
+                continue;
             ccnd_msg(h, "poll: %s (errno = %d)", strerror(errno), errno);
             sleep(1);
             continue;
         }
-        if (res > 0) {
-            /* we need a fresh current time for setting interest expiries */
-            struct ccn_timeval dummy;
-            h->ticktock.gettime(&h->ticktock, &dummy);
-        }
-        for (i = 0; res > 0 && i < h->nfds; i++) {
-            if (h->fds[i].revents != 0) {
-                res--;
-                if (h->fds[i].revents & (POLLERR | POLLNVAL | POLLHUP)) {
-                    if (h->fds[i].revents & (POLLIN))
-                        process_input(h, h->fds[i].fd);
-                    else
-                        shutdown_client_fd(h, h->fds[i].fd);
-                    continue;
-                }
-                if (h->fds[i].revents & (POLLOUT))
-                    do_deferred_write(h, h->fds[i].fd);
-                else if (h->fds[i].revents & (POLLIN))
-                    process_input(h, h->fds[i].fd);
-            }
-        }
     }
 }
 
@@ -6001,8 +9274,18 @@ ccnd_create(const char *progname, ccnd_logger logger, void *loggerdata)
     const char *portstr;
     const char *debugstr;
     const char *entrylimit;
+    const char *bytelimit;
+    const char *cspolicy;
+    const char *csadmit;
+    const char *cstier;
+    const char *cstierbytes;
+    unsigned long long tierbytes;
     const char *mtu;
     const char *data_pause;
+    const char *pack;
+    const char *link_ack;
+    const char *aqm_target;
+    const char *overload;
     const char *tts_default;
     const char *tts_limit;
     const char *predicted_response_limit;
@@ -6029,20 +9312,33 @@ ccnd_create(const char *progname, ccnd_logger logger, void *loggerdata)
     param.finalize = &finalize_face;
     h->faces_by_fd = hashtb_create(sizeof(struct face), &param);
     h->dgram_faces = hashtb_create(sizeof(struct face), &param);
-    param.finalize = &finalize_nonce;
-    h->nonce_tab = hashtb_create(sizeof(struct nonce_entry), &param);
-    h->ncehead.next = h->ncehead.prev = &h->ncehead;
+    ccnd_slab_init(h);
     param.finalize = 0;
     h->faceid_by_guid = hashtb_create(sizeof(unsigned), &param);
     param.finalize = &finalize_nameprefix;
     h->nameprefix_tab = hashtb_create(sizeof(struct nameprefix_entry), &param);
+    h->nameprefix_index = ccnd_lpm_create();
+    param.node_alloc = &ccnd_hashtb_alloc;
+    param.node_free = &ccnd_hashtb_free;
     param.finalize = &finalize_interest;
     h->interest_tab = hashtb_create(sizeof(struct interest_entry), &param);
+    param.node_alloc = 0;
+    param.node_free = 0;
     param.finalize = &finalize_guest;
     h->guest_tab = hashtb_create(sizeof(struct guest_entry), &param);
     param.finalize = 0;
     h->faceattr_index_tab = hashtb_create(sizeof(struct faceattr_index_entry),
                                           &param);
+    h->dgram_flush = ccn_indexbuf_create();
+    h->input_backlog = ccn_indexbuf_create();
+    h->epfd = -1;
+#ifdef CCND_HAVE_EPOLL
+    h->epfd = epoll_create(64);
+    if (h->epfd == -1)
+        ccnd_msg(h, "epoll_create: %s - using poll", strerror(errno));
+    else
+        fcntl(h->epfd, F_SETFD, FD_CLOEXEC);
+#endif
     h->headx = calloc(1, sizeof(*h->headx));
     h->headx->staletime = -1;
     h->headx->nextx = h->headx->prevx = h->headx;
@@ -6076,12 +9372,48 @@ ccnd_create(const char *progname, ccnd_logger logger, void *loggerdata)
     if (entrylimit != NULL && entrylimit[0] != 0)
         h->capacity = strtoul(entrylimit, NULL, 10);
     ccnd_msg(h, "CCND_DEBUG=%d CCND_CAP=%lu", h->debug, h->capacity);
+    bytelimit = getenv("CCND_CAP_BYTES");
+    h->cap_bytes = ~0ULL;
+    if (bytelimit != NULL && bytelimit[0] != 0) {
+        h->cap_bytes = strtoull(bytelimit, NULL, 10);
+        ccnd_msg(h, "CCND_CAP_BYTES=%llu", h->cap_bytes);
+    }
+    cspolicy = getenv("CCND_CS_POLICY");
+    csadmit = getenv("CCND_CS_ADMIT");
+    if (ccnd_cs_policy_init(h, cspolicy, csadmit) < 0)
+        ccnd_msg(h, "CCND_CS_POLICY=%s CCND_CS_ADMIT=%s not understood",
+                 cspolicy ? cspolicy : "", csadmit ? csadmit : "");
+    if (h->cs_policy != NULL)
+        ccnd_msg(h, "content store policy %s%s", ccnd_cs_policy_name(h),
+                 h->cs_admit != NULL ? " with tinylfu admission" : "");
+    cstier = getenv("CCND_CS_TIER");
+    if (cstier != NULL && cstier[0] != 0) {
+        cstierbytes = getenv("CCND_CS_TIER_BYTES");
+        tierbytes = CCND_CS_TIER_BYTES;
+        if (cstierbytes != NULL && cstierbytes[0] != 0)
+            tierbytes = strtoull(cstierbytes, NULL, 10);
+        if (ccnd_cs_tier_init(h, cstier, tierbytes) < 0)
+            ccnd_msg(h, "CCND_CS_TIER=%s not usable", cstier);
+        else
+            ccnd_msg(h, "CCND_CS_TIER=%s CCND_CS_TIER_BYTES=%llu", cstier,
+                     ccnd_cs_tier_size(h));
+    }
     cap = 100000; /* Don't try to allocate an insanely high number */
     cap = h->capacity < cap ? h->capacity : cap;
     h->content_tree = ccn_nametree_create(cap);
+    h->content_by_name = hashtb_create(sizeof(struct content_name_entry), NULL);
     h->content_tree->data = h;
     h->content_tree->pre_remove = &content_preremove;
     h->content_tree->finalize = &content_finalize;
+    h->content_tree->ccny_alloc = &content_ccny_alloc;
+    h->content_tree->ccny_free = &content_ccny_free;
+    h->cs_snapshot = getenv("CCND_CS_SNAPSHOT");
+    if (h->cs_snapshot != NULL && h->cs_snapshot[0] == 0)
+        h->cs_snapshot = NULL;
+    if (h->cs_snapshot != NULL) {
+        cs_snapshot_load(h);
+        signal(CCND_SNAPSHOT_SIGNAL, &handle_snapshot_signal);
+    }
     h->mtu = 0;
     mtu = getenv("CCND_MTU");
     if (mtu != NULL && mtu[0] != 0) {
@@ -6100,6 +9432,39 @@ ccnd_create(const char *progname, ccnd_logger logger, void *loggerdata)
         if (h->data_pause_microsec > 1000000)
             h->data_pause_microsec = 1000000;
     }
+    h->pack_microsec = 0;
+    pack = getenv("CCND_PACK_MICROSEC");
+    if (pack != NULL && pack[0] != 0) {
+        h->pack_microsec = atol(pack);
+        if (h->pack_microsec > 100000)
+            h->pack_microsec = 100000;
+    }
+    if (h->mtu > 0)
+        ccnd_msg(h, "CCND_MTU=%d CCND_PACK_MICROSEC=%u",
+                 h->mtu, h->pack_microsec);
+    h->link_ack = 0;
+    link_ack = getenv("CCND_LINK_ACK");
+    if (link_ack != NULL && link_ack[0] != 0) {
+        h->link_ack = (atoi(link_ack) != 0);
+        ccnd_msg(h, "CCND_LINK_ACK=%d", h->link_ack);
+    }
+    h->aqm_target_usec = 0;
+    aqm_target = getenv("CCND_AQM_TARGET_MICROSEC");
+    if (aqm_target != NULL && aqm_target[0] != 0) {
+        h->aqm_target_usec = atol(aqm_target);
+        if (h->aqm_target_usec > CCND_AQM_INTERVAL_MICROSEC / 2)
+            h->aqm_target_usec = CCND_AQM_INTERVAL_MICROSEC / 2;
+        ccnd_msg(h, "CCND_AQM_TARGET_MICROSEC=%u", h->aqm_target_usec);
+    }
+    h->overload_usec = CCND_OVERLOAD_MICROSEC;
+    overload = getenv("CCND_OVERLOAD_MICROSEC");
+    if (overload != NULL && overload[0] != 0) {
+        h->overload_usec = atol(overload);
+        if (h->overload_usec < 1000)
+            h->overload_usec = 1000;
+        if (h->overload_usec > 10000000)
+            h->overload_usec = 10000000;
+    }
     h->tts_limit = 126230400; /* 4 years, assuming 1 leap year */
     tts_limit = getenv("CCND_MAX_TIME_TO_STALE");
     if (tts_limit != NULL && tts_limit[0] != 0) {
@@ -6142,6 +9507,8 @@ ccnd_create(const char *progname, ccnd_logger logger, void *loggerdata)
     /* Do keystore setup early, it takes a while the first time */
     ccnd_init_internal_keystore(h);
     ccnd_reseed(h);
+    h->nonce_tab = ccnd_nonce_table_create(CCND_NONCE_LIFETIME, h->wtnow,
+                                           h->seed);
     faceattr_declare(h, "valid", FAI_VALID);
     faceattr_declare(h, "application", FAI_APPLICATION);
     faceattr_declare(h, "broadcastcapable", FAI_BROADCAST_CAPABLE);
@@ -6202,12 +9569,13 @@ ccnd_destroy(struct ccnd_handle **pccnd)
     ccnd_shutdown_listeners(h);
     ccnd_internal_client_stop(h);
     ccn_schedule_destroy(&h->sched);
-    hashtb_destroy(&h->nonce_tab);
+    ccnd_nonce_table_destroy(&h->nonce_tab);
     hashtb_destroy(&h->dgram_faces);
     hashtb_destroy(&h->faces_by_fd);
     hashtb_destroy(&h->faceid_by_guid);
     hashtb_destroy(&h->interest_tab);
     hashtb_destroy(&h->nameprefix_tab);
+    ccnd_lpm_destroy(&h->nameprefix_index);
     hashtb_destroy(&h->guest_tab);
     hashtb_destroy(&h->faceattr_index_tab);
     if (h->fds != NULL) {
@@ -6215,21 +9583,36 @@ ccnd_destroy(struct ccnd_handle **pccnd)
         h->fds = NULL;
         h->nfds = 0;
     }
+    if (h->events != NULL) {
+        free(h->events);
+        h->events = NULL;
+        h->nevents = 0;
+    }
+    if (h->epfd != -1) {
+        close(h->epfd);
+        h->epfd = -1;
+    }
     if (h->faces_by_faceid != NULL) {
         free(h->faces_by_faceid);
         h->faces_by_faceid = NULL;
         h->face_limit = h->face_gen = 0;
     }
+    cs_snapshot_save(h);
     ccn_nametree_destroy(&h->content_tree);
+    hashtb_destroy(&h->content_by_name);
+    ccnd_cs_policy_finalize(h);
+    ccnd_cs_tier_finalize(h);
     ccn_nametree_destroy(&h->ex_index);
     ccn_charbuf_destroy(&h->send_interest_scratch);
     ccn_charbuf_destroy(&h->scratch_charbuf);
     ccn_charbuf_destroy(&h->autoreg);
     ccn_indexbuf_destroy(&h->scratch_indexbuf);
+    ccn_indexbuf_destroy(&h->dgram_flush);
+    ccn_indexbuf_destroy(&h->input_backlog);
     if (h->face0 != NULL) {
         int i;
         ccn_charbuf_destroy(&h->face0->inbuf);
-        ccn_charbuf_destroy(&h->face0->outbuf);
+        outq_destroy(h, &h->face0->outq);
         for (i = 0; i < CCN_CQ_N; i++)
             content_queue_destroy(h, &(h->face0->q[i]));
         for (i = 0; i < CCND_FACE_METER_N; i++)
@@ -6239,6 +9622,7 @@ ccnd_destroy(struct ccnd_handle **pccnd)
     }
     if (h->headx != NULL)
         free(h->headx);
+    ccnd_slab_destroy(h);
     free(h);
     *pccnd = NULL;
 }
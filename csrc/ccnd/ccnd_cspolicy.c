@@ -0,0 +1,773 @@
+/**
+ * @file ccnd_cspolicy.c
+ *
+ * Content store replacement policies for ccnd.
+ *
+ * Part of ccnd - the CCNx Daemon.
+ *
+ * Copyright (C) 2013 Palo Alto Research Center, Inc.
+ *
+ * This work is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 2 as published by the
+ * Free Software Foundation.
+ * This work is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details. You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <ccn/ccn.h>
+#include <ccn/flatname.h>
+#include <ccn/hashtb.h>
+#include <ccn/nametree.h>
+
+#include "ccnd_private.h"
+
+/**
+ * How far a policy looks for an evictable item before giving up
+ *
+ * Items that are queued for sending are not evicted, so the policies
+ * skip over them.
+ */
+#define CS_SCAN_LIMIT 100
+
+/* content_entry csflags */
+#define CS_LISTMASK 3       /**< which list, plus one; 0 if none */
+#define CS_REF      4       /**< referenced bit, for CLOCK */
+
+/**
+ * A list of content in the order kept by the policy
+ *
+ * The head is the least recently used end.
+ */
+struct cs_list {
+    struct content_entry *head;
+    struct content_entry *tail;
+    unsigned n;
+};
+
+/**
+ * A remembered name of recently evicted content, for ARC
+ */
+struct cs_ghost {
+    struct cs_ghost *next;          /**< toward the newer end */
+    struct cs_ghost *prev;          /**< toward the older end */
+    const unsigned char *key;       /**< the hashtb key */
+    size_t keysize;
+    int which;                      /**< 0 for B1, 1 for B2 */
+};
+
+struct cs_ghost_list {
+    struct cs_ghost *head;
+    struct cs_ghost *tail;
+    unsigned n;
+};
+
+/**
+ * Private state of the content store policy
+ */
+struct cs_policy_state {
+    struct cs_list l[2];            /**< ARC uses both, T1 and T2 */
+    struct content_entry *hand;     /**< CLOCK hand */
+    unsigned p;                     /**< ARC target size of T1 */
+    struct hashtb *ghost_tab;       /**< ARC ghost entries */
+    struct cs_ghost_list b[2];      /**< ARC B1 and B2 */
+};
+
+/**
+ * Frequency sketch used for TinyLFU admission
+ *
+ * This is a count-min sketch with CS_SKETCH_ROWS rows of small saturating
+ * counters.  All the counters are halved after every sample_limit
+ * recorded accesses, so that the frequencies reflect recent history.
+ */
+#define CS_SKETCH_ROWS 4
+#define CS_SKETCH_MAX 15
+struct cs_admit_filter {
+    unsigned mask;                  /**< row width minus one */
+    unsigned samples;               /**< accesses since the last aging */
+    unsigned sample_limit;          /**< when to age the counters */
+    unsigned char *counts;          /**< CS_SKETCH_ROWS rows of counters */
+};
+
+static void
+cs_list_append(struct cs_list *l, struct content_entry *c)
+{
+    c->csnext = NULL;
+    c->csprev = l->tail;
+    if (l->tail != NULL)
+        l->tail->csnext = c;
+    else
+        l->head = c;
+    l->tail = c;
+    l->n++;
+}
+
+static void
+cs_list_insert_before(struct cs_list *l, struct content_entry *pos,
+                      struct content_entry *c)
+{
+    if (pos == NULL) {
+        cs_list_append(l, c);
+        return;
+    }
+    c->csnext = pos;
+    c->csprev = pos->csprev;
+    if (pos->csprev != NULL)
+        pos->csprev->csnext = c;
+    else
+        l->head = c;
+    pos->csprev = c;
+    l->n++;
+}
+
+static void
+cs_list_unlink(struct cs_list *l, struct content_entry *c)
+{
+    if (c->csprev != NULL)
+        c->csprev->csnext = c->csnext;
+    else
+        l->head = c->csnext;
+    if (c->csnext != NULL)
+        c->csnext->csprev = c->csprev;
+    else
+        l->tail = c->csprev;
+    c->csnext = c->csprev = NULL;
+    l->n--;
+}
+
+/**
+ * Find the first item on the list, from the least recently used end,
+ * that is not queued for sending.
+ */
+static struct content_entry *
+cs_list_scan(struct cs_list *l, int *budget)
+{
+    struct content_entry *c;
+    
+    for (c = l->head; c != NULL && *budget > 0; c = c->csnext, (*budget)--)
+        if (c->refs == 0)
+            return(c);
+    return(NULL);
+}
+
+static struct cs_list *
+cs_list_of(struct cs_policy_state *s, struct content_entry *c)
+{
+    int which = c->csflags & CS_LISTMASK;
+    
+    if (which == 0)
+        return(NULL);
+    return(&s->l[which - 1]);
+}
+
+static int
+cs_init(struct ccnd_handle *h)
+{
+    h->cs_state = calloc(1, sizeof(*h->cs_state));
+    return(h->cs_state == NULL ? -1 : 0);
+}
+
+static void
+cs_finalize(struct ccnd_handle *h)
+{
+    free(h->cs_state);
+    h->cs_state = NULL;
+}
+
+static void
+cs_remove(struct ccnd_handle *h, struct content_entry *c)
+{
+    struct cs_list *l = cs_list_of(h->cs_state, c);
+    
+    if (l != NULL)
+        cs_list_unlink(l, c);
+    c->csflags = 0;
+}
+
+/* LRU */
+
+static void
+lru_insert(struct ccnd_handle *h, struct content_entry *c)
+{
+    cs_list_append(&h->cs_state->l[0], c);
+    c->csflags = 1;
+}
+
+static void
+lru_hit(struct ccnd_handle *h, struct content_entry *c)
+{
+    struct cs_list *l = cs_list_of(h->cs_state, c);
+    
+    if (l != NULL) {
+        cs_list_unlink(l, c);
+        cs_list_append(l, c);
+    }
+}
+
+static struct content_entry *
+lru_victim(struct ccnd_handle *h, int peek)
+{
+    int budget = CS_SCAN_LIMIT;
+    
+    return(cs_list_scan(&h->cs_state->l[0], &budget));
+}
+
+/* CLOCK */
+
+static void
+clock_insert(struct ccnd_handle *h, struct content_entry *c)
+{
+    struct cs_policy_state *s = h->cs_state;
+    
+    /* Just behind the hand, so it gets a full trip around */
+    cs_list_insert_before(&s->l[0], s->hand, c);
+    c->csflags = 1;
+}
+
+static void
+clock_hit(struct ccnd_handle *h, struct content_entry *c)
+{
+    if ((c->csflags & CS_LISTMASK) != 0)
+        c->csflags |= CS_REF;
+}
+
+static void
+clock_remove(struct ccnd_handle *h, struct content_entry *c)
+{
+    struct cs_policy_state *s = h->cs_state;
+    
+    if (s->hand == c)
+        s->hand = c->csnext;
+    cs_remove(h, c);
+}
+
+/**
+ * Find the content that clock_victim would most likely pick, without
+ * moving the hand or clearing referenced bits
+ *
+ * The hand clears the referenced bits it passes, so if there is no
+ * unreferenced candidate ahead of it, it comes back around to the first
+ * candidate it passed.
+ */
+static struct content_entry *
+clock_peek(struct ccnd_handle *h)
+{
+    struct cs_policy_state *s = h->cs_state;
+    struct content_entry *c;
+    struct content_entry *first = NULL;
+    int i;
+    
+    c = s->hand;
+    for (i = 0; i < CS_SCAN_LIMIT; i++) {
+        if (c == NULL)
+            c = s->l[0].head;
+        if (c == NULL)
+            break;
+        if (c->refs == 0) {
+            if ((c->csflags & CS_REF) == 0)
+                return(c);
+            if (first == NULL)
+                first = c;
+        }
+        c = c->csnext;
+    }
+    return(first);
+}
+
+static struct content_entry *
+clock_victim(struct ccnd_handle *h, int peek)
+{
+    struct cs_policy_state *s = h->cs_state;
+    struct content_entry *c;
+    int i;
+    
+    if (peek)
+        return(clock_peek(h));
+    c = s->hand;
+    for (i = 0; i < 2 * CS_SCAN_LIMIT; i++) {
+        if (c == NULL)
+            c = s->l[0].head;
+        if (c == NULL)
+            break;
+        if ((c->csflags & CS_REF) != 0)
+            c->csflags &= ~CS_REF;
+        else if (c->refs == 0) {
+            s->hand = c;
+            return(c);
+        }
+        c = c->csnext;
+    }
+    s->hand = c;
+    return(NULL);
+}
+
+/* ARC */
+
+static const unsigned char *
+cs_content_key(struct ccnd_handle *h, struct content_entry *c, size_t *size)
+{
+    struct ccny *y = ccny_from_cookie(h->content_tree, c->accession);
+    
+    if (y == NULL)
+        return(NULL);
+    *size = ccny_keylen(y);
+    return(ccny_key(y));
+}
+
+static void
+ghost_unlink(struct cs_policy_state *s, struct cs_ghost *g)
+{
+    struct cs_ghost_list *b = &s->b[g->which];
+    
+    if (g->prev != NULL)
+        g->prev->next = g->next;
+    else
+        b->head = g->next;
+    if (g->next != NULL)
+        g->next->prev = g->prev;
+    else
+        b->tail = g->prev;
+    g->next = g->prev = NULL;
+    b->n--;
+}
+
+static void
+ghost_drop_oldest(struct cs_policy_state *s, int which)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct cs_ghost *g = s->b[which].head;
+    
+    if (g == NULL)
+        return;
+    hashtb_start(s->ghost_tab, e);
+    if (hashtb_seek(e, g->key, g->keysize, 0) == HT_OLD_ENTRY)
+        hashtb_delete(e); /* finalize_ghost unlinks it */
+    hashtb_end(e);
+}
+
+static void
+finalize_ghost(struct hashtb_enumerator *e)
+{
+    struct ccnd_handle *h = hashtb_get_param(e->ht, NULL);
+    struct cs_ghost *g = e->data;
+    
+    if (g->key != NULL)
+        ghost_unlink(h->cs_state, g);
+}
+
+static int
+arc_init(struct ccnd_handle *h)
+{
+    struct hashtb_param param = {0};
+    
+    if (cs_init(h) < 0)
+        return(-1);
+    param.finalize_data = h;
+    param.finalize = &finalize_ghost;
+    h->cs_state->ghost_tab = hashtb_create(sizeof(struct cs_ghost), &param);
+    if (h->cs_state->ghost_tab == NULL)
+        return(-1);
+    return(0);
+}
+
+static void
+arc_finalize(struct ccnd_handle *h)
+{
+    if (h->cs_state != NULL)
+        hashtb_destroy(&h->cs_state->ghost_tab);
+    cs_finalize(h);
+}
+
+static void
+arc_insert(struct ccnd_handle *h, struct content_entry *c)
+{
+    struct cs_policy_state *s = h->cs_state;
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct cs_ghost *g;
+    const unsigned char *key;
+    size_t keysize = 0;
+    unsigned cap;
+    unsigned delta;
+    int which = 0;
+    
+    key = cs_content_key(h, c, &keysize);
+    g = (key == NULL) ? NULL : hashtb_lookup(s->ghost_tab, key, keysize);
+    if (g != NULL) {
+        /* Seen recently; adapt the target size of T1 toward the winner */
+        cap = s->l[0].n + s->l[1].n + 1;
+        if (g->which == 0) {
+            delta = s->b[1].n / s->b[0].n;
+            s->p += (delta > 1) ? delta : 1;
+            if (s->p > cap)
+                s->p = cap;
+        }
+        else {
+            delta = s->b[0].n / s->b[1].n;
+            delta = (delta > 1) ? delta : 1;
+            s->p = (s->p > delta) ? s->p - delta : 0;
+        }
+        hashtb_start(s->ghost_tab, e);
+        if (hashtb_seek(e, key, keysize, 0) == HT_OLD_ENTRY)
+            hashtb_delete(e);
+        hashtb_end(e);
+        which = 1;
+    }
+    cs_list_append(&s->l[which], c);
+    c->csflags = which + 1;
+}
+
+static void
+arc_hit(struct ccnd_handle *h, struct content_entry *c)
+{
+    struct cs_list *l = cs_list_of(h->cs_state, c);
+    
+    if (l != NULL) {
+        cs_list_unlink(l, c);
+        cs_list_append(&h->cs_state->l[1], c);
+        c->csflags = 2;
+    }
+}
+
+static void
+arc_touch(struct ccnd_handle *h, struct content_entry *c)
+{
+    lru_hit(h, c);
+}
+
+static void
+arc_remove(struct ccnd_handle *h, struct content_entry *c)
+{
+    struct cs_policy_state *s = h->cs_state;
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct cs_ghost *g;
+    struct cs_ghost_list *b;
+    const unsigned char *key;
+    size_t keysize = 0;
+    unsigned cap;
+    int which;
+    
+    which = (c->csflags & CS_LISTMASK) - 1;
+    cs_remove(h, c);
+    if (which < 0)
+        return;
+    /* Remember the name in B1 or B2 */
+    key = cs_content_key(h, c, &keysize);
+    if (key != NULL) {
+        hashtb_start(s->ghost_tab, e);
+        if (hashtb_seek(e, key, keysize, 0) == HT_NEW_ENTRY) {
+            g = e->data;
+            g->key = e->key;
+            g->keysize = e->keysize;
+            g->which = which;
+            b = &s->b[which];
+            g->prev = b->tail;
+            if (b->tail != NULL)
+                b->tail->next = g;
+            else
+                b->head = g;
+            b->tail = g;
+            b->n++;
+        }
+        hashtb_end(e);
+    }
+    /* Keep |T1| + |B1| and |B1| + |B2| within the resident size */
+    cap = s->l[0].n + s->l[1].n + 1;
+    while (s->b[0].n > 0 && s->l[0].n + s->b[0].n > cap)
+        ghost_drop_oldest(s, 0);
+    while (s->b[0].n + s->b[1].n > cap)
+        ghost_drop_oldest(s, s->b[1].n > 0 ? 1 : 0);
+}
+
+static struct content_entry *
+arc_victim(struct ccnd_handle *h, int peek)
+{
+    struct cs_policy_state *s = h->cs_state;
+    struct content_entry *c = NULL;
+    int budget = CS_SCAN_LIMIT;
+    int first = 1;
+    
+    if (s->l[0].n > 0 && (s->l[0].n > s->p || s->l[1].n == 0))
+        first = 0;
+    c = cs_list_scan(&s->l[first], &budget);
+    if (c == NULL)
+        c = cs_list_scan(&s->l[1 - first], &budget);
+    return(c);
+}
+
+static const struct cs_policy_class cs_policies[] = {
+    {"lru", &cs_init, &cs_finalize, &lru_insert, &lru_hit, &lru_hit,
+        &cs_remove, &lru_victim},
+    {"clock", &cs_init, &cs_finalize, &clock_insert, &clock_hit, &clock_hit,
+        &clock_remove, &clock_victim},
+    {"arc", &arc_init, &arc_finalize, &arc_insert, &arc_hit, &arc_touch,
+        &arc_remove, &arc_victim},
+    {NULL}
+};
+
+/* TinyLFU admission */
+
+static struct cs_admit_filter *
+cs_admit_create(unsigned width)
+{
+    struct cs_admit_filter *f;
+    unsigned w;
+    
+    for (w = 1024; w < width;)
+        w <<= 1;
+    f = calloc(1, sizeof(*f));
+    if (f == NULL)
+        return(NULL);
+    f->counts = calloc(CS_SKETCH_ROWS, w);
+    if (f->counts == NULL) {
+        free(f);
+        return(NULL);
+    }
+    f->mask = w - 1;
+    f->sample_limit = 10 * w;
+    return(f);
+}
+
+static void
+cs_admit_destroy(struct cs_admit_filter **pf)
+{
+    struct cs_admit_filter *f = *pf;
+    
+    if (f == NULL)
+        return;
+    free(f->counts);
+    free(f);
+    *pf = NULL;
+}
+
+/**
+ * Locate the counter for row i of the sketch
+ */
+static unsigned char *
+cs_sketch_counter(struct cs_admit_filter *f, size_t hash, int i)
+{
+    unsigned x;
+    
+    /* Double hashing gives the row indices from one hash value */
+    x = (unsigned)hash + i * ((unsigned)(hash >> 17) | 1);
+    x ^= x >> 15;
+    return(&f->counts[i * (f->mask + 1) + (x & f->mask)]);
+}
+
+static unsigned
+cs_sketch_estimate(struct cs_admit_filter *f, const unsigned char *key,
+                   size_t size)
+{
+    size_t hash = hashtb_hash(key, size);
+    unsigned ans = CS_SKETCH_MAX;
+    unsigned v;
+    int i;
+    
+    for (i = 0; i < CS_SKETCH_ROWS; i++) {
+        v = *cs_sketch_counter(f, hash, i);
+        if (v < ans)
+            ans = v;
+    }
+    return(ans);
+}
+
+/**
+ * Get the length of the content name part of a content store key
+ *
+ * The key ends with the implicit digest component, which the
+ * sketch should not see.
+ */
+static size_t
+cs_name_size(const unsigned char *key, size_t size)
+{
+    size_t last = 0;
+    size_t i;
+    int n;
+    
+    for (i = 0; i < size; i += n) {
+        n = ccn_flatname_next_comp(key + i, size - i);
+        if (n <= 0)
+            break;
+        last = i;
+    }
+    return(last);
+}
+
+static unsigned
+cs_content_frequency(struct ccnd_handle *h, struct content_entry *c)
+{
+    const unsigned char *key;
+    size_t keysize = 0;
+    
+    key = cs_content_key(h, c, &keysize);
+    if (key == NULL)
+        return(0);
+    return(cs_sketch_estimate(h->cs_admit, key, cs_name_size(key, keysize)));
+}
+
+/**
+ * Select and initialize the content store policy
+ *
+ * policy names one of the cs_policies; NULL, "", or "expiry" keep
+ * the default expiry-order eviction.  admit may be "tinylfu" to enable
+ * the admission filter, which requires a policy (lru is used if none
+ * was given).
+ * @returns 0 for success, -1 if an unknown name was given.
+ */
+int
+ccnd_cs_policy_init(struct ccnd_handle *h, const char *policy,
+                    const char *admit)
+{
+    int res = 0;
+    int i;
+    
+    h->cs_policy = NULL;
+    if (policy != NULL && policy[0] != 0 && strcmp(policy, "expiry") != 0) {
+        for (i = 0; cs_policies[i].id != NULL; i++)
+            if (strcmp(policy, cs_policies[i].id) == 0)
+                h->cs_policy = &cs_policies[i];
+        if (h->cs_policy == NULL)
+            res = -1;
+    }
+    if (admit != NULL && admit[0] != 0) {
+        if (strcmp(admit, "tinylfu") != 0)
+            res = -1;
+        else {
+            if (h->cs_policy == NULL)
+                h->cs_policy = &cs_policies[0];
+            h->cs_admit = cs_admit_create(h->capacity < (1U << 18) ?
+                                          h->capacity : (1U << 18));
+        }
+    }
+    if (h->cs_policy != NULL && (h->cs_policy->init)(h) < 0) {
+        ccnd_msg(h, "content store policy %s failed to start",
+                 h->cs_policy->id);
+        (h->cs_policy->finalize)(h);
+        h->cs_policy = NULL;
+        cs_admit_destroy(&h->cs_admit);
+        res = -1;
+    }
+    return(res);
+}
+
+void
+ccnd_cs_policy_finalize(struct ccnd_handle *h)
+{
+    if (h->cs_policy != NULL)
+        (h->cs_policy->finalize)(h);
+    cs_admit_destroy(&h->cs_admit);
+}
+
+/**
+ * Get the name of the content store policy in effect
+ */
+const char *
+ccnd_cs_policy_name(struct ccnd_handle *h)
+{
+    if (h->cs_policy == NULL)
+        return("expiry");
+    return(h->cs_policy->id);
+}
+
+/** Note that new content has entered the store */
+void
+ccnd_cs_insert(struct ccnd_handle *h, struct content_entry *content)
+{
+    if (h->cs_policy != NULL)
+        (h->cs_policy->insert)(h, content);
+}
+
+/** Note that content in the store has answered an interest */
+void
+ccnd_cs_hit(struct ccnd_handle *h, struct content_entry *content)
+{
+    if (h->cs_policy != NULL)
+        (h->cs_policy->hit)(h, content);
+}
+
+/** Note that content in the store is being sent */
+void
+ccnd_cs_touch(struct ccnd_handle *h, struct content_entry *content)
+{
+    if (h->cs_policy != NULL)
+        (h->cs_policy->touch)(h, content);
+}
+
+/** Note that content is leaving the store */
+void
+ccnd_cs_remove(struct ccnd_handle *h, struct content_entry *content)
+{
+    if (h->cs_policy != NULL)
+        (h->cs_policy->remove)(h, content);
+}
+
+/**
+ * Nominate content for eviction
+ *
+ * Content that is queued for sending is not nominated.
+ * @returns NULL if nothing suitable was found.
+ */
+struct content_entry *
+ccnd_cs_victim(struct ccnd_handle *h)
+{
+    if (h->cs_policy == NULL)
+        return(NULL);
+    return((h->cs_policy->victim)(h, 0));
+}
+
+/**
+ * Count an access to a name, for the admission filter
+ */
+void
+ccnd_cs_record(struct ccnd_handle *h, const unsigned char *flatname,
+               size_t size)
+{
+    struct cs_admit_filter *f = h->cs_admit;
+    unsigned char *p;
+    size_t hash;
+    unsigned i;
+    
+    if (f == NULL)
+        return;
+    hash = hashtb_hash(flatname, size);
+    for (i = 0; i < CS_SKETCH_ROWS; i++) {
+        p = cs_sketch_counter(f, hash, i);
+        if (*p < CS_SKETCH_MAX)
+            (*p)++;
+    }
+    if (++(f->samples) >= f->sample_limit) {
+        for (i = 0; i < CS_SKETCH_ROWS * (f->mask + 1); i++)
+            f->counts[i] >>= 1;
+        f->samples /= 2;
+    }
+}
+
+/**
+ * Decide whether newly arrived content deserves to stay in a full store
+ *
+ * With TinyLFU, the newcomer is kept only if its name has been asked
+ * for more often than that of the content it would displace.
+ * @returns 1 to admit, 0 to reject.
+ */
+int
+ccnd_cs_admit(struct ccnd_handle *h, struct content_entry *content)
+{
+    struct content_entry *victim;
+    
+    if (h->cs_admit == NULL)
+        return(1);
+    /* Only look; a refused newcomer must not age the resident content */
+    victim = (h->cs_policy == NULL) ? NULL : (h->cs_policy->victim)(h, 1);
+    if (victim == NULL || victim == content)
+        return(1);
+    return(cs_content_frequency(h, content) > cs_content_frequency(h, victim));
+}
@@ -0,0 +1,398 @@
+/**
+ * @file ccnd_cstier.c
+ *
+ * On-disk second tier for the ccnd content store.
+ *
+ * Part of ccnd - the CCNx Daemon.
+ *
+ * Copyright (C) 2013 Palo Alto Research Center, Inc.
+ *
+ * This work is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 2 as published by the
+ * Free Software Foundation.
+ * This work is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details. You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Content that is evicted from the in-memory store while still fresh is
+ * appended to a memory-mapped cache file that is used as a circular log.
+ * When the log wraps, the oldest records are simply overwritten.
+ *
+ * The in-memory index is a nametree keyed by the flatname of each record,
+ * with the key itself living in the mapped file.  The info field of each
+ * index entry holds the record offset divided by CS_TIER_ALIGN, so the
+ * index needs nothing beyond the nametree entries themselves.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <ccn/ccn.h>
+#include <ccn/charbuf.h>
+#include <ccn/flatname.h>
+#include <ccn/nametree.h>
+
+#include "ccnd_private.h"
+
+/** Record alignment in the cache file */
+#define CS_TIER_ALIGN 8
+
+/** Smallest cache file we are willing to use */
+#define CS_TIER_MIN_SIZE (1024 * 1024)
+
+/** How many tier entries an interest lookup may examine */
+#define CS_TIER_MAX_PROBES 200
+
+#define CS_TIER_MAGIC 0x43437431    /**< a record, "CCt1" */
+#define CS_TIER_WRAP  0x43437457    /**< the log continues at offset 0 */
+
+/**
+ * Header of each record in the cache file
+ *
+ * The ccnb follows the header, then the key, padded to CS_TIER_ALIGN.
+ */
+struct cs_tier_rec {
+    uint32_t magic;
+    uint32_t reclen;                /**< including header and padding */
+    uint32_t size;                  /**< size of ccnb */
+    uint32_t keysize;               /**< size of key */
+    int64_t staleat;                /**< wall-clock seconds */
+};
+
+/**
+ * State of the on-disk tier
+ *
+ * The live part of the log runs from tail to head, possibly wrapping
+ * around the end of the file.  Space that is skipped at the end of the
+ * file when the log wraps counts as used until the tail passes it.
+ */
+struct cs_tier {
+    int fd;
+    unsigned char *base;            /**< the mapped file */
+    size_t size;                    /**< size of the mapping */
+    size_t head;                    /**< where the next record goes */
+    size_t tail;                    /**< oldest record */
+    size_t used;                    /**< bytes between tail and head */
+    unsigned long long live;        /**< bytes in indexed records */
+    struct ccn_nametree *index;     /**< by flatname */
+};
+
+static struct cs_tier_rec *
+tier_rec(struct cs_tier *t, struct ccny *y)
+{
+    return((struct cs_tier_rec *)(t->base + (size_t)ccny_info(y) * CS_TIER_ALIGN));
+}
+
+/**
+ * The index keys live in the mapped file, so they must not be freed
+ */
+static void
+tier_index_finalize(struct ccn_nametree *ntree, struct ccny *y)
+{
+    ccny_set_key_fields(y, NULL, 0);
+}
+
+/**
+ * Remove an index entry, which must be enrolled
+ */
+static void
+tier_unindex(struct cs_tier *t, struct ccny *y)
+{
+    t->live -= tier_rec(t, y)->reclen;
+    ccny_remove(t->index, y);
+    ccny_destroy(t->index, &y);
+}
+
+/**
+ * Retire the oldest record in the log
+ */
+static void
+tier_reclaim_tail(struct cs_tier *t)
+{
+    struct cs_tier_rec *rec;
+    struct ccny *y;
+    size_t avail;
+
+    avail = t->size - t->tail;
+    rec = (struct cs_tier_rec *)(t->base + t->tail);
+    if (avail < sizeof(*rec) || rec->magic != CS_TIER_MAGIC) {
+        /* wrap marker or unusable end of the file */
+        t->used -= avail;
+        t->tail = 0;
+        return;
+    }
+    y = ccn_nametree_lookup(t->index,
+                            (unsigned char *)(rec + 1) + rec->size,
+                            rec->keysize);
+    if (y != NULL && tier_rec(t, y) == rec)
+        tier_unindex(t, y);
+    t->used -= rec->reclen;
+    t->tail += rec->reclen;
+    if (t->tail == t->size)
+        t->tail = 0;
+}
+
+/**
+ * Make room for a record of the given length at t->head
+ * @returns 0 for success, -1 if the record can never fit.
+ */
+static int
+tier_make_room(struct cs_tier *t, size_t reclen)
+{
+    struct cs_tier_rec *rec;
+
+    if (reclen > t->size / 2)
+        return(-1);
+    while (t->used != 0) {
+        if (t->head > t->tail) {
+            /* free space is at the end, and before the tail */
+            if (t->size - t->head >= reclen)
+                return(0);
+            if (t->size - t->head >= sizeof(*rec)) {
+                rec = (struct cs_tier_rec *)(t->base + t->head);
+                rec->magic = CS_TIER_WRAP;
+                rec->reclen = t->size - t->head;
+            }
+            t->used += t->size - t->head;
+            t->head = 0;
+            continue;
+        }
+        if (t->tail - t->head >= reclen)
+            return(0);
+        tier_reclaim_tail(t);
+    }
+    t->head = t->tail = 0;
+    return(0);
+}
+
+/**
+ * Set up the on-disk tier, using the cache file at path
+ *
+ * Any previous contents of the file are discarded.
+ * @returns 0 for success, -1 for error.
+ */
+int
+ccnd_cs_tier_init(struct ccnd_handle *h, const char *path,
+                  unsigned long long size)
+{
+    struct cs_tier *t = NULL;
+    void *base;
+    unsigned long long maxsize;
+
+    maxsize = (unsigned long long)UINT_MAX * CS_TIER_ALIGN;
+    if (maxsize > SIZE_MAX / 2)
+        maxsize = SIZE_MAX / 2;
+    if (size > maxsize)
+        size = maxsize;
+    size -= size % CS_TIER_ALIGN;
+    if (size < CS_TIER_MIN_SIZE) {
+        ccnd_msg(h, "content store tier: %llu bytes is too small", size);
+        return(-1);
+    }
+    t = calloc(1, sizeof(*t));
+    if (t == NULL)
+        return(-1);
+    t->size = size;
+    t->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (t->fd == -1 || ftruncate(t->fd, t->size) == -1) {
+        ccnd_msg(h, "content store tier %s: %s", path, strerror(errno));
+        goto Fail;
+    }
+    base = mmap(NULL, t->size, PROT_READ | PROT_WRITE, MAP_SHARED, t->fd, 0);
+    if (base == MAP_FAILED) {
+        ccnd_msg(h, "content store tier %s: mmap: %s", path, strerror(errno));
+        goto Fail;
+    }
+    t->base = base;
+    t->index = ccn_nametree_create(1024);
+    if (t->index == NULL)
+        goto Fail;
+    t->index->finalize = &tier_index_finalize;
+    h->cs_tier = t;
+    return(0);
+Fail:
+    if (t->base != NULL)
+        munmap(t->base, t->size);
+    if (t->fd != -1)
+        close(t->fd);
+    free(t);
+    return(-1);
+}
+
+/**
+ * Tear down the on-disk tier
+ */
+void
+ccnd_cs_tier_finalize(struct ccnd_handle *h)
+{
+    struct cs_tier *t = h->cs_tier;
+
+    if (t == NULL)
+        return;
+    h->cs_tier = NULL;
+    ccn_nametree_destroy(&t->index);
+    munmap(t->base, t->size);
+    close(t->fd);
+    free(t);
+}
+
+/**
+ * Append content that is leaving the in-memory store to the tier
+ *
+ * @param key is the flatname, including the digest component.
+ * @param freshness is the number of seconds until the content goes stale.
+ * @returns 0 if the content was stored, -1 if not.
+ */
+int
+ccnd_cs_tier_spill(struct ccnd_handle *h,
+                   const unsigned char *key, size_t keysize,
+                   const unsigned char *ccnb, size_t size, int freshness)
+{
+    struct cs_tier *t = h->cs_tier;
+    struct cs_tier_rec *rec;
+    struct ccny *y;
+    unsigned char *p;
+    size_t reclen;
+
+    if (t == NULL || freshness <= 0)
+        return(-1);
+    if (ccn_nametree_lookup(t->index, key, keysize) != NULL)
+        return(0); /* already there */
+    reclen = sizeof(*rec) + size + keysize;
+    reclen += (CS_TIER_ALIGN - reclen % CS_TIER_ALIGN) % CS_TIER_ALIGN;
+    if (tier_make_room(t, reclen) < 0)
+        return(-1);
+    if (t->index->n >= t->index->limit && ccn_nametree_grow(t->index) < 0)
+        return(-1);
+    y = ccny_create(nrand48(h->seed), 0);
+    if (y == NULL)
+        return(-1);
+    rec = (struct cs_tier_rec *)(t->base + t->head);
+    rec->magic = CS_TIER_MAGIC;
+    rec->reclen = reclen;
+    rec->size = size;
+    rec->keysize = keysize;
+    rec->staleat = (int64_t)h->sec + freshness;
+    p = (unsigned char *)(rec + 1);
+    memcpy(p, ccnb, size);
+    memcpy(p + size, key, keysize);
+    ccny_set_key_fields(y, p + size, keysize);
+    ccny_set_info(y, t->head / CS_TIER_ALIGN);
+    if (ccny_enroll(t->index, y) != 0 || ccny_cookie(y) == 0) {
+        ccny_destroy(t->index, &y);
+        return(-1);
+    }
+    t->head += reclen;
+    t->used += reclen;
+    t->live += reclen;
+    return(0);
+}
+
+/**
+ * Look in the tier for content that matches an interest
+ *
+ * @param flatname is the interest name, as a flatname.
+ * @param excl is the compiled Exclude of the interest, or NULL.
+ * @returns 0 and fills in *hit if a match is found, otherwise -1.
+ */
+int
+ccnd_cs_tier_lookup(struct ccnd_handle *h,
+                    const unsigned char *msg, size_t size,
+                    const struct ccn_parsed_interest *pi,
+                    const struct ccn_exclusion *excl,
+                    const struct ccn_charbuf *flatname,
+                    struct cs_tier_hit *hit)
+{
+    struct cs_tier *t = h->cs_tier;
+    struct cs_tier_rec *rec = NULL;
+    struct cs_tier_rec *match = NULL;
+    struct ccny *y;
+    int s_ok;
+    int res;
+    int try;
+
+    if (t == NULL || t->index->n == 0)
+        return(-1);
+    s_ok = (pi->answerfrom & CCN_AOK_STALE) != 0;
+    y = ccn_nametree_look_ge(t->index, flatname->buf, flatname->length);
+    for (try = 0; y != NULL && try < CS_TIER_MAX_PROBES; try++, y = ccny_next(y)) {
+        res = ccn_flatname_compare(flatname->buf, flatname->length,
+                                   ccny_key(y), ccny_keylen(y));
+        if (res != CCN_STRICT_PREFIX && res != 0)
+            break;
+        rec = tier_rec(t, y);
+        if (!s_ok && rec->staleat <= h->sec)
+            continue;
+        if (ccn_content_matches_interest_excl((unsigned char *)(rec + 1),
+                                              rec->size, 1, NULL,
+                                              msg, size, pi, excl)) {
+            match = rec;
+            if ((pi->orderpref & 1) == 0)
+                break;
+        }
+    }
+    if (match == NULL)
+        return(-1);
+    hit->ccnb = (unsigned char *)(match + 1);
+    hit->size = match->size;
+    hit->key = hit->ccnb + match->size;
+    hit->keysize = match->keysize;
+    hit->freshness = match->staleat - h->sec;
+    return(0);
+}
+
+/**
+ * Forget a record, normally because it has been promoted
+ */
+void
+ccnd_cs_tier_drop(struct ccnd_handle *h, const struct cs_tier_hit *hit)
+{
+    struct cs_tier *t = h->cs_tier;
+    struct ccny *y;
+
+    if (t == NULL)
+        return;
+    y = ccn_nametree_lookup(t->index, hit->key, hit->keysize);
+    if (y != NULL)
+        tier_unindex(t, y);
+}
+
+/**
+ * @returns the number of content objects held in the tier.
+ */
+int
+ccnd_cs_tier_n(struct ccnd_handle *h)
+{
+    return(h->cs_tier == NULL ? 0 : h->cs_tier->index->n);
+}
+
+/**
+ * @returns the number of bytes of the cache file used by indexed records.
+ */
+unsigned long long
+ccnd_cs_tier_bytes(struct ccnd_handle *h)
+{
+    return(h->cs_tier == NULL ? 0 : h->cs_tier->live);
+}
+
+/**
+ * @returns the size of the cache file.
+ */
+unsigned long long
+ccnd_cs_tier_size(struct ccnd_handle *h)
+{
+    return(h->cs_tier == NULL ? 0 : h->cs_tier->size);
+}
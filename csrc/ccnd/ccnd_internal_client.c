@@ -967,6 +967,7 @@ ccnd_req_guest(struct ccn_closure *selfp,
 #define OP_SETSTRATEGY 0x0B00
 #define OP_GETSTRATEGY 0x0C00
 #define OP_REMSTRATEGY 0x0D00
+#define OP_BULKREG     0x0E00
 
 /**
  * Common interest handler for ccnd_internal_client
@@ -1073,6 +1074,10 @@ ccnd_answer_req(struct ccn_closure *selfp,
             reply_body = ccn_charbuf_create();
             res = ccnd_req_unreg(ccnd, final_comp, final_size, reply_body);
             break;
+        case OP_BULKREG:
+            reply_body = ccn_charbuf_create();
+            res = ccnd_req_bulkreg(ccnd, final_comp, final_size, reply_body);
+            break;
         case OP_SETSTRATEGY:
             v = "setstrategy";
             reply_body = ccn_charbuf_create();
@@ -1589,6 +1594,8 @@ ccnd_internal_client_start(struct ccnd_handle *ccnd)
                     &ccnd_answer_req, OP_SELFREG + MUST_VERIFY1);
     ccnd_uri_listen(ccnd, "ccnx:/ccnx/" CCND_ID_TEMPL "/unreg",
                     &ccnd_answer_req, OP_UNREG + MUST_VERIFY1);
+    ccnd_uri_listen(ccnd, "ccnx:/ccnx/" CCND_ID_TEMPL "/bulkreg",
+                    &ccnd_answer_req, OP_BULKREG + MUST_VERIFY1);
     
     ccnd_uri_listen(ccnd, "ccnx:/ccnx/" CCND_ID_TEMPL "/setstrategy",
                     &ccnd_answer_req, MUST_VERIFY1 + OP_SETSTRATEGY);
@@ -0,0 +1,191 @@
+/**
+ * @file ccnd_lpm.c
+ *
+ * Longest-prefix match of names against the name prefix table.
+ *
+ * Part of ccnd - the CCNx Daemon.
+ *
+ * Copyright (C) 2013 Palo Alto Research Center, Inc.
+ *
+ * This work is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 2 as published by the
+ * Free Software Foundation.
+ * This work is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details. You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <ccn/charbuf.h>
+#include <ccn/flatname.h>
+#include <ccn/hashtb.h>
+
+#include "ccnd_private.h"
+
+/**
+ * Index of the children of the nodes of a name prefix tree
+ *
+ * Each entry is keyed by the address of the parent node followed by
+ * the value of one name component, and points to the child node.
+ * The nodes themselves belong to the caller.  Since a name prefix
+ * table holds every prefix of each name in it, the longest matching
+ * prefix of a name is found by following one entry per component,
+ * starting from the root, until a component has no child.
+ */
+struct ccnd_lpm {
+    struct hashtb *ht;              /**< child links */
+    struct ccn_charbuf *key;        /**< scratch for building keys */
+};
+
+struct lpm_link {
+    void *child;
+};
+
+static const unsigned char *
+lpm_key(struct ccnd_lpm *lpm, const void *parent,
+        const unsigned char *comp, size_t size)
+{
+    struct ccn_charbuf *key = lpm->key;
+    
+    key->length = 0;
+    ccn_charbuf_append(key, &parent, sizeof(parent));
+    ccn_charbuf_append(key, comp, size);
+    return(key->buf);
+}
+
+struct ccnd_lpm *
+ccnd_lpm_create(void)
+{
+    struct ccnd_lpm *lpm;
+    
+    lpm = calloc(1, sizeof(*lpm));
+    if (lpm == NULL)
+        return(NULL);
+    lpm->ht = hashtb_create(sizeof(struct lpm_link), NULL);
+    lpm->key = ccn_charbuf_create();
+    if (lpm->ht == NULL || lpm->key == NULL)
+        ccnd_lpm_destroy(&lpm);
+    return(lpm);
+}
+
+void
+ccnd_lpm_destroy(struct ccnd_lpm **plpm)
+{
+    struct ccnd_lpm *lpm = *plpm;
+    
+    if (lpm == NULL)
+        return;
+    hashtb_destroy(&lpm->ht);
+    ccn_charbuf_destroy(&lpm->key);
+    free(lpm);
+    *plpm = NULL;
+}
+
+/**
+ * Find the child of parent that adds the component value comp
+ * @returns NULL if there is none.
+ */
+void *
+ccnd_lpm_child(struct ccnd_lpm *lpm, const void *parent,
+               const unsigned char *comp, size_t size)
+{
+    struct lpm_link *link;
+    
+    link = hashtb_lookup(lpm->ht, lpm_key(lpm, parent, comp, size),
+                         sizeof(parent) + size);
+    if (link == NULL)
+        return(NULL);
+    return(link->child);
+}
+
+/**
+ * Record child as the child of parent that adds the component value comp
+ * @returns 0 for success, -1 for error.
+ */
+int
+ccnd_lpm_link(struct ccnd_lpm *lpm, const void *parent,
+              const unsigned char *comp, size_t size, void *child)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct lpm_link *link;
+    int res;
+    
+    hashtb_start(lpm->ht, e);
+    res = hashtb_seek(e, lpm_key(lpm, parent, comp, size),
+                      sizeof(parent) + size, 0);
+    if (res >= 0) {
+        link = e->data;
+        link->child = child;
+        res = 0;
+    }
+    hashtb_end(e);
+    return(res);
+}
+
+/**
+ * Forget the child of parent that adds the component value comp
+ */
+void
+ccnd_lpm_unlink(struct ccnd_lpm *lpm, const void *parent,
+                const unsigned char *comp, size_t size)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    
+    hashtb_start(lpm->ht, e);
+    if (hashtb_seek(e, lpm_key(lpm, parent, comp, size),
+                    sizeof(parent) + size, 0) == HT_OLD_ENTRY)
+        hashtb_delete(e);
+    hashtb_end(e);
+}
+
+/**
+ * Find the node for the longest prefix of a name
+ *
+ * The name is given in flatname form, so no ccnb decoding is needed.
+ * If pncomps is not NULL, the number of components matched is stored
+ * there.
+ * @returns the deepest node reached, which is root if not even the first
+ *          component matches.
+ */
+void *
+ccnd_lpm_match(struct ccnd_lpm *lpm, void *root,
+               const unsigned char *flatname, size_t size, int *pncomps)
+{
+    void *node = root;
+    void *child;
+    size_t i;
+    int ncomps = 0;
+    int rnc;
+    
+    for (i = 0; node != NULL && i < size; i += CCNFLATSKIP(rnc)) {
+        rnc = ccn_flatname_next_comp(flatname + i, size - i);
+        if (rnc <= 0)
+            break;
+        child = ccnd_lpm_child(lpm, node, flatname + i + CCNFLATDELIMSZ(rnc),
+                               CCNFLATDATASZ(rnc));
+        if (child == NULL)
+            break;
+        node = child;
+        ncomps++;
+    }
+    if (pncomps != NULL)
+        *pncomps = ncomps;
+    return(node);
+}
+
+/**
+ * Get the number of child links in the index
+ */
+int
+ccnd_lpm_n(struct ccnd_lpm *lpm)
+{
+    return(hashtb_n(lpm->ht));
+}
@@ -310,13 +310,42 @@ const char *ccnd_usage_message =
     "      Also affects name of unix-domain socket.\n"
     "    CCN_LOCAL_SOCKNAME=\n"
     "      Name stem of unix-domain socket (default "CCN_DEFAULT_LOCAL_SOCKNAME").\n"
+    "    CCN_SCHEDULE=\n"
+    "      Set to 'wheel' to use a timing wheel for scheduled events\n"
     "    CCND_CAP=\n"
     "      Capacity limit, in count of ContentObjects.\n"
     "      Not an absolute limit.\n"
+    "    CCND_CAP_BYTES=\n"
+    "      Capacity limit, in bytes of memory used by the content store.\n"
+    "      Not an absolute limit.\n"
+    "    CCND_CS_POLICY=\n"
+    "      Content store replacement policy: expiry (default), lru, clock, arc\n"
+    "    CCND_CS_ADMIT=\n"
+    "      Set to tinylfu to admit new content to a full store only if its\n"
+    "      name is more popular than that of the content it would displace\n"
+    "    CCND_CS_TIER=\n"
+    "      Cache file for an on-disk tier that holds fresh evicted content\n"
+    "    CCND_CS_TIER_BYTES=\n"
+    "      Size of the CCND_CS_TIER cache file (default 1 GiB)\n"
+    "    CCND_CS_SNAPSHOT=\n"
+    "      File for saving the content store at exit or on SIGUSR1,\n"
+    "      and reloading it at startup\n"
     "    CCND_MTU=\n"
     "      Packet size in bytes.\n"
     "      If set, interest stuffing is allowed within this budget.\n"
     "      Single items larger than this are not precluded.\n"
+    "      Small messages to datagram faces are packed together within it.\n"
+    "    CCND_PACK_MICROSEC=\n"
+    "      Longest wait for more messages to pack into a datagram (default 0)\n"
+    "    CCND_LINK_ACK=\n"
+    "      If 1, acknowledge packets and retransmit losses on unicast\n"
+    "      datagram faces whose peers do the same (default 0)\n"
+    "    CCND_AQM_TARGET_MICROSEC=\n"
+    "      Drop content that waits longer than this in a face's send queue\n"
+    "      beyond its intended delay, when that persists (default 0, off)\n"
+    "    CCND_OVERLOAD_MICROSEC=\n"
+    "      Shed interests from other nodes once input has been backing up\n"
+    "      for this long (default 50000)\n"
     "    CCND_DATA_PAUSE_MICROSEC=\n"
     "      Adjusts content-send delay time for multicast and udplink faces\n"
     "    CCND_DEFAULT_TIME_TO_STALE=\n"
@@ -0,0 +1,476 @@
+/**
+ * @file ccnd_nonce.c
+ *
+ * Table of recently seen interest nonces, for duplicate detection.
+ *
+ * Part of ccnd - the CCNx Daemon.
+ *
+ * Copyright (C) 2013 Palo Alto Research Center, Inc.
+ *
+ * This work is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 2 as published by the
+ * Free Software Foundation.
+ * This work is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details. You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ccn/ccn.h>
+#include <ccn/charbuf.h>
+#include <ccn/face_mgmt.h>
+#include <ccn/siphash24.h>
+
+#include "ccnd_private.h"
+
+/**
+ * Number of time buckets in the ring
+ *
+ * Each bucket holds the nonces first seen or refreshed while it was the
+ * current one.  When the ring comes around, the oldest bucket is emptied
+ * all at once, so there is no per-nonce expiry bookkeeping.
+ */
+#define NONCE_BUCKETS 8
+#define NONCE_MIN_TABLE 64          /**< initial slots in a bucket table */
+#define FILTER_WAYS 4               /**< fingerprints per filter bucket */
+#define FILTER_MIN_BUCKETS 1024
+#define FILTER_MAX_KICKS 256
+
+/**
+ * A nonce in the exact table of a time bucket
+ *
+ * The nonce bytes are kept in the arena of the bucket.
+ */
+struct nonce_rec {
+    uint64_t hash;                  /**< keyed hash; 0 marks an empty slot */
+    unsigned off;                   /**< offset of the nonce in the arena */
+    unsigned size;                  /**< size of the nonce */
+    unsigned faceid;                /**< face the nonce was first seen on */
+};
+
+struct nonce_bucket {
+    ccn_wrappedtime start;          /**< when this became the current bucket */
+    unsigned gen;                   /**< generation number, for the filter */
+    unsigned n;                     /**< records in tab */
+    unsigned mask;                  /**< size of tab, minus one */
+    struct nonce_rec *tab;          /**< open addressing, linear probing */
+    struct ccn_charbuf *arena;      /**< nonce bytes */
+};
+
+/**
+ * The nonce table
+ *
+ * In front of the exact tables sits a cuckoo filter.  Each of its entries
+ * holds a 16-bit fingerprint of a nonce and the low bits of the generation
+ * of the newest bucket that holds it; entries from generations that have
+ * left the ring count as empty, so dropping a bucket costs nothing in the
+ * filter either.  A miss in the filter means the nonce is certainly new,
+ * and the exact tables need not be consulted.
+ */
+struct ccnd_nonce_table {
+    unsigned char key[16];          /**< siphash key */
+    unsigned lifetime;              /**< how long a nonce is remembered */
+    unsigned span;                  /**< how long each bucket is current */
+    unsigned cur;                   /**< index of the current bucket */
+    unsigned gen;                   /**< generation of the current bucket */
+    unsigned n;                     /**< records in all buckets */
+    struct nonce_bucket b[NONCE_BUCKETS];
+    uint32_t *filter;               /**< (fmask + 1) * FILTER_WAYS entries */
+    unsigned fmask;                 /**< filter buckets, minus one */
+};
+
+#define FILTER_FP(e) ((e) >> 16)
+#define FILTER_GEN(e) ((e) & 0xFFFF)
+
+static int
+filter_live(struct ccnd_nonce_table *t, uint32_t e)
+{
+    return(FILTER_FP(e) != 0 &&
+           ((t->gen - FILTER_GEN(e)) & 0xFFFF) < NONCE_BUCKETS);
+}
+
+static uint32_t
+filter_fp(uint64_t hash)
+{
+    uint32_t fp = (hash >> 48) & 0xFFFF;
+    
+    return(fp == 0 ? 1 : fp);
+}
+
+static unsigned
+filter_alt(struct ccnd_nonce_table *t, unsigned i, uint32_t fp)
+{
+    return((i ^ (fp * 0x5bd1e995U)) & t->fmask);
+}
+
+/**
+ * Allocate an empty filter with at least the given number of buckets
+ */
+static int
+filter_alloc(struct ccnd_nonce_table *t, unsigned nbuckets)
+{
+    uint32_t *f;
+    unsigned n;
+    
+    for (n = FILTER_MIN_BUCKETS; n < nbuckets;)
+        n <<= 1;
+    f = calloc(n * FILTER_WAYS, sizeof(f[0]));
+    if (f == NULL)
+        return(-1);
+    free(t->filter);
+    t->filter = f;
+    t->fmask = n - 1;
+    return(0);
+}
+
+static int
+filter_contains(struct ccnd_nonce_table *t, uint64_t hash)
+{
+    uint32_t fp = filter_fp(hash);
+    unsigned i = hash & t->fmask;
+    unsigned j = filter_alt(t, i, fp);
+    uint32_t *a = &t->filter[i * FILTER_WAYS];
+    uint32_t *b = &t->filter[j * FILTER_WAYS];
+    int k;
+    
+    for (k = 0; k < FILTER_WAYS; k++) {
+        if (FILTER_FP(a[k]) == fp && filter_live(t, a[k]))
+            return(1);
+        if (FILTER_FP(b[k]) == fp && filter_live(t, b[k]))
+            return(1);
+    }
+    return(0);
+}
+
+/**
+ * Note in the filter that a nonce is held by the current bucket
+ *
+ * A live entry with the same fingerprint may be brought up to the current
+ * generation instead of adding another, since that only makes it last
+ * longer for any other nonce that it stands for.
+ * @returns 0 for success, -1 if the filter is too full.
+ */
+static int
+filter_add(struct ccnd_nonce_table *t, uint64_t hash)
+{
+    uint32_t fp = filter_fp(hash);
+    uint32_t e = (fp << 16) | (t->gen & 0xFFFF);
+    uint32_t victim;
+    uint32_t *s;
+    unsigned i = hash & t->fmask;
+    unsigned j = filter_alt(t, i, fp);
+    unsigned x;
+    int k;
+    int m;
+    int n;
+    
+    for (x = i, m = 0; m < 2; x = j, m++) {
+        s = &t->filter[x * FILTER_WAYS];
+        for (k = 0; k < FILTER_WAYS; k++)
+            if (FILTER_FP(s[k]) == fp && filter_live(t, s[k])) {
+                s[k] = e;
+                return(0);
+            }
+    }
+    for (n = 0; n < FILTER_MAX_KICKS; n++) {
+        for (x = i, m = 0; m < 2; x = j, m++) {
+            s = &t->filter[x * FILTER_WAYS];
+            for (k = 0; k < FILTER_WAYS; k++)
+                if (!filter_live(t, s[k])) {
+                    s[k] = e;
+                    return(0);
+                }
+        }
+        /* Both full; displace an entry to its other bucket */
+        x = (n & 1) ? j : i;
+        s = &t->filter[x * FILTER_WAYS];
+        k = (hash >> (n % 32)) % FILTER_WAYS;
+        victim = s[k];
+        s[k] = e;
+        e = victim;
+        i = j = filter_alt(t, x, FILTER_FP(e));
+    }
+    return(-1);
+}
+
+static struct nonce_rec *
+bucket_find(struct nonce_bucket *b, uint64_t hash,
+            const unsigned char *nonce, size_t size)
+{
+    struct nonce_rec *r;
+    unsigned i;
+    
+    if (b->n == 0)
+        return(NULL);
+    for (i = hash & b->mask;; i = (i + 1) & b->mask) {
+        r = &b->tab[i];
+        if (r->hash == 0)
+            return(NULL);
+        if (r->hash == hash && r->size == size &&
+            memcmp(b->arena->buf + r->off, nonce, size) == 0)
+            return(r);
+    }
+}
+
+static int
+bucket_resize(struct nonce_bucket *b, unsigned nslots)
+{
+    struct nonce_rec *old = b->tab;
+    struct nonce_rec *tab;
+    unsigned oldslots = (old == NULL) ? 0 : b->mask + 1;
+    unsigned mask = nslots - 1;
+    unsigned i;
+    unsigned k;
+    
+    tab = calloc(nslots, sizeof(tab[0]));
+    if (tab == NULL)
+        return(-1);
+    for (k = 0; k < oldslots; k++) {
+        if (old[k].hash == 0)
+            continue;
+        for (i = old[k].hash & mask; tab[i].hash != 0; i = (i + 1) & mask)
+            continue;
+        tab[i] = old[k];
+    }
+    free(old);
+    b->tab = tab;
+    b->mask = mask;
+    return(0);
+}
+
+static struct nonce_rec *
+bucket_add(struct nonce_bucket *b, uint64_t hash,
+           const unsigned char *nonce, size_t size, unsigned faceid)
+{
+    struct nonce_rec *r;
+    unsigned i;
+    
+    if (b->tab == NULL || (b->n + 1) * 4 > (b->mask + 1) * 3) {
+        if (bucket_resize(b, b->tab == NULL ? NONCE_MIN_TABLE :
+                                              2 * (b->mask + 1)) < 0)
+            return(NULL);
+    }
+    for (i = hash & b->mask; b->tab[i].hash != 0; i = (i + 1) & b->mask)
+        continue;
+    r = &b->tab[i];
+    r->hash = hash;
+    r->off = b->arena->length;
+    r->size = size;
+    r->faceid = faceid;
+    ccn_charbuf_append(b->arena, nonce, size);
+    b->n++;
+    return(r);
+}
+
+/**
+ * Empty a bucket, giving back memory if it was much bigger than needed
+ */
+static void
+bucket_clear(struct nonce_bucket *b)
+{
+    if (b->tab != NULL) {
+        if (b->mask + 1 > NONCE_MIN_TABLE && b->n * 8 < b->mask + 1) {
+            free(b->tab);
+            b->tab = NULL;
+            b->mask = 0;
+        }
+        else
+            memset(b->tab, 0, (b->mask + 1) * sizeof(b->tab[0]));
+    }
+    b->n = 0;
+    b->arena->length = 0;
+}
+
+/**
+ * Rebuild the filter from the exact tables, with room for more
+ */
+static int
+filter_rebuild(struct ccnd_nonce_table *t, unsigned nbuckets)
+{
+    struct nonce_bucket *b;
+    unsigned savegen = t->gen;
+    unsigned i;
+    unsigned k;
+    int res = 0;
+    
+    if (filter_alloc(t, nbuckets) < 0)
+        return(-1);
+    /* Oldest first, so each nonce ends up tagged with its newest bucket */
+    for (i = 1; i <= NONCE_BUCKETS && res == 0; i++) {
+        b = &t->b[(t->cur + i) % NONCE_BUCKETS];
+        if (b->n == 0)
+            continue;
+        t->gen = b->gen;
+        for (k = 0; k <= b->mask && res == 0; k++)
+            if (b->tab[k].hash != 0)
+                res = filter_add(t, b->tab[k].hash);
+    }
+    t->gen = savegen;
+    return(res);
+}
+
+static void
+filter_insert(struct ccnd_nonce_table *t, uint64_t hash)
+{
+    unsigned nbuckets = t->fmask + 1;
+    
+    if (filter_add(t, hash) == 0)
+        return;
+    /*
+     * The entry that did not fit might stand for any nonce, so rebuild
+     * everything from the exact tables.
+     */
+    do {
+        nbuckets *= 2;
+    } while (filter_rebuild(t, nbuckets) < 0 && nbuckets < (1U << 28));
+}
+
+/**
+ * Advance the ring of buckets to the given time
+ */
+static void
+nonce_rotate(struct ccnd_nonce_table *t, ccn_wrappedtime now)
+{
+    struct nonce_bucket *b = &t->b[t->cur];
+    unsigned steps;
+    unsigned i;
+    
+    if ((int)(now - b->start) < (int)t->span)
+        return;
+    steps = (now - b->start) / t->span;
+    if (steps > NONCE_BUCKETS)
+        steps = NONCE_BUCKETS;
+    for (i = 0; i < steps; i++) {
+        ccn_wrappedtime start = b->start + t->span;
+        t->cur = (t->cur + 1) % NONCE_BUCKETS;
+        t->gen++;
+        b = &t->b[t->cur];
+        t->n -= b->n;
+        bucket_clear(b);
+        b->start = (steps == NONCE_BUCKETS) ? now : start;
+        b->gen = t->gen;
+    }
+}
+
+/**
+ * Create a nonce table
+ *
+ * Nonces are remembered for at least lifetime ticks of wrapped time after
+ * they are last seen, and for less than lifetime plus one bucket span.
+ */
+struct ccnd_nonce_table *
+ccnd_nonce_table_create(unsigned lifetime, ccn_wrappedtime now,
+                        unsigned short seed[3])
+{
+    struct ccnd_nonce_table *t;
+    int i;
+    
+    t = calloc(1, sizeof(*t));
+    if (t == NULL)
+        return(NULL);
+    for (i = 0; i < 16; i++)
+        t->key[i] = nrand48(seed);
+    t->lifetime = lifetime;
+    t->span = (lifetime + NONCE_BUCKETS - 2) / (NONCE_BUCKETS - 1);
+    if (t->span == 0)
+        t->span = 1;
+    for (i = 0; i < NONCE_BUCKETS; i++) {
+        t->b[i].start = now;
+        t->b[i].arena = ccn_charbuf_create();
+        if (t->b[i].arena == NULL)
+            goto Bail;
+    }
+    if (filter_alloc(t, FILTER_MIN_BUCKETS) < 0)
+        goto Bail;
+    return(t);
+Bail:
+    ccnd_nonce_table_destroy(&t);
+    return(NULL);
+}
+
+void
+ccnd_nonce_table_destroy(struct ccnd_nonce_table **pt)
+{
+    struct ccnd_nonce_table *t = *pt;
+    int i;
+    
+    if (t == NULL)
+        return;
+    for (i = 0; i < NONCE_BUCKETS; i++) {
+        free(t->b[i].tab);
+        ccn_charbuf_destroy(&t->b[i].arena);
+    }
+    free(t->filter);
+    free(t);
+    *pt = NULL;
+}
+
+/**
+ * Check a nonce against the table, and record it
+ *
+ * The nonce is remembered anew from now, but keeps the faceid it was
+ * first seen with.
+ * @returns 0 if an unexpired duplicate was seen from another face,
+ *          1 if the nonce is new, or 2 if it was seen before on the face
+ *          given by faceid (which should be CCN_NO_FACEID if unknown).
+ */
+int
+ccnd_nonce_check(struct ccnd_nonce_table *t, ccn_wrappedtime now,
+                 const unsigned char *nonce, size_t size, unsigned faceid)
+{
+    struct nonce_bucket *b;
+    struct nonce_rec *r = NULL;
+    uint64_t hash;
+    unsigned i;
+    
+    nonce_rotate(t, now);
+    hash = siphash_2_4(nonce, size, t->key);
+    if (hash == 0)
+        hash = 1;
+    if (filter_contains(t, hash)) {
+        for (i = 0; i < NONCE_BUCKETS && r == NULL; i++) {
+            b = &t->b[(t->cur + NONCE_BUCKETS - i) % NONCE_BUCKETS];
+            /* Everything in this bucket was seen before its span ended */
+            if (i > 0 && (int)(now - (b->start + t->span + t->lifetime)) > 0)
+                break;
+            r = bucket_find(b, hash, nonce, size);
+        }
+    }
+    b = &t->b[t->cur];
+    if (r == NULL) {
+        if (bucket_add(b, hash, nonce, size, faceid) != NULL) {
+            t->n++;
+            filter_insert(t, hash);
+        }
+        return(1);
+    }
+    if (i > 1) {
+        /* Refresh it by copying it into the current bucket */
+        if (bucket_add(b, hash, nonce, size, r->faceid) != NULL) {
+            t->n++;
+            filter_insert(t, hash);
+        }
+    }
+    if (faceid != CCN_NO_FACEID && faceid == r->faceid)
+        return(2);
+    return(0);
+}
+
+/**
+ * Get the number of nonces in the table
+ *
+ * A nonce that has been refreshed may be counted more than once.
+ */
+int
+ccnd_nonce_table_n(struct ccnd_nonce_table *t)
+{
+    return(t->n);
+}
+
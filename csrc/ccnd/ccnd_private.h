@@ -32,6 +32,7 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 
+#include <ccn/ccn.h>
 #include <ccn/ccn_private.h>
 #include <ccn/coding.h>
 #include <ccn/nametree.h>
@@ -48,6 +49,7 @@
  */
 struct ccn_charbuf;
 struct ccn_indexbuf;
+struct ccn_parsed_interest;
 struct hashtb;
 struct ccnd_meter;
 
@@ -61,24 +63,57 @@ struct nameprefix_entry;
 struct interest_entry;
 struct guest_entry;
 struct ccn_forwarding;
+struct epoll_event;
+struct dgram_batch;
+struct ccnd_outq;
+struct ccnd_reasm;
+struct ccnd_link_arq;
+struct ccnd_pktbuf;
+struct cs_policy_class;
+struct cs_policy_state;
+struct cs_admit_filter;
+struct cs_tier;
+struct ccnd_lpm;
+struct ccnd_nonce_table;
 typedef int (*ccnd_logger)(void *loggerdata, const char *format, va_list ap);
 
-/* see nonce_entry */
-struct ncelinks {
-    struct ncelinks *next;           /**< next in list */
-    struct ncelinks *prev;           /**< previous in list */
+/**
+ * One size class of the slab allocator
+ *
+ * The small objects that come and go with each packet (nametree entries
+ * for the content store, PIT and nonce table entries, pit face items)
+ * are carved out of large slabs and recycled through a free list per
+ * size class, rather than going through malloc each time.
+ */
+struct ccnd_slab_class {
+    unsigned size;                  /**< object size, including header */
+    unsigned nslabs;                /**< number of slabs for this class */
+    unsigned inuse;                 /**< objects currently allocated */
+    unsigned nfree;                 /**< objects on the free list */
+    void *freelist;                 /**< recycled objects */
+    unsigned char *next;            /**< uncarved part of newest slab */
+    unsigned char *limit;           /**< end of newest slab */
 };
+#define CCND_SLAB_NCLASS 10
 
 /**
  * We pass this handle almost everywhere within ccnd
+ *
+ * Everything reachable from the handle is owned by the single thread
+ * running ccnd_run(); none of it is protected by locks.  The tables are
+ * also cross-linked (PIT entries point at nameprefix entries and faces,
+ * content queues hold accessions into the content_tree, strategies and
+ * the internal client reach back into all of them), so they cannot be
+ * split among threads piecemeal.
  */
 struct ccnd_handle {
     unsigned char ccnd_id[32];      /**< sha256 digest of our public key */
-    struct hashtb *nonce_tab;       /**< keyed by interest Nonce */
+    struct ccnd_nonce_table *nonce_tab; /**< recently seen interest nonces */
     struct hashtb *faces_by_fd;     /**< keyed by fd */
     struct hashtb *dgram_faces;     /**< keyed by sockaddr */
     struct hashtb *faceid_by_guid;  /**< keyed by guid */
     struct hashtb *nameprefix_tab;  /**< keyed by name prefix components */
+    struct ccnd_lpm *nameprefix_index; /**< children of nameprefix entries */
     struct hashtb *interest_tab;    /**< keyed by interest msg sans Nonce */
     struct hashtb *guest_tab;       /**< keyed by faceid */
     struct hashtb *faceattr_index_tab; /**< keyed by faceattr name */
@@ -89,16 +124,39 @@ struct ccnd_handle {
     unsigned face_rover;            /**< for faceid allocation */
     unsigned face_limit;            /**< current number of face slots */
     struct face **faces_by_faceid;  /**< array with face_limit elements */
-    struct ncelinks ncehead;        /**< list head for expiry-sorted nonces */
     struct ccn_scheduled_event *reaper;
     struct ccn_scheduled_event *age;
     struct ccn_scheduled_event *clean;
     struct ccn_scheduled_event *age_forwarding;
+    int reap_phase;                 /**< what the reaper is working on */
+    ccn_wrappedtime reap_started;   /**< when the reaper's pass began */
+    unsigned dgram_faces_pos;       /**< where reaper left off in dgram_faces */
+    unsigned nameprefix_pos;        /**< and in nameprefix_tab */
+    unsigned age_forwarding_pos;    /**< where age_forwarding left off */
+    unsigned age_forwarding_pass;   /**< counts age_forwarding passes */
+    ccn_wrappedtime age_forwarding_started; /**< when its pass began */
+    int age_forwarding_secs;        /**< seconds to age entries this pass */
+    unsigned long housekeeping_max_usec; /**< longest housekeeping slice */
     const char *portstr;            /**< "main" port number */
     unsigned ipv4_faceid;           /**< wildcard IPv4, bound to port */
     unsigned ipv6_faceid;           /**< wildcard IPv6, bound to port */
     nfds_t nfds;                    /**< number of entries in fds array */
     struct pollfd *fds;             /**< used for poll system call */
+    int epfd;                       /**< epoll instance, or -1 to use poll */
+    int nevents;                    /**< number of entries in events array */
+    struct epoll_event *events;     /**< used for epoll_wait system call */
+    struct ccn_indexbuf *dgram_flush; /**< faceids with queued datagrams */
+    struct ccn_indexbuf *input_backlog; /**< faceids with input left over */
+    unsigned input_pass;            /**< counts passes through main loop */
+    int input_busy;                 /**< input was left waiting this pass */
+    int input_behind;               /**< input has been backing up */
+    unsigned input_behind_since;    /**< when it started, see cq_usec */
+    int overload;                   /**< 1 to shed from strangers, 2 neighbors too */
+    unsigned overload_usec;         /**< tunable, CCND_OVERLOAD_MICROSEC */
+    struct ccnd_slab_class slab[CCND_SLAB_NCLASS]; /**< slab allocator */
+    void *slabs;                    /**< chain of all slabs, for freeing */
+    unsigned slab_bytes;            /**< size of each slab */
+    unsigned slab_large;            /**< live objects too big for a slab */
     struct ccn_gettime ticktock;    /**< our time generator */
     long sec;                       /**< cached gettime seconds */
     unsigned usec;                  /**< cached gettime microseconds */
@@ -113,9 +171,24 @@ struct ccnd_handle {
     struct ccn_charbuf *scratch_charbuf; /**< one-slot scratch cache */
     struct ccn_indexbuf *scratch_indexbuf; /**< one-slot scratch cache */
     struct ccn_nametree *content_tree; /**< content store */
+    struct hashtb *content_by_name; /**< exact-name index of content_tree */
     struct content_entry *headx;    /**< list head for expiry queue */
     unsigned capacity;              /**< may toss content if there more than
                                      this many content objects in the store */
+    unsigned long long cap_bytes;   /**< likewise, for bytes of memory used */
+    unsigned long long cs_bytes;    /**< memory charged to the content store */
+    unsigned long long cs_bytes_peak; /**< high-water mark of cs_bytes */
+    const struct cs_policy_class *cs_policy; /**< replacement policy */
+    struct cs_policy_state *cs_state; /**< private to the policy */
+    struct cs_admit_filter *cs_admit; /**< admission filter, or NULL */
+    unsigned long cs_lookups;       /**< interests that searched the store */
+    unsigned long cs_hits;          /**< ... and found a match there */
+    unsigned long cs_evicted;       /**< content evicted by the policy */
+    unsigned long cs_rejected;      /**< new content not admitted */
+    struct cs_tier *cs_tier;        /**< on-disk content store tier, or NULL */
+    unsigned long cs_spilled;       /**< evicted content copied to the tier */
+    unsigned long cs_tier_hits;     /**< content brought back from the tier */
+    const char *cs_snapshot;        /**< content store snapshot file */
     struct ccn_nametree *ex_index;  /**< for speedy adds to expiry queue */
     unsigned long accessioned;
     unsigned long oldformatcontent;
@@ -129,6 +202,7 @@ struct ccnd_handle {
     unsigned long interests_dropped;
     unsigned long interests_sent;
     unsigned long interests_stuffed;
+    unsigned long interests_shed;   /**< dropped because of overload */
     unsigned short seed[3];         /**< for PRNG */
     int running;                    /**< true while should be running */
     int debug;                      /**< For controlling debug output */
@@ -151,6 +225,9 @@ struct ccnd_handle {
     struct ccn_scheduled_event *internal_client_refresh;
     struct ccn_scheduled_event *notice_push;
     unsigned data_pause_microsec;   /**< tunable, see choose_face_delay() */
+    unsigned pack_microsec;         /**< tunable, longest wait to fill a packed datagram */
+    int link_ack;                   /**< tunable, acknowledge and retransmit on datagram links */
+    unsigned aqm_target_usec;       /**< tunable, content queue delay target (0 disables) */
     int (*noncegen)(struct ccnd_handle *, struct face *, unsigned char *);
                                     /**< pluggable nonce generation */
     int tts_default;                /**< CCND_DEFAULT_TIME_TO_STALE (seconds) */
@@ -175,7 +252,13 @@ struct content_queue {
     unsigned ready;                  /**< # that have waited enough */
     unsigned nrun;                   /**< # sent since last randomized delay */
     struct ccn_indexbuf *send_queue; /**< accession numbers of pending content */
+    struct ccn_indexbuf *enq_usec;   /**< when each was queued, in parallel */
     struct ccn_scheduled_event *sender;
+    unsigned sojourn_usec;           /**< smoothed time spent in queue */
+    unsigned first_above;            /**< when delay may be called persistent */
+    unsigned drop_next;              /**< time of the next drop */
+    unsigned drop_count;             /**< drops in the current dropping state */
+    int dropping;                    /**< set while delay is persistently high */
 };
 
 enum cq_delay_class {
@@ -213,8 +296,10 @@ struct face {
     struct content_queue *q[CCN_CQ_N]; /**< outgoing content, per delay class */
     struct ccn_charbuf *inbuf;
     struct ccn_skeleton_decoder decoder;
-    size_t outbufindex;
-    struct ccn_charbuf *outbuf;
+    size_t deficit;             /**< input bytes allowed this pass */
+    unsigned input_pass;        /**< h->input_pass when deficit was topped up */
+    int backlogged;             /**< complete messages are left in inbuf */
+    struct ccnd_outq *outq;     /**< output waiting for the socket */
     const struct sockaddr *addr;
     socklen_t addrlen;
     int pending_interests;      /**< received and not yet consumed */
@@ -226,7 +311,23 @@ struct face {
     unsigned *lfaceattrs;       /**< storage for large face attributes */
     struct ccnd_meter *meter[CCND_FACE_METER_N];
     unsigned short pktseq;      /**< sequence number for sent packets */
+    unsigned frag_mtu;          /**< nonzero if the other side reassembles */
+    struct ccnd_reasm *reasm;   /**< fragmented messages coming in */
+    int pduseq_ok;              /**< set if pduseq is from the current PDU */
+    uintmax_t pduseq;           /**< SequenceNumber of the current PDU */
+    unsigned long pkts_lost;    /**< gaps in the received sequence */
+    unsigned long reasm_lost;   /**< fragmented messages not reassembled */
+    struct ccnd_link_arq *arq;  /**< link acknowledgement state */
+    unsigned long rtx_sent;     /**< datagrams retransmitted */
+    unsigned long rtx_lost;     /**< datagrams never acknowledged */
+    unsigned long cq_drops;     /**< content dropped by queue management */
+    unsigned pace_nsec;         /**< measured nsec per KByte, for pacing content */
     unsigned short adjstate;    /**< state of adjacency negotiotiation */
+    short pollevents;           /**< events registered for recv_fd */
+    struct dgram_batch *batch;  /**< batched datagram i/o on our socket */
+    struct ccn_charbuf *pack;   /**< small messages waiting to share a datagram */
+    int pack_n;                 /**< number of messages in pack */
+    struct ccn_scheduled_event *pack_ev; /**< sends pack when time is up */
 };
 
 /** face flags */
@@ -253,6 +354,7 @@ struct face {
 #define CCN_FACE_BC    (1 << 20) /** Needs SO_BROADCAST to send */
 #define CCN_FACE_NBC   (1 << 21) /** Don't use SO_BROADCAST to send */
 #define CCN_FACE_ADJ   (1 << 22) /** Adjacency guid has been negotiatied */
+#define CCN_FACE_ACKOK (1 << 23) /** Other side acknowledges our packets */
 
 /**
  *  Entry in faceattr_index_tab
@@ -272,6 +374,43 @@ struct faceattr_index_entry {
     int fa_index;       /**< index for accessing faceattr value */
 };
 
+/**
+ * A reference-counted buffer holding encoded messages.
+ *
+ * The content store keeps each ContentObject in one of these, so that
+ * output queues can refer to it without making a copy.
+ */
+struct ccnd_pktbuf {
+    int refs;                   /**< number of holders */
+    size_t size;                /**< allocated size of buf */
+    unsigned char buf[1];       /**< the data (flex array) */
+};
+
+/**
+ * Content store replacement policy
+ *
+ * A policy keeps its own ordering of the content in the store, using
+ * the cs fields of the content_entry, and nominates content for eviction
+ * when the store is over its limits.  The policies are implemented
+ * in ccnd_cspolicy.c, and are selected by CCND_CS_POLICY.
+ */
+struct cs_policy_class {
+    const char *id;             /**< name used to select the policy */
+    int (*init)(struct ccnd_handle *h);
+    void (*finalize)(struct ccnd_handle *h);
+    /** New content has entered the store */
+    void (*insert)(struct ccnd_handle *h, struct content_entry *content);
+    /** Content has satisfied an interest from the store */
+    void (*hit)(struct ccnd_handle *h, struct content_entry *content);
+    /** Content is being sent (recency only, not a repeat access) */
+    void (*touch)(struct ccnd_handle *h, struct content_entry *content);
+    /** Content is leaving the store */
+    void (*remove)(struct ccnd_handle *h, struct content_entry *content);
+    /** Nominate unqueued content for eviction, or return NULL;
+        if peek is nonzero, leave the policy state alone */
+    struct content_entry *(*victim)(struct ccnd_handle *h, int peek);
+};
+
 /**
  * Content table entry
  *
@@ -285,10 +424,28 @@ struct content_entry {
     short ncomps;               /**< Number of name components plus one */
     int flags;                  /**< see defines below */
     unsigned char *ccnb;        /**< ccnb-encoded ContentObject */
+    struct ccnd_pktbuf *pkt;    /**< storage for ccnb and nametree key */
     int size;                   /**< Size of ContentObject */
     int staletime;              /**< Time in seconds, relative to starttime */
     struct content_entry *nextx; /**< Next to expire after us */
     struct content_entry *prevx; /**< Expiry doubly linked for fast removal */
+    struct content_entry *csnext; /**< for use by the replacement policy */
+    struct content_entry *csprev; /**< for use by the replacement policy */
+    int csflags;                /**< for use by the replacement policy */
+};
+
+/**
+ * Content found in the on-disk tier of the content store
+ *
+ * The pointers refer to the mapped cache file, and are only good until
+ * the next change to the tier.
+ */
+struct cs_tier_hit {
+    const unsigned char *ccnb;  /**< ccnb-encoded ContentObject */
+    size_t size;                /**< size of ccnb */
+    const unsigned char *key;   /**< flatname, including the digest */
+    size_t keysize;             /**< size of key */
+    int freshness;              /**< seconds until stale, may be negative */
 };
 
 /**
@@ -317,18 +474,22 @@ struct interest_entry {
     struct ccn_scheduled_event *ev; /**< next interest timeout */    
     const unsigned char *interest_msg; /**< pending interest message */
     unsigned size;                  /**< size of interest message */
+    struct ccnd_pktbuf *pkt;        /**< copy of interest_msg for queues */
+    struct ccn_parsed_interest pi;  /**< parse of interest_msg */
+    struct ccn_exclusion *excl;     /**< compiled Exclude, or NULL */
     unsigned serial;                /**< used for logging */
 };
 
 /**
- * The nonce hash table is keyed by the interest nonce
+ * The exact-name index of the content store is keyed by the flatname
+ * of the content name, without the implicit digest component.
+ *
+ * Usually there is just one content object with a given name.  If there
+ * are several, content may be NULL and the content tree must be searched.
  */
-struct nonce_entry {
-    struct ncelinks ll;             /** doubly-linked */
-    const unsigned char *key;       /** owned by hashtb */
-    unsigned size;                  /** size of key */
-    unsigned faceid;                /** originating face */
-    ccn_wrappedtime expiry;         /** when this should expire */
+struct content_name_entry {
+    struct content_entry *content;  /**< the content, if known and unique */
+    unsigned n;                     /**< number of objects with this name */
 };
 
 /**
@@ -354,6 +515,8 @@ struct nameprefix_entry {
     int children;                /**< number of children */
     unsigned flags;              /**< CCN_FORW_* flags about namespace */
     int fgen;                    /**< to decide when cached fields are stale */
+    int fchg;                    /**< forward_to_gen when forwarding changed */
+    unsigned age_pass;           /**< last age_forwarding pass to visit */
     struct strategy_instance *si;/**< explicit strategy for this prefix */
     struct nameprefix_state sst; /**< used by strategy layer */
 };
@@ -467,6 +630,14 @@ int ccnd_req_unreg(struct ccnd_handle *h,
                    const unsigned char *msg, size_t size,
                    struct ccn_charbuf *reply_body);
 
+/*
+ * The internal client calls this with the argument portion ARG of
+ * a bulk registration request (/ccnx/CCNDID/bulkreg/ARG)
+ */
+int ccnd_req_bulkreg(struct ccnd_handle *h,
+                     const unsigned char *msg, size_t size,
+                     struct ccn_charbuf *reply_body);
+
 int ccnd_reg_uri(struct ccnd_handle *h,
                  const char *uri,
                  unsigned faceid,
@@ -504,11 +675,67 @@ void ccnd_internal_client_has_somthing_to_say(struct ccnd_handle *h);
 struct face *ccnd_face_from_faceid(struct ccnd_handle *, unsigned);
 void ccnd_face_status_change(struct ccnd_handle *, unsigned);
 int ccnd_destroy_face(struct ccnd_handle *h, unsigned faceid);
+void ccnd_face_events_changed(struct ccnd_handle *h, struct face *face);
 void ccnd_send(struct ccnd_handle *h, struct face *face,
                const void *data, size_t size);
 
 int ccnd_n_stale(struct ccnd_handle *h);
 
+/* Content store replacement policy, in ccnd_cspolicy.c */
+int ccnd_cs_policy_init(struct ccnd_handle *h, const char *policy,
+                        const char *admit);
+void ccnd_cs_policy_finalize(struct ccnd_handle *h);
+const char *ccnd_cs_policy_name(struct ccnd_handle *h);
+void ccnd_cs_insert(struct ccnd_handle *h, struct content_entry *content);
+void ccnd_cs_hit(struct ccnd_handle *h, struct content_entry *content);
+void ccnd_cs_touch(struct ccnd_handle *h, struct content_entry *content);
+void ccnd_cs_remove(struct ccnd_handle *h, struct content_entry *content);
+struct content_entry *ccnd_cs_victim(struct ccnd_handle *h);
+void ccnd_cs_record(struct ccnd_handle *h, const unsigned char *flatname,
+                    size_t size);
+int ccnd_cs_admit(struct ccnd_handle *h, struct content_entry *content);
+
+/* On-disk content store tier, in ccnd_cstier.c */
+int ccnd_cs_tier_init(struct ccnd_handle *h, const char *path,
+                      unsigned long long size);
+void ccnd_cs_tier_finalize(struct ccnd_handle *h);
+int ccnd_cs_tier_spill(struct ccnd_handle *h,
+                       const unsigned char *key, size_t keysize,
+                       const unsigned char *ccnb, size_t size, int freshness);
+int ccnd_cs_tier_lookup(struct ccnd_handle *h,
+                        const unsigned char *msg, size_t size,
+                        const struct ccn_parsed_interest *pi,
+                        const struct ccn_exclusion *excl,
+                        const struct ccn_charbuf *flatname,
+                        struct cs_tier_hit *hit);
+void ccnd_cs_tier_drop(struct ccnd_handle *h, const struct cs_tier_hit *hit);
+int ccnd_cs_tier_n(struct ccnd_handle *h);
+unsigned long long ccnd_cs_tier_bytes(struct ccnd_handle *h);
+unsigned long long ccnd_cs_tier_size(struct ccnd_handle *h);
+
+/* Longest-prefix match index, in ccnd_lpm.c */
+struct ccnd_lpm *ccnd_lpm_create(void);
+void ccnd_lpm_destroy(struct ccnd_lpm **plpm);
+void *ccnd_lpm_child(struct ccnd_lpm *lpm, const void *parent,
+                     const unsigned char *comp, size_t size);
+int ccnd_lpm_link(struct ccnd_lpm *lpm, const void *parent,
+                  const unsigned char *comp, size_t size, void *child);
+void ccnd_lpm_unlink(struct ccnd_lpm *lpm, const void *parent,
+                     const unsigned char *comp, size_t size);
+void *ccnd_lpm_match(struct ccnd_lpm *lpm, void *root,
+                     const unsigned char *flatname, size_t size, int *pncomps);
+int ccnd_lpm_n(struct ccnd_lpm *lpm);
+
+/* Table of recently seen interest nonces, in ccnd_nonce.c */
+struct ccnd_nonce_table *ccnd_nonce_table_create(unsigned lifetime,
+                                                 ccn_wrappedtime now,
+                                                 unsigned short seed[3]);
+void ccnd_nonce_table_destroy(struct ccnd_nonce_table **pt);
+int ccnd_nonce_check(struct ccnd_nonce_table *t, ccn_wrappedtime now,
+                     const unsigned char *nonce, size_t size,
+                     unsigned faceid);
+int ccnd_nonce_table_n(struct ccnd_nonce_table *t);
+
 /* Consider a separate header for these */
 int ccnd_stats_handle_http_connection(struct ccnd_handle *, struct face *);
 void ccnd_msg(struct ccnd_handle *, const char *, ...);
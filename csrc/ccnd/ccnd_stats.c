@@ -147,6 +147,7 @@ ccnd_stats_handle_http_connection(struct ccnd_handle *h, struct face *face)
     else
         ccnd_send(h, face, resp405, strlen(resp405));
     face->flags |= (CCN_FACE_NOSEND | CCN_FACE_CLOSING);
+    ccnd_face_events_changed(h, face);
     ccn_charbuf_destroy(&response);
     return(0);
 }
@@ -212,12 +213,39 @@ ccnd_collect_stats(struct ccnd_handle *h, struct ccnd_stats *ans)
 
 /* HTML formatting */
 
+/**
+ * Summarize the content queues of a face
+ *
+ * @returns the largest smoothed queueing delay, in microseconds, of the
+ *          queues that have content waiting, and stores the number of
+ *          queued items through queued.
+ */
+static unsigned
+face_queue_delay(struct face *face, int *queued)
+{
+    unsigned delay = 0;
+    int c;
+    
+    *queued = 0;
+    for (c = 0; c < CCN_CQ_N; c++) {
+        struct content_queue *q = face->q[c];
+        if (q == NULL || q->send_queue->n == 0)
+            continue;
+        *queued += q->send_queue->n;
+        if (q->sojourn_usec > delay)
+            delay = q->sojourn_usec;
+    }
+    return(delay);
+}
+
 static void
 collect_faces_html(struct ccnd_handle *h, struct ccn_charbuf *b)
 {
     int i;
     struct ccn_charbuf *nodebuf;
     int port;
+    int queued;
+    unsigned delay;
     
     nodebuf = ccn_charbuf_create();
     ccn_charbuf_putf(b, "<h4>Faces</h4>" NL);
@@ -256,6 +284,18 @@ collect_faces_html(struct ccnd_handle *h, struct ccn_charbuf *b)
                     face->sendface != CCN_NOFACEID)
                     ccn_charbuf_putf(b, " <b>via:</b> %u", face->sendface);
             }
+            if ((face->flags & CCN_FACE_SEQOK) != 0 &&
+                (face->pkts_lost | face->reasm_lost) != 0)
+                ccn_charbuf_putf(b, " <b>lost:</b> %lu packets, %lu fragmented",
+                                 face->pkts_lost, face->reasm_lost);
+            if ((face->flags & CCN_FACE_ACKOK) != 0 && face->rtx_sent != 0)
+                ccn_charbuf_putf(b, " <b>resent:</b> %lu, %lu unrecovered",
+                                 face->rtx_sent, face->rtx_lost);
+            delay = face_queue_delay(face, &queued);
+            if ((delay | queued | face->cq_drops) != 0)
+                ccn_charbuf_putf(b, " <b>content queued:</b> %d,"
+                                 " %u usec delay, %lu dropped",
+                                 queued, delay, face->cq_drops);
             ccn_charbuf_putf(b, "</li>" NL);
         }
     }
@@ -341,6 +381,45 @@ collect_forwarding_html(struct ccnd_handle *h, struct ccn_charbuf *b)
     ccn_charbuf_putf(b, "</ul>");
 }
 
+static void
+collect_slabs_html(struct ccnd_handle *h, struct ccn_charbuf *b)
+{
+    struct ccnd_slab_class *c;
+    int i;
+    
+    ccn_charbuf_putf(b, "<h4>Slab Allocator</h4>");
+    ccn_charbuf_putf(b, "<table cellspacing='0' cellpadding='0' class='tbl' summary='slab occupancy'>");
+    ccn_charbuf_putf(b, "<tbody>" NL);
+    ccn_charbuf_putf(b, " <tr><td>Object size</td>\t"
+                        " <td>Slabs</td>\t"
+                        " <td>In use</td>\t"
+                        " <td>Free</td></tr>" NL);
+    for (i = 0; i < CCND_SLAB_NCLASS; i++) {
+        c = &h->slab[i];
+        if (c->nslabs == 0)
+            continue;
+        ccn_charbuf_putf(b, " <tr><td>%u</td>\t<td>%u</td>\t"
+                            "<td>%u</td>\t<td>%u</td></tr>" NL,
+                         c->size, c->nslabs, c->inuse, c->nfree);
+    }
+    ccn_charbuf_putf(b, " <tr><td>larger</td>\t<td></td>\t"
+                        "<td>%u</td>\t<td></td></tr>" NL, h->slab_large);
+    ccn_charbuf_putf(b, "</tbody>");
+    ccn_charbuf_putf(b, "</table>");
+}
+
+static void
+collect_cs_tier_html(struct ccnd_handle *h, struct ccn_charbuf *b)
+{
+    if (h->cs_tier == NULL)
+        return;
+    ccn_charbuf_putf(b,
+                     "<div><b>Content store tier:</b> %llu bytes, %d stored,"
+                     " %llu bytes used, %lu spilled, %lu hits</div>" NL,
+                     ccnd_cs_tier_size(h), ccnd_cs_tier_n(h),
+                     ccnd_cs_tier_bytes(h), h->cs_spilled, h->cs_tier_hits);
+}
+
 static unsigned
 ccnd_colorhash(struct ccnd_handle *h)
 {
@@ -391,10 +470,12 @@ collect_stats_html(struct ccnd_handle *h)
         "<p class='header'>%s ccnd[%d] local port %s api %d start %ld.%06u now %ld.%06u</p>" NL
         "<div><b>Content items:</b> %llu accessioned,"
         " %d stored, %d stale, %d sparse, %lu duplicate, %lu sent</div>" NL
+        "<div><b>Content store:</b> %llu bytes, %llu peak,"
+        " %s policy, %lu lookups, %lu hits, %lu evicted, %lu rejected</div>" NL
         "<div><b>Interests:</b> %d names,"
         " %ld pending, %d propagating, %d noted</div>" NL
         "<div><b>Interest totals:</b> %lu accepted,"
-        " %lu dropped, %lu sent, %lu stuffed</div>" NL,
+        " %lu dropped, %lu sent, %lu stuffed, %lu shed</div>" NL,
         un.nodename,
         pid,
         ccnd_colorhash(h),
@@ -411,18 +492,26 @@ collect_stats_html(struct ccnd_handle *h)
         0,
         h->content_dups_recvd,
         h->content_items_sent,
+        h->cs_bytes, h->cs_bytes_peak,
+        ccnd_cs_policy_name(h), h->cs_lookups, h->cs_hits,
+        h->cs_evicted, h->cs_rejected,
         hashtb_n(h->nameprefix_tab), stats.total_interest_counts,
         hashtb_n(h->interest_tab),
-        hashtb_n(h->nonce_tab),
+        ccnd_nonce_table_n(h->nonce_tab),
         h->interests_accepted, h->interests_dropped,
-        h->interests_sent, h->interests_stuffed);
+        h->interests_sent, h->interests_stuffed, h->interests_shed);
     if (0)
         ccn_charbuf_putf(b,
                          "<div><b>Active faces and listeners:</b> %d</div>" NL,
                          hashtb_n(h->faces_by_fd) + hashtb_n(h->dgram_faces));
+    collect_cs_tier_html(h, b);
     collect_faces_html(h, b);
     collect_face_meter_html(h, b);
     collect_forwarding_html(h, b);
+    collect_slabs_html(h, b);
+    ccn_charbuf_putf(b,
+        "<div><b>Housekeeping:</b> longest stall %lu usec</div>" NL,
+        h->housekeeping_max_usec);
     ccn_charbuf_putf(b,
         "</body>"
         "</html>" NL);
@@ -451,6 +540,8 @@ collect_faces_xml(struct ccnd_handle *h, struct ccn_charbuf *b)
     int i;
     int m;
     int port;
+    int queued;
+    unsigned delay;
     struct ccn_charbuf *nodebuf;
     
     nodebuf = ccn_charbuf_create();
@@ -476,6 +567,20 @@ collect_faces_xml(struct ccnd_handle *h, struct ccn_charbuf *b)
             if (face->sendface != face->faceid &&
                 face->sendface != CCN_NOFACEID)
                 ccn_charbuf_putf(b, "<via>%u</via>", face->sendface);
+            if ((face->flags & CCN_FACE_SEQOK) != 0)
+                ccn_charbuf_putf(b, "<pktlost>%lu</pktlost>"
+                                 "<fraglost>%lu</fraglost>",
+                                 face->pkts_lost, face->reasm_lost);
+            if ((face->flags & CCN_FACE_ACKOK) != 0)
+                ccn_charbuf_putf(b, "<retransmits>%lu</retransmits>"
+                                 "<rtxlost>%lu</rtxlost>",
+                                 face->rtx_sent, face->rtx_lost);
+            delay = face_queue_delay(face, &queued);
+            if ((delay | queued | face->cq_drops) != 0)
+                ccn_charbuf_putf(b, "<cqueued>%d</cqueued>"
+                                 "<cqdelay>%u</cqdelay>"
+                                 "<cqdrops>%lu</cqdrops>",
+                                 queued, delay, face->cq_drops);
             if (face != NULL && (face->flags & CCN_FACE_PASSIVE) == 0) {
                 ccn_charbuf_putf(b, "<meters>");
                 for (m = 0; m < CCND_FACE_METER_N; m++)
@@ -534,6 +639,46 @@ collect_forwarding_xml(struct ccnd_handle *h, struct ccn_charbuf *b)
     ccn_charbuf_putf(b, "</forwarding>");
 }
 
+static void
+collect_cs_tier_xml(struct ccnd_handle *h, struct ccn_charbuf *b)
+{
+    if (h->cs_tier == NULL)
+        return;
+    ccn_charbuf_putf(b,
+                     "<cstier>"
+                     "<size>%llu</size>"
+                     "<stored>%d</stored>"
+                     "<bytes>%llu</bytes>"
+                     "<spilled>%lu</spilled>"
+                     "<hits>%lu</hits>"
+                     "</cstier>",
+                     ccnd_cs_tier_size(h), ccnd_cs_tier_n(h),
+                     ccnd_cs_tier_bytes(h), h->cs_spilled, h->cs_tier_hits);
+}
+
+static void
+collect_slabs_xml(struct ccnd_handle *h, struct ccn_charbuf *b)
+{
+    struct ccnd_slab_class *c;
+    int i;
+    
+    ccn_charbuf_putf(b, "<slabs><slabsize>%u</slabsize>", h->slab_bytes);
+    for (i = 0; i < CCND_SLAB_NCLASS; i++) {
+        c = &h->slab[i];
+        if (c->nslabs == 0)
+            continue;
+        ccn_charbuf_putf(b,
+                         "<class>"
+                         "<size>%u</size>"
+                         "<slabs>%u</slabs>"
+                         "<inuse>%u</inuse>"
+                         "<free>%u</free>"
+                         "</class>",
+                         c->size, c->nslabs, c->inuse, c->nfree);
+    }
+    ccn_charbuf_putf(b, "<large>%u</large></slabs>", h->slab_large);
+}
+
 static struct ccn_charbuf *
 collect_stats_xml(struct ccnd_handle *h)
 {
@@ -565,6 +710,13 @@ collect_stats_xml(struct ccnd_handle *h)
         "<sparse>%d</sparse>"
         "<duplicate>%lu</duplicate>"
         "<sent>%lu</sent>"
+        "<bytes>%llu</bytes>"
+        "<peakbytes>%llu</peakbytes>"
+        "<policy>%s</policy>"
+        "<lookups>%lu</lookups>"
+        "<hits>%lu</hits>"
+        "<evicted>%lu</evicted>"
+        "<rejected>%lu</rejected>"
         "</cobs>"
         "<interests>"
         "<names>%d</names>"
@@ -575,6 +727,7 @@ collect_stats_xml(struct ccnd_handle *h)
         "<dropped>%lu</dropped>"
         "<sent>%lu</sent>"
         "<stuffed>%lu</stuffed>"
+        "<shed>%lu</shed>"
         "</interests>",
         (unsigned long long)h->accessioned,
         (int)h->content_tree->n,
@@ -582,13 +735,20 @@ collect_stats_xml(struct ccnd_handle *h)
         0,
         h->content_dups_recvd,
         h->content_items_sent,
+        h->cs_bytes, h->cs_bytes_peak,
+        ccnd_cs_policy_name(h), h->cs_lookups, h->cs_hits,
+        h->cs_evicted, h->cs_rejected,
         hashtb_n(h->nameprefix_tab), stats.total_interest_counts,
         hashtb_n(h->interest_tab),
-        hashtb_n(h->nonce_tab),
+        ccnd_nonce_table_n(h->nonce_tab),
         h->interests_accepted, h->interests_dropped,
-        h->interests_sent, h->interests_stuffed);
+        h->interests_sent, h->interests_stuffed, h->interests_shed);
+    collect_cs_tier_xml(h, b);
     collect_faces_xml(h, b);
     collect_forwarding_xml(h, b);
+    collect_slabs_xml(h, b);
+    ccn_charbuf_putf(b, "<housekeeping><maxstall>%lu</maxstall></housekeeping>",
+                     h->housekeeping_max_usec);
     ccn_charbuf_putf(b, "</ccnd>" NL);
     return(b);
 }
@@ -31,6 +31,29 @@ ccnd_internal_client.o: ccnd_internal_client.c ../include/ccn/ccn.h \
   ../include/ccn/schedule.h ../include/ccn/sockaddrutil.h \
   ../include/ccn/uri.h ccnd_private.h ../include/ccn/nametree.h \
   ../include/ccn/reg_mgmt.h ../include/ccn/seqwriter.h ccnd_strategy.h
+ccnd_cspolicy.o: ccnd_cspolicy.c ../include/ccn/ccn.h \
+  ../include/ccn/coding.h ../include/ccn/charbuf.h \
+  ../include/ccn/indexbuf.h ../include/ccn/flatname.h \
+  ../include/ccn/hashtb.h ../include/ccn/nametree.h ccnd_private.h \
+  ../include/ccn/ccn_private.h ../include/ccn/reg_mgmt.h \
+  ../include/ccn/schedule.h ../include/ccn/seqwriter.h ccnd_strategy.h
+ccnd_cstier.o: ccnd_cstier.c ../include/ccn/ccn.h \
+  ../include/ccn/coding.h ../include/ccn/charbuf.h \
+  ../include/ccn/indexbuf.h ../include/ccn/flatname.h \
+  ../include/ccn/nametree.h ccnd_private.h ../include/ccn/ccn_private.h \
+  ../include/ccn/reg_mgmt.h ../include/ccn/schedule.h \
+  ../include/ccn/seqwriter.h ccnd_strategy.h
+ccnd_lpm.o: ccnd_lpm.c ../include/ccn/charbuf.h ../include/ccn/flatname.h \
+  ../include/ccn/hashtb.h ccnd_private.h ../include/ccn/ccn_private.h \
+  ../include/ccn/coding.h ../include/ccn/nametree.h \
+  ../include/ccn/reg_mgmt.h ../include/ccn/schedule.h \
+  ../include/ccn/seqwriter.h ccnd_strategy.h
+ccnd_nonce.o: ccnd_nonce.c ../include/ccn/ccn.h ../include/ccn/coding.h \
+  ../include/ccn/charbuf.h ../include/ccn/indexbuf.h \
+  ../include/ccn/face_mgmt.h ../include/ccn/siphash24.h ccnd_private.h \
+  ../include/ccn/ccn_private.h ../include/ccn/nametree.h \
+  ../include/ccn/reg_mgmt.h ../include/ccn/schedule.h \
+  ../include/ccn/seqwriter.h ccnd_strategy.h
 ccnd_stregistry.o: ccnd_stregistry.c ccnd_stregistry.h ccnd_strategy.h
 default_strategy.o: default_strategy.c ccnd_strategy.h ccnd_private.h \
   ../include/ccn/ccn_private.h ../include/ccn/coding.h \
@@ -49,3 +72,9 @@ faceattr_strategy.o: faceattr_strategy.c ../include/ccn/charbuf.h \
   ccnd_strategy.h
 ccndsmoketest.o: ccndsmoketest.c ../include/ccn/ccnd.h \
   ../include/ccn/ccn_private.h
+lpmbenchtest.o: lpmbenchtest.c ../include/ccn/ccn.h \
+  ../include/ccn/coding.h ../include/ccn/charbuf.h \
+  ../include/ccn/indexbuf.h ../include/ccn/flatname.h \
+  ../include/ccn/hashtb.h ccnd_private.h ../include/ccn/ccn_private.h \
+  ../include/ccn/nametree.h ../include/ccn/reg_mgmt.h \
+  ../include/ccn/schedule.h ../include/ccn/seqwriter.h ccnd_strategy.h
@@ -16,15 +16,16 @@ LDLIBS = -L$(CCNLIBDIR) $(MORE_LDLIBS) -lccn
 CCNLIBDIR = ../lib
 
 INSTALLED_PROGRAMS = ccnd ccndsmoketest 
-PROGRAMS = $(INSTALLED_PROGRAMS)
+PROGRAMS = $(INSTALLED_PROGRAMS) lpmbenchtest
 DEBRIS = anything.ccnb contentobjecthash.ccnb contentmishash.ccnb \
          contenthash.ccnb ccnd_stregistry.h
 
 BROKEN_PROGRAMS = 
 CSRC = ccnd_main.c \
        ccnd.c ccnd_msg.c ccnd_stats.c ccnd_internal_client.c ccnd_stregistry.c \
+       ccnd_cspolicy.c ccnd_cstier.c ccnd_lpm.c ccnd_nonce.c \
        $(STRATEGYSRC) \
-       ccndsmoketest.c
+       ccndsmoketest.c lpmbenchtest.c
 HSRC = ccnd_private.h ccnd_strategy.h
 SCRIPTSRC = testbasics fortunes.ccnb contentobjecthash.ref anything.ref \
             minsuffix.ref gen_stregistry.sh
@@ -42,6 +43,7 @@ $(PROGRAMS): $(CCNLIBDIR)/libccn.a
 
 # Leave main out of this list to make it easier to support the android build
 CCND_OBJ = ccnd.o ccnd_msg.o ccnd_stats.o ccnd_internal_client.o ccnd_stregistry.o \
+	ccnd_cspolicy.o ccnd_cstier.o ccnd_lpm.o ccnd_nonce.o \
 	$(STRATEGYSRC:.c=.o)
 
 ccnd: ccnd_main.o $(CCND_OBJ) ccnd_built.sh
@@ -54,6 +56,9 @@ ccnd_built.sh:
 ccndsmoketest: ccndsmoketest.o
 	$(CC) $(CFLAGS) -o $@ ccndsmoketest.o $(LDLIBS)
 
+lpmbenchtest: lpmbenchtest.o ccnd_lpm.o
+	$(CC) $(CFLAGS) -o $@ lpmbenchtest.o ccnd_lpm.o $(LDLIBS)
+
 ccnd_stregistry.h: gen_stregistry.sh $(CSRC)
 	$(SH) gen_stregistry.sh $(CSRC)
 
@@ -0,0 +1,251 @@
+/**
+ * @file lpmbenchtest.c
+ *
+ * Benchmark of longest-prefix match against a name prefix table.
+ *
+ * Compares the child index of ccnd_lpm.c, which walks a flatname one
+ * component at a time, with the older method of rebuilding the ccnb name
+ * and probing the prefix table once for each prefix length.
+ *
+ * Part of ccnd - the CCNx Daemon.
+ *
+ * Copyright (C) 2013 Palo Alto Research Center, Inc.
+ *
+ * This work is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 2 as published by the
+ * Free Software Foundation.
+ * This work is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details. You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <ccn/ccn.h>
+#include <ccn/charbuf.h>
+#include <ccn/flatname.h>
+#include <ccn/hashtb.h>
+#include <ccn/indexbuf.h>
+
+#include "ccnd_private.h"
+
+#define NPREFIXES 1000
+#define NNAMES 10000
+#define ROUNDS 20
+
+/** Stands in for a nameprefix_entry */
+struct bench_node {
+    struct bench_node *parent;
+    int ncomps;
+};
+
+static void
+usage(const char *progname)
+{
+    fprintf(stderr,
+            "%s [-p prefixes] [-n names] [-d depth]\n"
+            "Benchmark longest-prefix match of content names against "
+            "a name prefix table\n",
+            progname);
+    exit(1);
+}
+
+static void
+append_comp(struct ccn_charbuf *name, const char *fmt, unsigned v)
+{
+    char buf[40];
+    
+    snprintf(buf, sizeof(buf), fmt, v);
+    ccn_name_append_str(name, buf);
+}
+
+/**
+ * Make a random name of the given depth, in a namespace with some fanout
+ */
+static void
+make_name(struct ccn_charbuf *name, int depth)
+{
+    int i;
+    
+    ccn_name_init(name);
+    ccn_name_append_str(name, "bench");
+    for (i = 1; i < depth; i++)
+        append_comp(name, (i < 4) ? "node%u" : "segment-%08u",
+                    random() % (i < 4 ? 8 : 1000));
+}
+
+/**
+ * Enter every prefix of a name into the table and the index
+ */
+static void
+add_prefix(struct hashtb *tab, struct ccnd_lpm *lpm, struct ccn_charbuf *name)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct ccn_indexbuf *comps = ccn_indexbuf_create();
+    struct bench_node *parent = NULL;
+    struct bench_node *node = NULL;
+    const unsigned char *comp = NULL;
+    size_t compsize = 0;
+    size_t base;
+    int i;
+    int res;
+    
+    ccn_name_split(name, comps);
+    base = comps->buf[0];
+    hashtb_start(tab, e);
+    for (i = 0; i < comps->n; i++) {
+        res = hashtb_seek(e, name->buf + base, comps->buf[i] - base, 0);
+        node = e->data;
+        if (res == HT_NEW_ENTRY) {
+            node->parent = parent;
+            node->ncomps = i;
+            if (parent != NULL) {
+                ccn_ref_tagged_BLOB(CCN_DTAG_Component, name->buf,
+                                    comps->buf[i - 1], comps->buf[i],
+                                    &comp, &compsize);
+                ccnd_lpm_link(lpm, parent, comp, compsize, node);
+            }
+        }
+        parent = node;
+    }
+    hashtb_end(e);
+    ccn_indexbuf_destroy(&comps);
+}
+
+/**
+ * The method formerly used by match_interests
+ */
+static struct bench_node *
+lookup_by_probes(struct hashtb *tab, const unsigned char *flatname, size_t size,
+                 struct ccn_charbuf *name, struct ccn_indexbuf *comps)
+{
+    struct bench_node *node = NULL;
+    unsigned c0;
+    int ci;
+    
+    ccn_name_init(name);
+    ccn_name_append_flatname(name, flatname, size, 0, -1);
+    ccn_name_split(name, comps);
+    c0 = comps->buf[0];
+    for (ci = comps->n - 1; ci >= 0; ci--) {
+        node = hashtb_lookup(tab, name->buf + c0, comps->buf[ci] - c0);
+        if (node != NULL)
+            break;
+    }
+    return(node);
+}
+
+static double
+elapsed_ns(struct timeval *start, struct timeval *end, long count)
+{
+    double us;
+    
+    us = (end->tv_sec - start->tv_sec) * 1e6 + (end->tv_usec - start->tv_usec);
+    return(us * 1e3 / count);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *progname = argv[0];
+    struct hashtb *tab = NULL;
+    struct ccnd_lpm *lpm = NULL;
+    struct ccn_charbuf *name = ccn_charbuf_create();
+    struct ccn_charbuf *scratch = ccn_charbuf_create();
+    struct ccn_indexbuf *comps = ccn_indexbuf_create();
+    struct ccn_charbuf **flat = NULL;
+    struct bench_node *root = NULL;
+    struct bench_node *a = NULL;
+    struct bench_node *b = NULL;
+    struct timeval start, end;
+    unsigned char digest[32];
+    int nprefixes = NPREFIXES;
+    int nnames = NNAMES;
+    int depth = 12;
+    long sum = 0;
+    int i;
+    int r;
+    int res;
+    
+    while ((res = getopt(argc, argv, "hp:n:d:")) != -1) {
+        switch (res) {
+            case 'p':
+                nprefixes = atoi(optarg);
+                break;
+            case 'n':
+                nnames = atoi(optarg);
+                break;
+            case 'd':
+                depth = atoi(optarg);
+                break;
+            default:
+                usage(progname);
+        }
+    }
+    if (nprefixes < 1 || nnames < 1 || depth < 2)
+        usage(progname);
+    srandom(1);
+    tab = hashtb_create(sizeof(struct bench_node), NULL);
+    lpm = ccnd_lpm_create();
+    /* Registered prefixes are shorter than the content names */
+    for (i = 0; i < nprefixes; i++) {
+        make_name(name, 2 + random() % (depth / 2));
+        add_prefix(tab, lpm, name);
+    }
+    root = hashtb_lookup(tab, "", 0);
+    /* Content names, in flatname form, with an implicit digest at the end */
+    flat = calloc(nnames, sizeof(*flat));
+    for (i = 0; i < nnames; i++) {
+        make_name(name, depth);
+        for (r = 0; r < (int)sizeof(digest); r++)
+            digest[r] = random();
+        ccn_name_append(name, digest, sizeof(digest));
+        flat[i] = ccn_charbuf_create();
+        ccn_flatname_from_ccnb(flat[i], name->buf, name->length);
+    }
+    /* Both methods must agree */
+    for (i = 0; i < nnames; i++) {
+        a = lookup_by_probes(tab, flat[i]->buf, flat[i]->length, scratch, comps);
+        b = ccnd_lpm_match(lpm, root, flat[i]->buf, flat[i]->length, NULL);
+        if (a != b) {
+            fprintf(stderr, "%s: mismatch at name %d\n", progname, i);
+            exit(1);
+        }
+        sum += b->ncomps;
+    }
+    printf("%d prefix entries, %d names of %d components, "
+           "average match %.2f components\n",
+           hashtb_n(tab), nnames, depth + 1, (double)sum / nnames);
+    gettimeofday(&start, NULL);
+    for (r = 0; r < ROUNDS; r++)
+        for (i = 0; i < nnames; i++)
+            lookup_by_probes(tab, flat[i]->buf, flat[i]->length, scratch, comps);
+    gettimeofday(&end, NULL);
+    printf("rebuild and probe: %.0f ns per lookup\n",
+           elapsed_ns(&start, &end, (long)ROUNDS * nnames));
+    gettimeofday(&start, NULL);
+    for (r = 0; r < ROUNDS; r++)
+        for (i = 0; i < nnames; i++)
+            ccnd_lpm_match(lpm, root, flat[i]->buf, flat[i]->length, NULL);
+    gettimeofday(&end, NULL);
+    printf("child index walk:  %.0f ns per lookup\n",
+           elapsed_ns(&start, &end, (long)ROUNDS * nnames));
+    for (i = 0; i < nnames; i++)
+        ccn_charbuf_destroy(&flat[i]);
+    free(flat);
+    ccnd_lpm_destroy(&lpm);
+    hashtb_destroy(&tab);
+    ccn_charbuf_destroy(&name);
+    ccn_charbuf_destroy(&scratch);
+    ccn_indexbuf_destroy(&comps);
+    return(0);
+}
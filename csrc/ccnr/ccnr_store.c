@@ -928,6 +928,7 @@ static struct content_entry *
 r_store_lookup_backwards(struct ccnr_handle *h,
                          const unsigned char *interest_msg,
                          const struct ccn_parsed_interest *pi,
+                         const struct ccn_exclusion *excl,
                          struct ccn_indexbuf *comps)
 {
     struct content_entry *content = NULL;
@@ -987,7 +988,8 @@ r_store_lookup_backwards(struct ccnr_handle *h,
             }
         }
         else if (f->length < fsz) { errline = __LINE__; goto Done; }
-        res = ccn_btree_match_interest(leaf, ndx, interest_msg, pi, f);
+        res = ccn_btree_match_interest_excl(leaf, ndx, interest_msg, pi,
+                                            excl, f);
         if (res == 1) {
             res = ccn_btree_key_fetch(f, leaf, ndx);
             if (res < 0) { errline = __LINE__; goto Done; }
@@ -1110,13 +1112,20 @@ r_store_lookup(struct ccnr_handle *h,
     ccnr_cookie last_match = 0;
     ccnr_accession last_match_acc = CCNR_NULL_ACCESSION;
     struct ccn_charbuf *scratch = NULL;
+    struct ccn_exclusion *excl = NULL;
     size_t size = pi->offset[CCN_PI_E];
     int ndx;
     int res;
     int try;
     
+    /* Many candidates may be tested, so decode any Exclude just once */
+    if (pi->offset[CCN_PI_E_Exclude] > pi->offset[CCN_PI_B_Exclude])
+        excl = ccn_exclusion_compile(msg + pi->offset[CCN_PI_B_Exclude],
+                                     pi->offset[CCN_PI_E_Exclude] -
+                                     pi->offset[CCN_PI_B_Exclude]);
     if ((pi->orderpref & 1) == 1) {
-        content = r_store_lookup_backwards(h, msg, pi, comps);
+        content = r_store_lookup_backwards(h, msg, pi, excl, comps);
+        ccn_exclusion_destroy(&excl);
         return(content);
     }
     
@@ -1143,7 +1152,7 @@ r_store_lookup(struct ccnr_handle *h,
             break;
         }
         ndx = CCN_BT_SRCH_INDEX(res);
-        res = ccn_btree_match_interest(leaf, ndx, msg, pi, scratch);
+        res = ccn_btree_match_interest_excl(leaf, ndx, msg, pi, excl, scratch);
         if (res == -1) {
             ccnr_debug_ccnb(h, __LINE__, "match_error", NULL, msg, size);
             content = NULL;
@@ -1168,6 +1177,7 @@ r_store_lookup(struct ccnr_handle *h,
             content = r_store_content_from_accession(h, last_match_acc);
     }
     ccn_charbuf_destroy(&scratch);
+    ccn_exclusion_destroy(&excl);
     if (content != NULL) {
         h->count_lmc_found += 1;
         h->count_lmc_found_iters += try;
@@ -60,6 +60,13 @@ int ccn_btree_match_interest(struct ccn_btree_node *node, int ndx,
                              const struct ccn_parsed_interest *pi,
                              struct ccn_charbuf *scratch);
 
+/* Same, using a compiled Exclude if excl is not NULL. */
+int ccn_btree_match_interest_excl(struct ccn_btree_node *node, int ndx,
+                                  const unsigned char *interest_msg,
+                                  const struct ccn_parsed_interest *pi,
+                                  const struct ccn_exclusion *excl,
+                                  struct ccn_charbuf *scratch);
+
 /* Insert a ContentObject into a btree node */
 int ccn_btree_insert_content(struct ccn_btree_node *node, int ndx,
                              uint_least64_t cobid,
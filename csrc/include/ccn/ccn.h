@@ -928,6 +928,32 @@ int ccn_excluded(const unsigned char *excl,
                  const unsigned char *nextcomp,
                  size_t nextcomp_size);
 
+/*
+ * A compiled Exclude clause, for testing many names against one interest.
+ * Explicit components are found by binary search instead of by decoding
+ * the clause each time.
+ */
+struct ccn_exclusion;
+struct ccn_exclusion *ccn_exclusion_compile(const unsigned char *excl,
+                                            size_t excl_size);
+void ccn_exclusion_destroy(struct ccn_exclusion **px);
+int ccn_exclusion_match(const struct ccn_exclusion *x,
+                        const unsigned char *nextcomp,
+                        size_t nextcomp_size);
+
+/*
+ * ccn_content_matches_interest_excl: Like ccn_content_matches_interest,
+ * but if excl is not NULL it is used in place of the interest's Exclude.
+ */
+int ccn_content_matches_interest_excl(const unsigned char *content_object,
+                                      size_t content_object_size,
+                                      int implicit_content_digest,
+                                      struct ccn_parsed_ContentObject *pc,
+                                      const unsigned char *interest_msg,
+                                      size_t interest_msg_size,
+                                      const struct ccn_parsed_interest *pi,
+                                      const struct ccn_exclusion *excl);
+
 /***********************************
  * StatusResponse
  */
@@ -168,6 +168,11 @@ enum ccn_dtag {
     CCN_DTAG_StrategyID = 145,
     CCN_DTAG_StrategyParameters = 146,
     CCN_DTAG_SequenceNumber = 256,
+    CCN_DTAG_Fragment = 257,
+    CCN_DTAG_FragmentIndex = 258,
+    CCN_DTAG_FragmentCount = 259,
+    CCN_DTAG_LinkMTU = 260,
+    CCN_DTAG_LinkAck = 261,
     CCN_DTAG_CCNProtocolDataUnit = 17702112
 };
 
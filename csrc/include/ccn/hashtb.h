@@ -27,10 +27,15 @@
 struct hashtb; /* details are private to the implementation */
 struct hashtb_enumerator; /* more about this below */
 typedef void (*hashtb_finalize_proc)(struct hashtb_enumerator *);
+/* Optional node allocator; memory need not be zeroed. */
+typedef void *(*hashtb_alloc_proc)(struct hashtb *, size_t);
+typedef void (*hashtb_free_proc)(struct hashtb *, void *);
 struct hashtb_param {
     hashtb_finalize_proc finalize; /* default is NULL */
     void *finalize_data;           /* default is NULL */
     int orders;                    /* default is 0 */
+    hashtb_alloc_proc node_alloc;  /* default is NULL, meaning calloc */
+    hashtb_free_proc node_free;    /* must be set along with node_alloc */
 }; 
 
 /*
@@ -99,6 +104,24 @@ void hashtb_end(struct hashtb_enumerator *);
 
 void hashtb_next(struct hashtb_enumerator *);
 
+/*
+ * hashtb_start_at: like hashtb_start, but begins at a position
+ * previously obtained from hashtb_position.
+ * This allows a long enumeration to be done a piece at a time.
+ * Entries that share a position are always enumerated together, so a
+ * piece should end only where the position changes.
+ * If the table is rehashed between pieces, some entries may be
+ * skipped or visited twice.
+ */
+struct hashtb_enumerator *
+hashtb_start_at(struct hashtb *, struct hashtb_enumerator *, unsigned pos);
+
+/*
+ * hashtb_position: position of the current entry, for hashtb_start_at
+ * Returns -1 if the enumeration is at the end.
+ */
+int hashtb_position(struct hashtb_enumerator *);
+
 /*
  * hashtb_seek: Find or add an item
  * For a newly added item, the keysize bytes of key along
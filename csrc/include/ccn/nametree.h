@@ -52,6 +52,15 @@ typedef void (*ccn_nametree_action)(struct ccn_nametree *, struct ccny *);
 typedef int (*ccn_nametree_compare)(const unsigned char *, size_t,
                                     const unsigned char *, size_t);
 
+/**
+ *  Procedure types for optional client allocation of entries
+ *
+ * These are used only by ccny_create_in().  The memory returned by
+ * the allocator need not be zeroed.
+ */
+typedef void *(*ccn_nametree_alloc)(struct ccn_nametree *, size_t);
+typedef void (*ccn_nametree_free)(struct ccn_nametree *, void *);
+
 struct ccn_nametree {
     int n;                  /**< number of enrolled entries */
     int limit;              /**< recommended maximum n */
@@ -65,12 +74,16 @@ struct ccn_nametree {
     ccn_nametree_action pre_remove; /**< called before removal */
     ccn_nametree_action check; /**< called to check client structures */
     ccn_nametree_action finalize; /**< called from destroy */
+    ccn_nametree_alloc ccny_alloc; /**< allocates entries, if set */
+    ccn_nametree_free ccny_free; /**< frees entries from ccny_alloc */
 };
 
 struct ccn_nametree *ccn_nametree_create(int initial_limit);
 
 /* reasonably good random bits must be provided, crypto quality not needed */
 struct ccny *ccny_create(unsigned randombits, size_t payload_size);
+struct ccny *ccny_create_in(struct ccn_nametree *h,
+                            unsigned randombits, size_t payload_size);
 
 /* Consult the documentation about the difference between the next two */
 int ccny_set_key(struct ccny *y, const unsigned char *key, size_t size);
@@ -98,6 +111,9 @@ int ccn_nametree_grow(struct ccn_nametree *h);
 /* Consult documentation about the return value to avoid surprises */
 ccn_cookie ccny_enroll(struct ccn_nametree *h, struct ccny *y);
 
+/* Enroll entries in bulk, in key order */
+int ccn_nametree_append(struct ccn_nametree *h, struct ccny **v, int n);
+
 void ccny_remove(struct ccn_nametree *h, struct ccny *y);
 
 void ccny_destroy(struct ccn_nametree *h, struct ccny **py);
@@ -114,6 +130,7 @@ void *ccny_payload(struct ccny *y);
 void ccny_set_payload(struct ccny *y, void *payload);
 const unsigned char *ccny_key(struct ccny *y);
 unsigned ccny_keylen(struct ccny *y);
+size_t ccny_overhead(struct ccny *y);
 unsigned ccny_info(struct ccny *y);
 void ccny_set_info(struct ccny *y, unsigned info);
 struct ccny *ccn_nametree_first(struct ccn_nametree *h);
@@ -71,6 +71,8 @@ struct ccn_scheduled_event {
 
 /*
  * Create and destroy
+ * Events are kept in a heap, or in a hierarchical timing wheel if
+ * CCN_SCHEDULE=wheel is set in the environment.
  */
 struct ccn_schedule *ccn_schedule_create(void *clienth,
                                          const struct ccn_gettime *ccnclock);
@@ -143,6 +143,35 @@ ccn_btree_match_interest(struct ccn_btree_node *node, int ndx,
                          const unsigned char *interest_msg,
                          const struct ccn_parsed_interest *pi,
                          struct ccn_charbuf *scratch)
+{
+    return(ccn_btree_match_interest_excl(node, ndx, interest_msg, pi,
+                                         NULL, scratch));
+}
+
+/**
+ * Test for a match between the ContentObject described by a btree 
+ * index entry and an Interest, using a compiled Exclude
+ *
+ * This is the same as ccn_btree_match_interest(), except that if excl is
+ * not NULL, it is used in place of the interest's Exclude.  When many
+ * entries are tested against one interest, compiling its Exclude once
+ * avoids decoding it for every entry.
+ *
+ * @param node                  leaf node
+ * @param ndx                   index of entry within leaf node
+ * @param interest_msg          ccnb-encoded Interest
+ * @param pi                    corresponding parsed interest
+ * @param excl                  compiled Exclude of the interest, or NULL
+ * @param scratch               for scratch use
+ *
+ * @result 1 for match, 0 for no match, -1 for error.
+ */
+int
+ccn_btree_match_interest_excl(struct ccn_btree_node *node, int ndx,
+                              const unsigned char *interest_msg,
+                              const struct ccn_parsed_interest *pi,
+                              const struct ccn_exclusion *excl,
+                              struct ccn_charbuf *scratch)
 {
     const unsigned char *blob = NULL;
     const unsigned char *nextcomp = NULL;
@@ -203,11 +232,15 @@ ccn_btree_match_interest(struct ccn_btree_node *node, int ndx,
         }
         if (nextcomp == NULL)
             return(0);
-        if (ccn_excluded(interest_msg + pi->offset[CCN_PI_B_Exclude],
-                         (pi->offset[CCN_PI_E_Exclude] -
-                          pi->offset[CCN_PI_B_Exclude]),
-                         nextcomp,
-                         nextcomp_size))
+        if (excl != NULL) {
+            if (ccn_exclusion_match(excl, nextcomp, nextcomp_size))
+                return(0);
+        }
+        else if (ccn_excluded(interest_msg + pi->offset[CCN_PI_B_Exclude],
+                              (pi->offset[CCN_PI_E_Exclude] -
+                               pi->offset[CCN_PI_B_Exclude]),
+                              nextcomp,
+                              nextcomp_size))
             return(0);
     }
     /*
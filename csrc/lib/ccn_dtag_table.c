@@ -134,6 +134,11 @@ static const struct ccn_dict_entry ccn_tagdict[] = {
     {CCN_DTAG_StrategyID, "StrategyID"},
     {CCN_DTAG_StrategyParameters, "StrategyParameters"},
     {CCN_DTAG_SequenceNumber, "SequenceNumber"},
+    {CCN_DTAG_Fragment, "Fragment"},
+    {CCN_DTAG_FragmentIndex, "FragmentIndex"},
+    {CCN_DTAG_FragmentCount, "FragmentCount"},
+    {CCN_DTAG_LinkMTU, "LinkMTU"},
+    {CCN_DTAG_LinkAck, "LinkAck"},
     {CCN_DTAG_CCNProtocolDataUnit, "CCNProtocolDataUnit"},
     {0, 0}
 };
@@ -172,6 +172,211 @@ ccn_excluded(const unsigned char *excl,
     return(!excluded);
 }
 
+/**
+ * A compiled Exclude clause
+ *
+ * The explicit components are copied out of the encoding, so that when
+ * they are in canonical order (as they should be) membership can be
+ * decided by binary search.  range[i] is the filter (Any, Bloom, or none)
+ * that applies to values that sort between comp[i-1] and comp[i];
+ * range[0] covers values before the first component, and range[n]
+ * values after the last.
+ */
+struct ccn_exclusion {
+    int n;                              /**< number of explicit components */
+    int sorted;                         /**< comp is in canonical order */
+    struct ccn_exclusion_comp *comp;    /**< n entries */
+    struct ccn_exclusion_range *range;  /**< n + 1 entries */
+    unsigned char *bytes;               /**< component values and filters */
+};
+
+struct ccn_exclusion_comp {
+    size_t off;                         /**< offset of value in bytes */
+    size_t size;                        /**< size of value */
+};
+
+struct ccn_exclusion_range {
+    int any;                            /**< everything here is excluded */
+    const struct ccn_bloom_wire *bloom; /**< validated filter, or NULL */
+};
+
+/**
+ * Decode an Exclude clause, copying its contents into x if it is not NULL
+ *
+ * @returns the number of explicit components, or -1 for error.
+ */
+static int
+ccn_exclusion_scan(const unsigned char *excl, size_t excl_size,
+                   struct ccn_exclusion *x, size_t *pbytes)
+{
+    struct ccn_buf_decoder decoder;
+    struct ccn_buf_decoder *d = ccn_buf_decoder_start(&decoder, excl, excl_size);
+    const unsigned char *blob = NULL;
+    size_t blob_size = 0;
+    size_t nbytes = 0;
+    int n = 0;
+    
+    if (!ccn_buf_match_dtag(d, CCN_DTAG_Exclude))
+        return(-1);
+    ccn_buf_advance(d);
+    for (;;) {
+        /* The filter, if any, that precedes component n */
+        if (ccn_buf_match_dtag(d, CCN_DTAG_Any)) {
+            ccn_buf_advance(d);
+            ccn_buf_check_close(d);
+            if (x != NULL)
+                x->range[n].any = 1;
+        }
+        else if (ccn_buf_match_dtag(d, CCN_DTAG_Bloom)) {
+            ccn_buf_advance(d);
+            blob_size = 0;
+            if (ccn_buf_match_blob(d, &blob, &blob_size))
+                ccn_buf_advance(d);
+            ccn_buf_check_close(d);
+            if (x != NULL && blob_size != 0) {
+                memcpy(x->bytes + nbytes, blob, blob_size);
+                x->range[n].bloom = ccn_bloom_validate_wire(x->bytes + nbytes,
+                                                            blob_size);
+                /* If not a valid filter, treat like a false positive */
+                if (x->range[n].bloom == NULL)
+                    x->range[n].any = 1;
+            }
+            nbytes += blob_size;
+        }
+        if (!ccn_buf_match_dtag(d, CCN_DTAG_Component))
+            break;
+        ccn_buf_advance(d);
+        blob_size = 0;
+        if (ccn_buf_match_blob(d, &blob, &blob_size))
+            ccn_buf_advance(d);
+        ccn_buf_check_close(d);
+        if (x != NULL) {
+            memcpy(x->bytes + nbytes, blob, blob_size);
+            x->comp[n].off = nbytes;
+            x->comp[n].size = blob_size;
+        }
+        nbytes += blob_size;
+        n++;
+    }
+    ccn_buf_check_close(d);
+    if (d->decoder.state < 0)
+        return(-1);
+    *pbytes = nbytes;
+    return(n);
+}
+
+/**
+ * Compare an explicit component of a compiled Exclude with a value,
+ * in canonical order
+ */
+static int
+ccn_exclusion_compare(const struct ccn_exclusion *x, int i,
+                      const unsigned char *val, size_t size)
+{
+    const struct ccn_exclusion_comp *c = &x->comp[i];
+    
+    if (c->size != size)
+        return(c->size < size ? -1 : 1);
+    return(memcmp(x->bytes + c->off, val, size));
+}
+
+/**
+ * Compile an Exclude clause for repeated testing
+ *
+ * @param excl                  address of exclusion encoding
+ * @param excl_size             bytes in exclusion encoding
+ * @result the compiled form, or NULL if the encoding is not valid or
+ *         memory is short.  Use ccn_exclusion_destroy() to free it.
+ */
+struct ccn_exclusion *
+ccn_exclusion_compile(const unsigned char *excl, size_t excl_size)
+{
+    struct ccn_exclusion *x = NULL;
+    size_t nbytes = 0;
+    size_t size;
+    int n;
+    int i;
+    
+    n = ccn_exclusion_scan(excl, excl_size, NULL, &nbytes);
+    if (n < 0)
+        return(NULL);
+    size = sizeof(*x) + n * sizeof(x->comp[0]) +
+           (n + 1) * sizeof(x->range[0]) + nbytes;
+    x = calloc(1, size);
+    if (x == NULL)
+        return(NULL);
+    x->n = n;
+    x->comp = (struct ccn_exclusion_comp *)(x + 1);
+    x->range = (struct ccn_exclusion_range *)(x->comp + n);
+    x->bytes = (unsigned char *)(x->range + n + 1);
+    if (ccn_exclusion_scan(excl, excl_size, x, &nbytes) != n) {
+        free(x);
+        return(NULL);
+    }
+    x->sorted = 1;
+    for (i = 1; i < n && x->sorted; i++)
+        if (ccn_exclusion_compare(x, i - 1, x->bytes + x->comp[i].off,
+                                  x->comp[i].size) >= 0)
+            x->sorted = 0;
+    return(x);
+}
+
+void
+ccn_exclusion_destroy(struct ccn_exclusion **px)
+{
+    free(*px);
+    *px = NULL;
+}
+
+/**
+ * Test a next component against a compiled Exclude clause
+ *
+ * Gives the same answer as ccn_excluded() on the encoding that x was
+ * compiled from.
+ * @result 1 if nextcomp is excluded, otherwise 0.
+ */
+int
+ccn_exclusion_match(const struct ccn_exclusion *x,
+                    const unsigned char *nextcomp,
+                    size_t nextcomp_size)
+{
+    const struct ccn_exclusion_range *r;
+    int lo = 0;
+    int hi = x->n;
+    int mid;
+    int res;
+    
+    if (x->sorted) {
+        while (lo < hi) {
+            mid = (lo + hi) / 2;
+            res = ccn_exclusion_compare(x, mid, nextcomp, nextcomp_size);
+            if (res == 0)
+                return(1); /* One of the explicit excludes */
+            if (res < 0)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+    }
+    else {
+        /* Out of order, so do what a linear scan of the encoding does */
+        for (lo = 0; lo < hi; lo++) {
+            res = ccn_exclusion_compare(x, lo, nextcomp, nextcomp_size);
+            if (res == 0)
+                return(1);
+            if (res > 0)
+                break;
+        }
+    }
+    r = &x->range[lo];
+    if (r->any)
+        return(1);
+    if (r->bloom != NULL && ccn_bloom_match_wire(r->bloom, nextcomp,
+                                                 nextcomp_size))
+        return(1);
+    return(0);
+}
+
 /**
  * Test for a match between a ContentObject and an Interest
  *
@@ -199,6 +404,31 @@ ccn_content_matches_interest(const unsigned char *content_object,
                              const unsigned char *interest_msg,
                              size_t interest_msg_size,
                              const struct ccn_parsed_interest *pi)
+{
+    return(ccn_content_matches_interest_excl(content_object,
+                                             content_object_size,
+                                             implicit_content_digest, pc,
+                                             interest_msg, interest_msg_size,
+                                             pi, NULL));
+}
+
+/**
+ * Test for a match between a ContentObject and an Interest, using a
+ * compiled Exclude
+ *
+ * This is the same as ccn_content_matches_interest(), except that if excl
+ * is not NULL, it is used in place of the interest's Exclude.  The caller
+ * is responsible for having compiled it from the same interest.
+ */
+int
+ccn_content_matches_interest_excl(const unsigned char *content_object,
+                                  size_t content_object_size,
+                                  int implicit_content_digest,
+                                  struct ccn_parsed_ContentObject *pc,
+                                  const unsigned char *interest_msg,
+                                  size_t interest_msg_size,
+                                  const struct ccn_parsed_interest *pi,
+                                  const struct ccn_exclusion *excl)
 {
     struct ccn_parsed_ContentObject pc_store;
     struct ccn_parsed_interest pi_store;
@@ -300,11 +530,15 @@ ccn_content_matches_interest(const unsigned char *content_object,
             nextcomp = pc->digest;
         }
         else abort(); /* bug - should have returned already */
-        if (ccn_excluded(interest_msg + pi->offset[CCN_PI_B_Exclude],
-                         (pi->offset[CCN_PI_E_Exclude] -
-                          pi->offset[CCN_PI_B_Exclude]),
-                         nextcomp,
-                         nextcomp_size))
+        if (excl != NULL) {
+            if (ccn_exclusion_match(excl, nextcomp, nextcomp_size))
+                return(0);
+        }
+        else if (ccn_excluded(interest_msg + pi->offset[CCN_PI_B_Exclude],
+                              (pi->offset[CCN_PI_E_Exclude] -
+                               pi->offset[CCN_PI_B_Exclude]),
+                              nextcomp,
+                              nextcomp_size))
             return(0);
     exclude_checked: {}
     }
@@ -26,6 +26,7 @@
 
 #define CCN_SKIPLIST_MAX_DEPTH 16
 #define NAMETREE_PVT_PAYLOAD_OWNED 0x40
+#define NAMETREE_PVT_CLIENT_ALLOC 0x20
 
 /**
  *  Create a new, empty nametree
@@ -67,6 +68,8 @@ ccn_nametree_create(int initial_limit)
         h->pre_remove = 0;
         h->check = 0;
         h->finalize = 0;
+        h->ccny_alloc = 0;
+        h->ccny_free = 0;
         h->compare = &ccn_flatname_compare;
     }
     return(h);
@@ -89,6 +92,19 @@ ccn_nametree_create(int initial_limit)
  */
 struct ccny *
 ccny_create(unsigned randombits, size_t payload_size)
+{
+    return(ccny_create_in(NULL, randombits, payload_size));
+}
+
+/**
+ *  Create a new nametree entry, using the allocator of h
+ *
+ * This is like ccny_create(), except that if h supplies a ccny_alloc
+ * procedure, it is used to get the memory for the entry.  Such an
+ * entry must be destroyed with the same h.
+ */
+struct ccny *
+ccny_create_in(struct ccn_nametree *h, unsigned randombits, size_t payload_size)
 {
     struct ccny *y = NULL;
     int d;
@@ -100,7 +116,15 @@ ccny_create(unsigned randombits, size_t payload_size)
     base_size = sizeof(*y) + (d - 1) * sizeof(y->skiplinks[0]);
     if (payload_size > 0)
         base_size = (base_size + 7) / 8 * 8; /* 8-byte alignment */
-    y = calloc(1, base_size + payload_size);
+    if (h != NULL && h->ccny_alloc != NULL) {
+        y = (h->ccny_alloc)(h, base_size + payload_size);
+        if (y == NULL)
+            return(y);
+        memset(y, 0, base_size + payload_size);
+        y->prv |= NAMETREE_PVT_CLIENT_ALLOC;
+    }
+    else
+        y = calloc(1, base_size + payload_size);
     if (y == NULL)
         return(y);
     y->cookie = 0;
@@ -424,6 +448,77 @@ ccny_enroll(struct ccn_nametree *h, struct ccny *y)
     }
 }
 
+/**
+ *  Enroll entries that are already in key order
+ *
+ * This is a fast path for loading a nametree in bulk.  The keys in v
+ * must be increasing, and the first must be greater than any key
+ * already in the tree.  Each new entry then goes at the end, so it is
+ * linked in without searching the skiplist.
+ *
+ * Enrollment stops at the first entry that is out of order, or when
+ * the table is full, so the caller should grow the table beforehand.
+ *
+ * @returns the number of entries enrolled, which are a prefix of v.
+ */
+int
+ccn_nametree_append(struct ccn_nametree *h, struct ccny **v, int n)
+{
+    struct ccny *pred[CCN_SKIPLIST_MAX_DEPTH];
+    struct ccny *last;
+    struct ccny *c;
+    struct ccny *y;
+    ccn_cookie cookie;
+    unsigned lastslot;
+    unsigned slot;
+    int i;
+    int k;
+    
+    /* The predecessors of a new last entry are the last ones at each level */
+    c = h->head;
+    for (i = h->head->skipdim - 1; i >= 0; i--) {
+        while (c->skiplinks[i] != NULL)
+            c = c->skiplinks[i];
+        pred[i] = c;
+    }
+    for (i = h->head->skipdim; i < CCN_SKIPLIST_MAX_DEPTH; i++)
+        pred[i] = h->head;
+    last = h->head->prev;
+    for (k = 0; k < n; k++) {
+        y = v[k];
+        if (y->cookie != 0)
+            abort();
+        if (last != NULL &&
+            (h->compare)(last->key, last->keylen, y->key, y->keylen) >= 0)
+            break;
+        lastslot = h->cookie & h->cookiemask;
+        for (;;) {
+            cookie = ++(h->cookie);
+            slot = cookie & h->cookiemask;
+            if (cookie != 0 && h->nmentry_by_cookie[slot] == NULL)
+                break;
+            if (slot == lastslot)
+                return(k);
+        }
+        y->cookie = cookie;
+        while (h->head->skipdim < y->skipdim)
+            h->head->skiplinks[h->head->skipdim++] = NULL;
+        for (i = 0; i < y->skipdim; i++) {
+            y->skiplinks[i] = NULL;
+            pred[i]->skiplinks[i] = y;
+            pred[i] = y;
+        }
+        y->prev = last;
+        h->head->prev = y;
+        last = y;
+        h->nmentry_by_cookie[slot] = y;
+        h->n += 1;
+        if (h->post_enroll)
+            (h->post_enroll)(h, y);
+    }
+    return(k);
+}
+
 /**
  *  Double the size of the direct lookup table
  *
@@ -493,7 +588,12 @@ ccny_destroy(struct ccn_nametree *h, struct ccny **py)
         (h->finalize)(h, y);
     if (y->key != NULL)
         free(y->key);
-    free(y);
+    if ((y->prv & NAMETREE_PVT_CLIENT_ALLOC) != 0) {
+        if (h == NULL || h->ccny_free == NULL) abort();
+        (h->ccny_free)(h, y);
+    }
+    else
+        free(y);
     *py = NULL;
 }
 
@@ -629,6 +729,18 @@ ccny_keylen(struct ccny *y)
     return(y->keylen);
 }
 
+/**
+ * Access the size of the entry's own bookkeeping
+ *
+ * This covers the entry header and its skiplinks, but not the
+ * key or the payload.
+ */
+size_t
+ccny_overhead(struct ccny *y)
+{
+    return(sizeof(*y) + (y->skipdim - 1) * sizeof(y->skiplinks[0]));
+}
+
 /** Get the client info */
 unsigned
 ccny_info(struct ccny *y)
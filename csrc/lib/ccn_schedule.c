@@ -41,6 +41,47 @@ struct ccn_schedule_heap_item {
     struct ccn_scheduled_event *ev;
 };
 
+/**
+ * As an alternative to the heap, a hierarchical timing wheel may be used.
+ *
+ * Each level of the wheel has WHEEL_SLOTS lists of events, and each slot
+ * of a level spans WHEEL_SLOTS times as many micros as a slot of the
+ * level below.  An event is filed at the lowest level whose range covers
+ * its remaining time, and is moved down toward level 0 as time passes.
+ * Insertion and cancellation are O(1), and a cancelled event is removed
+ * and freed right away.
+ *
+ * Select the wheel by setting CCN_SCHEDULE=wheel in the environment.
+ */
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 6      /* covers 2**36 micros, more than an int */
+
+struct ccn_wheel_link {
+    struct ccn_wheel_link *next;
+    struct ccn_wheel_link *prev;
+};
+
+/**
+ * Private form of an event scheduled on the wheel
+ */
+struct ccn_wheel_event {
+    struct ccn_scheduled_event ev;  /**< client view; must be first */
+    struct ccn_wheel_link link;
+    struct ccn_wheel_link *list;    /**< list head, or NULL while running */
+    uint64_t expires;               /**< in wheel micros */
+};
+
+struct ccn_schedule_wheel {
+    uint64_t clock;     /* wheel micros corresponding to lasttime */
+    uint64_t curtime;   /* time up to which the slots have been processed */
+    uint64_t pending[WHEEL_LEVELS]; /* bitmaps of non-empty slots */
+    struct ccn_wheel_link slot[WHEEL_LEVELS][WHEEL_SLOTS];
+    struct ccn_wheel_link expired;  /* events ready to run */
+    int n;              /* number of scheduled events */
+};
+
 struct ccn_schedule {
     void *clienth;
     const struct ccn_gettime *clock;
@@ -52,6 +93,7 @@ struct ccn_schedule {
     struct ccn_timeval lasttime; /* actual time when we last checked  */
     int time_leap;      /* number of times clock took a large jump */
     int time_ran_backward; /* number of times clock ran backwards */
+    struct ccn_schedule_wheel *wheel; /* NULL if using the heap */
 };
 
 /*
@@ -94,24 +136,278 @@ update_time(struct ccn_schedule *sched)
         update_epoch(sched);
     sched->now += elapsed;
     sched->lasttime = now;
+    if (sched->wheel != NULL)
+        sched->wheel->clock += elapsed;
+}
+
+static void
+wheel_list_init(struct ccn_wheel_link *head)
+{
+    head->next = head->prev = head;
+}
+
+static void
+wheel_list_append(struct ccn_wheel_link *head, struct ccn_wheel_link *link)
+{
+    link->next = head;
+    link->prev = head->prev;
+    head->prev->next = link;
+    head->prev = link;
+}
+
+static void
+wheel_list_remove(struct ccn_wheel_link *link)
+{
+    link->prev->next = link->next;
+    link->next->prev = link->prev;
+    link->next = link->prev = link;
+}
+
+static struct ccn_wheel_event *
+wheel_event_from_link(struct ccn_wheel_link *link)
+{
+    return((struct ccn_wheel_event *)
+           ((char *)link - offsetof(struct ccn_wheel_event, link)));
+}
+
+/* Number of significant bits in x */
+static int
+wheel_bitlength(uint64_t x)
+{
+#if defined(__GNUC__)
+    return(x == 0 ? 0 : 64 - __builtin_clzll(x));
+#else
+    int n = 0;
+    for (; x >= 0x10000; x >>= 16)
+        n += 16;
+    for (; x != 0; x >>= 1)
+        n += 1;
+    return(n);
+#endif
+}
+
+/* Index of the lowest set bit in x, which must not be 0 */
+static int
+wheel_lowbit(uint64_t x)
+{
+#if defined(__GNUC__)
+    return(__builtin_ctzll(x));
+#else
+    int n = 0;
+    for (; (x & 0xFFFF) == 0; x >>= 16)
+        n += 16;
+    for (; (x & 1) == 0; x >>= 1)
+        n += 1;
+    return(n);
+#endif
+}
+
+static uint64_t
+wheel_rotr(uint64_t x, int c)
+{
+    c &= WHEEL_MASK;
+    if (c == 0)
+        return(x);
+    return((x >> c) | (x << (WHEEL_SLOTS - c)));
+}
+
+static uint64_t
+wheel_rotl(uint64_t x, int c)
+{
+    return(wheel_rotr(x, WHEEL_SLOTS - (c & WHEEL_MASK)));
+}
+
+/*
+ * wheel_place: file an event according to its expiry time
+ */
+static void
+wheel_place(struct ccn_schedule_wheel *w, struct ccn_wheel_event *wev)
+{
+    struct ccn_wheel_link *head;
+    uint64_t rem;
+    int level;
+    int slot;
+    if (wev->expires <= w->curtime)
+        head = &w->expired;
+    else {
+        rem = wev->expires - w->curtime;
+        level = (wheel_bitlength(rem) - 1) / WHEEL_BITS;
+        if (level >= WHEEL_LEVELS)
+            level = WHEEL_LEVELS - 1;
+        /*
+         * Above level 0, use the slot before the one holding the expiry
+         * time, so the event moves down a level before it is due.
+         */
+        slot = WHEEL_MASK &
+            ((wev->expires >> (level * WHEEL_BITS)) - (level != 0));
+        head = &w->slot[level][slot];
+        w->pending[level] |= (uint64_t)1 << slot;
+    }
+    wheel_list_append(head, &wev->link);
+    wev->list = head;
+}
+
+/*
+ * wheel_unplace: take an event off whatever list it is on
+ */
+static void
+wheel_unplace(struct ccn_schedule_wheel *w, struct ccn_wheel_event *wev)
+{
+    struct ccn_wheel_link *head = wev->list;
+    int i;
+    wheel_list_remove(&wev->link);
+    wev->list = NULL;
+    if (head != &w->expired && head->next == head) {
+        i = head - &w->slot[0][0];
+        w->pending[i / WHEEL_SLOTS] &= ~((uint64_t)1 << (i % WHEEL_SLOTS));
+    }
+}
+
+/*
+ * wheel_advance: bring the wheel up to the current clock
+ * Events that have come due are moved to the expired list; others in
+ * the slots that were passed over are filed again at a lower level.
+ */
+static void
+wheel_advance(struct ccn_schedule_wheel *w)
+{
+    struct ccn_wheel_link todo;
+    struct ccn_wheel_link *head;
+    struct ccn_wheel_event *wev;
+    uint64_t newtime = w->clock;
+    uint64_t elapsed;
+    uint64_t pending;
+    uint64_t span;
+    int level;
+    int oslot;
+    int nslot;
+    int slot;
+    if (newtime < w->curtime)
+        return;
+    elapsed = newtime - w->curtime;
+    wheel_list_init(&todo);
+    for (level = 0; level < WHEEL_LEVELS; level++) {
+        span = elapsed >> (level * WHEEL_BITS);
+        if (span > WHEEL_MASK)
+            pending = ~(uint64_t)0;
+        else {
+            /* the slots from the old position to the new one, inclusive */
+            oslot = WHEEL_MASK & (w->curtime >> (level * WHEEL_BITS));
+            nslot = WHEEL_MASK & (newtime >> (level * WHEEL_BITS));
+            pending = wheel_rotl(((uint64_t)1 << span) - 1, oslot);
+            pending |= wheel_rotr(wheel_rotl(((uint64_t)1 << span) - 1,
+                                             nslot), (int)span);
+            pending |= (uint64_t)1 << nslot;
+        }
+        while ((pending & w->pending[level]) != 0) {
+            slot = wheel_lowbit(pending & w->pending[level]);
+            head = &w->slot[level][slot];
+            if (head->next != head) {
+                /* splice the whole slot onto todo */
+                head->next->prev = todo.prev;
+                todo.prev->next = head->next;
+                head->prev->next = &todo;
+                todo.prev = head->prev;
+                wheel_list_init(head);
+            }
+            w->pending[level] &= ~((uint64_t)1 << slot);
+        }
+        if ((pending & 1) == 0)
+            break; /* did not wrap, so the higher levels have not moved */
+        /* the next level must tick at least once */
+        if (elapsed < ((uint64_t)WHEEL_SLOTS << (level * WHEEL_BITS)))
+            elapsed = (uint64_t)WHEEL_SLOTS << (level * WHEEL_BITS);
+    }
+    w->curtime = newtime;
+    while (todo.next != &todo) {
+        wev = wheel_event_from_link(todo.next);
+        wheel_list_remove(&wev->link);
+        wheel_place(w, wev);
+    }
+}
+
+/*
+ * wheel_next: micros until the next slot that may hold a due event
+ * This may be earlier than the actual expiry, if the slot is at
+ * a higher level.
+ */
+static uint64_t
+wheel_next(struct ccn_schedule_wheel *w)
+{
+    uint64_t ans = ~(uint64_t)0;
+    uint64_t t;
+    uint64_t relmask = 0;
+    int level;
+    int slot;
+    if (w->expired.next != &w->expired)
+        return(0);
+    for (level = 0; level < WHEEL_LEVELS; level++) {
+        if (w->pending[level] != 0) {
+            slot = WHEEL_MASK & (w->curtime >> (level * WHEEL_BITS));
+            t = (uint64_t)(wheel_lowbit(wheel_rotr(w->pending[level], slot)) +
+                           (level != 0)) << (level * WHEEL_BITS);
+            t -= relmask & w->curtime;
+            if (t < ans)
+                ans = t;
+        }
+        relmask = (relmask << WHEEL_BITS) | WHEEL_MASK;
+    }
+    return(ans);
 }
 
 struct ccn_schedule *
 ccn_schedule_create(void *clienth, const struct ccn_gettime *ccnclock)
 {
     struct ccn_schedule *sched;
+    const char *s;
+    int i;
+    int j;
     if (ccnclock == NULL)
         return(NULL);
     sched = calloc(1, sizeof(*sched));
     if (sched != NULL) {
         sched->clienth = clienth;
         sched->clock = ccnclock;
+        s = getenv("CCN_SCHEDULE");
+        if (s != NULL && strcmp(s, "wheel") == 0) {
+            sched->wheel = calloc(1, sizeof(*sched->wheel));
+            if (sched->wheel == NULL) {
+                free(sched);
+                return(NULL);
+            }
+            wheel_list_init(&sched->wheel->expired);
+            for (i = 0; i < WHEEL_LEVELS; i++)
+                for (j = 0; j < WHEEL_SLOTS; j++)
+                    wheel_list_init(&sched->wheel->slot[i][j]);
+        }
         update_time(sched);
         sched->time_leap = 0;
     }
     return(sched);
 }
 
+static void
+wheel_destroy(struct ccn_schedule *sched)
+{
+    struct ccn_schedule_wheel *w = sched->wheel;
+    struct ccn_wheel_link *head;
+    struct ccn_wheel_event *wev;
+    int i;
+    for (i = -1; i < WHEEL_LEVELS * WHEEL_SLOTS; i++) {
+        head = (i < 0) ? &w->expired : &w->slot[0][0] + i;
+        while (head->next != head) {
+            wev = wheel_event_from_link(head->next);
+            wheel_unplace(w, wev);
+            w->n--;
+            (wev->ev.action)(sched, sched->clienth, &wev->ev,
+                             CCN_SCHEDULE_CANCEL);
+            free(wev);
+        }
+    }
+    sched->wheel = NULL;
+    free(w);
+}
+
 void
 ccn_schedule_destroy(struct ccn_schedule **schedp)
 {
@@ -124,6 +420,8 @@ ccn_schedule_destroy(struct ccn_schedule **schedp)
     if (sched == NULL)
         return;
     *schedp = NULL;
+    if (sched->wheel != NULL)
+        wheel_destroy(sched);
     heap = sched->heap;
     if (heap != NULL) {
         n = sched->heap_n;
@@ -239,14 +537,28 @@ ccn_schedule_event(
     intptr_t evint)
 {
     struct ccn_scheduled_event *ev;
+    struct ccn_wheel_event *wev = NULL;
     if (micros < 0)
         return(NULL);
-    ev = calloc(1, sizeof(*ev));
-    if (ev == NULL) return(NULL);
+    if (sched->wheel != NULL) {
+        wev = calloc(1, sizeof(*wev));
+        if (wev == NULL) return(NULL);
+        ev = &wev->ev;
+    }
+    else {
+        ev = calloc(1, sizeof(*ev));
+        if (ev == NULL) return(NULL);
+    }
     ev->action = action;
     ev->evdata = evdata;
     ev->evint = evint;
     update_time(sched);
+    if (sched->wheel != NULL) {
+        wev->expires = sched->wheel->clock + micros;
+        wheel_place(sched->wheel, wev);
+        sched->wheel->n++;
+        return(ev);
+    }
     return(reschedule_event(sched, micros, ev));
 }
 
@@ -267,12 +579,23 @@ ccn_schedule_cancelled_event(struct ccn_schedule *sched, void *clienth,
 int
 ccn_schedule_cancel(struct ccn_schedule *sched, struct ccn_scheduled_event *ev)
 {
+    struct ccn_wheel_event *wev;
     int res;
     if (ev == NULL)
         return(-1);
     res = (ev->action)(sched, sched->clienth, ev, CCN_SCHEDULE_CANCEL);
     if (res > 0)
         abort(); /* Bug in ev->action - bad return value */
+    if (sched->wheel != NULL) {
+        wev = (struct ccn_wheel_event *)ev;
+        /* A running event is freed by wheel_run_next */
+        if (wev->list != NULL) {
+            wheel_unplace(sched->wheel, wev);
+            sched->wheel->n--;
+            free(wev);
+            return(0);
+        }
+    }
     ev->action = &ccn_schedule_cancelled_event;
     ev->evdata = NULL;
     ev->evint = 0;
@@ -307,6 +630,53 @@ ccn_schedule_run_next(struct ccn_schedule *sched)
     reschedule_event(sched, res, ev);
 }
 
+static void
+wheel_run_next(struct ccn_schedule *sched)
+{
+    struct ccn_schedule_wheel *w = sched->wheel;
+    struct ccn_wheel_event *wev;
+    uint64_t late;
+    int res;
+    wev = wheel_event_from_link(w->expired.next);
+    wheel_unplace(w, wev);
+    w->n--;
+    late = w->curtime - wev->expires;
+    res = (wev->ev.action)(sched, sched->clienth, &wev->ev, 0);
+    if (res <= 0) {
+        free(wev);
+        return;
+    }
+    /* Same policy as ccn_schedule_run_next */
+    if (late > res)
+        res = 1;
+    else if (late <= sched->clock->micros_per_base)
+        res -= late;
+    wev->expires = w->clock + res;
+    wheel_place(w, wev);
+    w->n++;
+}
+
+static int
+wheel_run(struct ccn_schedule *sched)
+{
+    struct ccn_schedule_wheel *w = sched->wheel;
+    uint64_t ans;
+    for (;;) {
+        update_time(sched);
+        wheel_advance(w);
+        if (w->expired.next == &w->expired)
+            break;
+        while (w->expired.next != &w->expired)
+            wheel_run_next(sched);
+    }
+    if (w->n == 0)
+        return(-1);
+    ans = wheel_next(w);
+    if (ans < INT_MAX)
+        return(ans);
+    return(INT_MAX);
+}
+
 /*
  * ccn_schedule_run: do any scheduled events
  * This executes any scheduled actions whose time has come.
@@ -317,6 +687,8 @@ int
 ccn_schedule_run(struct ccn_schedule *sched)
 {
     heapmicros ans;
+    if (sched->wheel != NULL)
+        return(wheel_run(sched));
     do {
         while (sched->heap_n > 0 && sched->heap[0].event_time <= sched->now)
             ccn_schedule_run_next(sched);
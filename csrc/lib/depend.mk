@@ -116,6 +116,9 @@ encodedecodetest.o: encodedecodetest.c ../include/ccn/ccn.h \
   ../include/ccn/indexbuf.h ../include/ccn/bloom.h ../include/ccn/uri.h \
   ../include/ccn/digest.h ../include/ccn/keystore.h \
   ../include/ccn/signing.h ../include/ccn/random.h
+excludetest.o: excludetest.c ../include/ccn/bloom.h ../include/ccn/ccn.h \
+  ../include/ccn/coding.h ../include/ccn/charbuf.h \
+  ../include/ccn/indexbuf.h
 hashtb.o: hashtb.c ../include/ccn/hashtb.h ../include/ccn/siphash24.h
 hashtbtest.o: hashtbtest.c ../include/ccn/hashtb.h
 lned.o: lned.c ../include/ccn/lned.h
@@ -123,6 +126,7 @@ nametreetest.o: nametreetest.c ../include/ccn/ccn.h \
   ../include/ccn/coding.h ../include/ccn/charbuf.h \
   ../include/ccn/indexbuf.h ../include/ccn/flatname.h \
   ../include/ccn/nametree.h ../include/ccn/uri.h
+schedbenchtest.o: schedbenchtest.c ../include/ccn/schedule.h
 signbenchtest.o: signbenchtest.c ../include/ccn/ccn.h \
   ../include/ccn/coding.h ../include/ccn/charbuf.h \
   ../include/ccn/indexbuf.h ../include/ccn/keystore.h
@@ -17,7 +17,8 @@ EXPATLIBS = -lexpat
 CCNLIBDIR = ../lib
 
 PROGRAMS = hashtbtest skel_decode_test \
-    encodedecodetest signbenchtest basicparsetest ccnbtreetest nametreetest
+    encodedecodetest signbenchtest basicparsetest ccnbtreetest nametreetest \
+    schedbenchtest excludetest
 
 BROKEN_PROGRAMS =
 
@@ -65,10 +66,12 @@ CSRC = \
     ccn_versioning.c \
     ccnbtreetest.c \
     encodedecodetest.c \
+    excludetest.c \
     hashtb.c \
     hashtbtest.c \
     lned.c \
     nametreetest.c \
+    schedbenchtest.c \
     signbenchtest.c \
     siphash24.c \
     skel_decode_test.c
@@ -144,11 +147,15 @@ shlib: $(SHLIBNAME)
 
 lib: libccn.a
 
-test: default encodedecodetest ccnbtreetest nametreetest q.dat
+test: default encodedecodetest ccnbtreetest nametreetest schedbenchtest \
+    excludetest hashtbtest q.dat
 	./encodedecodetest -o /dev/null
 	./ccnbtreetest
 	./ccnbtreetest - < q.dat
 	./nametreetest - < q.dat
+	./schedbenchtest -n 20000 -t 500
+	./excludetest
+	./hashtbtest -r 1000
 	$(RM) -R _bt_*
 
 dtag_check: _always
@@ -179,6 +186,12 @@ hashtbtest: hashtbtest.o
 skel_decode_test: skel_decode_test.o
 	$(CC) $(CFLAGS) -o $@ skel_decode_test.o $(LDLIBS)
 
+schedbenchtest: schedbenchtest.o
+	$(CC) $(CFLAGS) -o $@ schedbenchtest.o $(LDLIBS)
+
+excludetest: excludetest.o
+	$(CC) $(CFLAGS) -o $@ excludetest.o $(LDLIBS) $(OPENSSL_LIBS) -lcrypto
+
 basicparsetest: basicparsetest.o libccn.a
 	$(CC) $(CFLAGS) -o $@ basicparsetest.o $(LDLIBS) $(OPENSSL_LIBS) -lcrypto
 
@@ -0,0 +1,406 @@
+/**
+ * @file excludetest.c
+ *
+ * Unit tests for compiled Exclude clauses
+ *
+ * Checks ccn_exclusion_match() and ccn_content_matches_interest_excl()
+ * against ccn_excluded() and ccn_content_matches_interest() on the same
+ * inputs, and reports the cost of each.
+ */
+/*
+ * Copyright (C) 2013 Palo Alto Research Center, Inc.
+ *
+ * This work is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 2 as published by the
+ * Free Software Foundation.
+ * This work is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details. You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <ccn/bloom.h>
+#include <ccn/ccn.h>
+#include <ccn/charbuf.h>
+
+#define FAILIF(cond) do {} while ((cond) && fatal(__func__, __LINE__))
+#define CHKPTR(p)   FAILIF((p) == NULL)
+
+static int
+fatal(const char *fn, int lineno)
+{
+    fprintf(stderr, "OOPS - function %s, line %d\n", fn, lineno);
+    exit(1);
+    return(0);
+}
+
+/* Filters that may precede or follow an explicit component */
+#define F_NONE  0
+#define F_ANY   1
+#define F_BLOOM 2
+
+/** Probe values: every string of up to 2 bytes over a small alphabet */
+#define NPROBES (1 + 5 + 25)
+static unsigned char probe[NPROBES][2];
+static size_t probe_size[NPROBES];
+
+static void
+make_probes(void)
+{
+    static const unsigned char alpha[5] = {0x00, 'A', 'B', 'C', 0xFF};
+    int i;
+    int j;
+    int k = 1;
+
+    probe_size[0] = 0;
+    for (i = 0; i < 5; i++, k++) {
+        probe[k][0] = alpha[i];
+        probe_size[k] = 1;
+    }
+    for (i = 0; i < 5; i++)
+        for (j = 0; j < 5; j++, k++) {
+            probe[k][0] = alpha[i];
+            probe[k][1] = alpha[j];
+            probe_size[k] = 2;
+        }
+}
+
+/** Canonical order: shorter first, then bytewise */
+static int
+probe_compare(int a, int b)
+{
+    if (probe_size[a] != probe_size[b])
+        return(probe_size[a] < probe_size[b] ? -1 : 1);
+    return(memcmp(probe[a], probe[b], probe_size[a]));
+}
+
+/**
+ * Append a Bloom filter holding a random handful of the probes
+ */
+static void
+append_bloom(struct ccn_charbuf *c)
+{
+    static const unsigned char seed[4] = {1, 2, 3, 4};
+    struct ccn_bloom *b;
+    unsigned char wire[1100];
+    int size;
+    int i;
+
+    b = ccn_bloom_create(8, seed);
+    CHKPTR(b);
+    for (i = 0; i < 4; i++) {
+        int k = random() % NPROBES;
+        ccn_bloom_insert(b, probe[k], probe_size[k]);
+    }
+    size = ccn_bloom_wiresize(b);
+    FAILIF(size <= 0 || size > (int)sizeof(wire));
+    FAILIF(ccn_bloom_store_wire(b, wire, size) != 0);
+    ccnb_append_tagged_blob(c, CCN_DTAG_Bloom, wire, size);
+    ccn_bloom_destroy(&b);
+}
+
+static void
+append_filter(struct ccn_charbuf *c, int filter)
+{
+    if (filter == F_ANY) {
+        ccnb_element_begin(c, CCN_DTAG_Any);
+        ccnb_element_end(c);
+    }
+    else if (filter == F_BLOOM)
+        append_bloom(c);
+}
+
+/**
+ * Encode an Exclude with the given explicit probes and filters
+ *
+ * filter[i] precedes comp[i]; filter[n] follows the last component.
+ */
+static void
+make_exclude(struct ccn_charbuf *c, const int *comp, int n, const int *filter)
+{
+    int i;
+
+    ccnb_element_begin(c, CCN_DTAG_Exclude);
+    for (i = 0; i < n; i++) {
+        append_filter(c, filter[i]);
+        ccnb_append_tagged_blob(c, CCN_DTAG_Component,
+                                probe[comp[i]], probe_size[comp[i]]);
+    }
+    append_filter(c, filter[n]);
+    ccnb_element_end(c);
+}
+
+/**
+ * Build an Interest in ccnx:/t with the given Exclude (may be NULL)
+ */
+static void
+make_interest(struct ccn_charbuf *c, const struct ccn_charbuf *excl)
+{
+    ccnb_element_begin(c, CCN_DTAG_Interest);
+    ccnb_element_begin(c, CCN_DTAG_Name);
+    ccnb_append_tagged_blob(c, CCN_DTAG_Component, "t", 1);
+    ccnb_element_end(c);
+    if (excl != NULL)
+        ccn_charbuf_append_charbuf(c, excl);
+    ccnb_element_end(c);
+}
+
+/**
+ * Build an unsigned ContentObject named ccnx:/t/<probe k>
+ *
+ * The signature is not checked by the matching code, so a dummy will do.
+ */
+static void
+make_content(struct ccn_charbuf *c, int k)
+{
+    static const unsigned char dummy[32] = {0};
+
+    ccnb_element_begin(c, CCN_DTAG_ContentObject);
+    ccnb_element_begin(c, CCN_DTAG_Signature);
+    ccnb_append_tagged_blob(c, CCN_DTAG_SignatureBits, dummy, sizeof(dummy));
+    ccnb_element_end(c);
+    ccnb_element_begin(c, CCN_DTAG_Name);
+    ccnb_append_tagged_blob(c, CCN_DTAG_Component, "t", 1);
+    ccnb_append_tagged_blob(c, CCN_DTAG_Component, probe[k], probe_size[k]);
+    ccnb_element_end(c);
+    ccnb_element_begin(c, CCN_DTAG_SignedInfo);
+    ccnb_append_tagged_blob(c, CCN_DTAG_PublisherPublicKeyDigest,
+                            dummy, sizeof(dummy));
+    ccnb_element_begin(c, CCN_DTAG_Timestamp);
+    ccnb_append_now_blob(c, CCN_MARKER_NONE);
+    ccnb_element_end(c);
+    ccnb_element_end(c);
+    ccnb_append_tagged_blob(c, CCN_DTAG_Content, "x", 1);
+    ccnb_element_end(c);
+}
+
+static struct ccn_charbuf *content[NPROBES];
+
+/**
+ * Check the compiled form of one Exclude against the interpreted form
+ *
+ * Every probe is tried both directly and as the component after the
+ * prefix of an Interest.  Pass excl as NULL to test an Interest without
+ * an Exclude.
+ * @returns the number of probes excluded.
+ */
+static int
+check_exclude(const struct ccn_charbuf *excl)
+{
+    struct ccn_charbuf *interest = ccn_charbuf_create();
+    struct ccn_exclusion *x = NULL;
+    struct ccn_parsed_interest pi = {0};
+    int excluded = 0;
+    int a;
+    int b;
+    int k;
+
+    make_interest(interest, excl);
+    FAILIF(ccn_parse_interest(interest->buf, interest->length, &pi, NULL) < 0);
+    if (excl != NULL) {
+        x = ccn_exclusion_compile(excl->buf, excl->length);
+        CHKPTR(x);
+    }
+    for (k = 0; k < NPROBES; k++) {
+        if (x != NULL) {
+            a = ccn_excluded(excl->buf, excl->length,
+                             probe[k], probe_size[k]);
+            b = ccn_exclusion_match(x, probe[k], probe_size[k]);
+            FAILIF(a != b);
+            excluded += a;
+        }
+        a = ccn_content_matches_interest(content[k]->buf, content[k]->length,
+                                         0, NULL, interest->buf,
+                                         interest->length, &pi);
+        b = ccn_content_matches_interest_excl(content[k]->buf,
+                                              content[k]->length, 0, NULL,
+                                              interest->buf, interest->length,
+                                              &pi, x);
+        FAILIF(a != b);
+        if (x != NULL)
+            FAILIF(a == ccn_excluded(excl->buf, excl->length,
+                                     probe[k], probe_size[k]));
+        else
+            FAILIF(a != 1);
+    }
+    ccn_exclusion_destroy(&x);
+    ccn_charbuf_destroy(&interest);
+    return(excluded);
+}
+
+/**
+ * The cases that are easy to get wrong, spelled out
+ */
+static void
+test_fixed_cases(void)
+{
+    struct ccn_charbuf *c = ccn_charbuf_create();
+    int comp[3] = {2, 8, 14};       /* "A", "\0B", "AC": in order */
+    int backward[3] = {14, 8, 2};
+    int filter[4];
+    int where;
+
+    /* No Exclude at all */
+    check_exclude(NULL);
+    /* An empty Exclude excludes nothing */
+    filter[0] = F_NONE;
+    make_exclude(c, comp, 0, filter);
+    FAILIF(check_exclude(c) != 0);
+    /* A lone Any excludes everything */
+    filter[0] = F_ANY;
+    c->length = 0;
+    make_exclude(c, comp, 0, filter);
+    FAILIF(check_exclude(c) != NPROBES);
+    /* Any at the start, middle, and end */
+    for (where = 0; where <= 3; where++) {
+        memset(filter, 0, sizeof(filter));
+        filter[where] = F_ANY;
+        c->length = 0;
+        make_exclude(c, comp, 3, filter);
+        check_exclude(c);
+    }
+    /* Any on both ends leaves only the gaps between components */
+    filter[0] = filter[3] = F_ANY;
+    filter[1] = filter[2] = F_NONE;
+    c->length = 0;
+    make_exclude(c, comp, 3, filter);
+    check_exclude(c);
+    /* A Bloom filter in each position */
+    for (where = 0; where <= 3; where++) {
+        memset(filter, 0, sizeof(filter));
+        filter[where] = F_BLOOM;
+        c->length = 0;
+        make_exclude(c, comp, 3, filter);
+        check_exclude(c);
+    }
+    /* Components out of order take the linear path */
+    memset(filter, 0, sizeof(filter));
+    filter[1] = F_ANY;
+    c->length = 0;
+    make_exclude(c, backward, 3, filter);
+    check_exclude(c);
+    ccn_charbuf_destroy(&c);
+}
+
+/**
+ * Random Exclude clauses, mostly in canonical order
+ */
+static void
+test_random_cases(int trials)
+{
+    struct ccn_charbuf *c = ccn_charbuf_create();
+    int comp[NPROBES];
+    int filter[NPROBES + 1];
+    int used[NPROBES];
+    int n;
+    int i;
+    int j;
+    int t;
+    int tmp;
+
+    for (t = 0; t < trials; t++) {
+        memset(used, 0, sizeof(used));
+        n = random() % 10;
+        for (i = 0; i < n; i++) {
+            do comp[i] = random() % NPROBES; while (used[comp[i]]);
+            used[comp[i]] = 1;
+        }
+        if (random() % 4 != 0) {
+            for (i = 1; i < n; i++)
+                for (j = i; j > 0 && probe_compare(comp[j - 1], comp[j]) > 0; j--) {
+                    tmp = comp[j];
+                    comp[j] = comp[j - 1];
+                    comp[j - 1] = tmp;
+                }
+        }
+        for (i = 0; i <= n; i++)
+            filter[i] = random() % 3;
+        c->length = 0;
+        make_exclude(c, comp, n, filter);
+        check_exclude(c);
+    }
+    ccn_charbuf_destroy(&c);
+}
+
+static double
+seconds(struct timeval *start, struct timeval *end)
+{
+    return((end->tv_sec - start->tv_sec) +
+           (end->tv_usec - start->tv_usec) / 1e6);
+}
+
+/**
+ * Time both forms against a long Exclude, such as a consumer builds
+ * up when it keeps excluding the answers it has already seen
+ */
+static void
+bench(int ncomps, int rounds)
+{
+    struct ccn_charbuf *c = ccn_charbuf_create();
+    struct ccn_exclusion *x = NULL;
+    struct timeval t0, t1, t2;
+    unsigned char val[4];
+    int count[2] = {0, 0};
+    int i;
+    int r;
+
+    ccnb_element_begin(c, CCN_DTAG_Exclude);
+    for (i = 0; i < ncomps; i++) {
+        val[0] = i >> 8;
+        val[1] = i;
+        ccnb_append_tagged_blob(c, CCN_DTAG_Component, val, 2);
+    }
+    ccnb_element_begin(c, CCN_DTAG_Any);
+    ccnb_element_end(c);
+    ccnb_element_end(c);
+    x = ccn_exclusion_compile(c->buf, c->length);
+    CHKPTR(x);
+    gettimeofday(&t0, NULL);
+    for (r = 0; r < rounds; r++) {
+        val[0] = (r * 7) >> 8;
+        val[1] = r * 7;
+        count[0] += ccn_excluded(c->buf, c->length, val, 2);
+    }
+    gettimeofday(&t1, NULL);
+    for (r = 0; r < rounds; r++) {
+        val[0] = (r * 7) >> 8;
+        val[1] = r * 7;
+        count[1] += ccn_exclusion_match(x, val, 2);
+    }
+    gettimeofday(&t2, NULL);
+    FAILIF(count[0] != count[1]);
+    printf("exclude of %d components: ccn_excluded %.0f ns, "
+           "ccn_exclusion_match %.0f ns per test\n", ncomps,
+           seconds(&t0, &t1) * 1e9 / rounds, seconds(&t1, &t2) * 1e9 / rounds);
+    ccn_exclusion_destroy(&x);
+    ccn_charbuf_destroy(&c);
+}
+
+int
+main(int argc, char **argv)
+{
+    int k;
+
+    srandom(1);
+    make_probes();
+    for (k = 0; k < NPROBES; k++) {
+        content[k] = ccn_charbuf_create();
+        make_content(content[k], k);
+    }
+    test_fixed_cases();
+    test_random_cases(2000);
+    bench(10, 200000);
+    bench(200, 20000);
+    for (k = 0; k < NPROBES; k++)
+        ccn_charbuf_destroy(&content[k]);
+    return(0);
+}
@@ -49,6 +49,27 @@ struct hashtb {
     struct hashtb_param param;  /* saved client parameters */
 };
 
+static struct node *
+node_alloc(struct hashtb *ht, size_t size)
+{
+    struct node *p;
+    if (ht->param.node_alloc == NULL)
+        return(calloc(1, size));
+    p = (ht->param.node_alloc)(ht, size);
+    if (p != NULL)
+        memset(p, 0, size);
+    return(p);
+}
+
+static void
+node_free(struct hashtb *ht, struct node *p)
+{
+    if (ht->param.node_free == NULL)
+        free(p);
+    else
+        (ht->param.node_free)(ht, p);
+}
+
 size_t
 hashtb_hash(const unsigned char *key, size_t key_size)
 {
@@ -176,6 +197,24 @@ hashtb_start(struct hashtb *ht, struct hashtb_enumerator *hte)
     return(hte);
 }
 
+struct hashtb_enumerator *
+hashtb_start_at(struct hashtb *ht, struct hashtb_enumerator *hte, unsigned pos)
+{
+    hashtb_start(ht, hte);
+    if (pos != 0)
+        setpos(hte, scan_buckets(ht, pos));
+    return(hte);
+}
+
+int
+hashtb_position(struct hashtb_enumerator *hte)
+{
+    struct node **pp = hte->priv[0];
+    if (pp == NULL || *pp == NULL)
+        return(-1);
+    return((*pp)->hash % hte->ht->n_buckets);
+}
+
 void
 hashtb_end(struct hashtb_enumerator *hte)
 {
@@ -192,7 +231,7 @@ hashtb_end(struct hashtb_enumerator *hte)
                 (*f)(hte);
             p = ht->deferred;
             ht->deferred = p->link;
-            free(p);
+            node_free(ht, p);
         }
     }
     hte->priv[0] = 0;
@@ -242,7 +281,7 @@ hashtb_seek(struct hashtb_enumerator *hte, const void *key, size_t keysize, size
             return(HT_OLD_ENTRY);
         }
     }
-    p = calloc(1, sizeof(*p) + ht->item_size + keysize + extsize);
+    p = node_alloc(ht, sizeof(*p) + ht->item_size + keysize + extsize);
     if (p == NULL) {
         setpos(hte, NULL);
         return(-1);
@@ -273,7 +312,7 @@ hashtb_delete(struct hashtb_enumerator *hte)
             hashtb_finalize_proc f = ht->param.finalize;
             if (f != NULL)
                 (*f)(hte);
-            free(p);
+            node_free(ht, p);
         }
         else {
             p->link = ht->deferred;
@@ -44,6 +44,97 @@ finally(struct hashtb_enumerator *e)
     fprintf(stderr, "%s deleting %s\n", who, (const char *)e->key);
 }
 
+struct resume_item {
+    unsigned visits;
+    unsigned original;
+};
+
+static void
+resume_item_key(char *key, const char *prefix, int i)
+{
+    sprintf(key, "%s%d", prefix, i);
+}
+
+/*
+ * Walk the table a few entries at a time using hashtb_position and
+ * hashtb_start_at, adding and deleting entries between the pieces.
+ * Each entry that was there at the start and survives must be visited
+ * exactly once; those added along the way at most once.
+ */
+static int
+resume_test(int n)
+{
+    struct hashtb *h = hashtb_create(sizeof(struct resume_item), NULL);
+    struct hashtb_enumerator eee;
+    struct hashtb_enumerator *e = &eee;
+    struct resume_item *item = NULL;
+    char key[32];
+    int pieces = 0;
+    int added = 0;
+    int deleted = 0;
+    int survivors = 0;
+    int failures = 0;
+    int pos = 0;
+    int prev;
+    int i, k;
+    
+    hashtb_start(h, e);
+    for (i = 0; i < n; i++) {
+        resume_item_key(key, "k", i);
+        hashtb_seek(e, key, strlen(key), 0);
+        item = e->data;
+        item->original = 1;
+    }
+    hashtb_end(e);
+    while (pos >= 0) {
+        hashtb_start_at(h, e, pos);
+        for (k = 0, prev = -1; e->key != NULL; hashtb_next(e), k++) {
+            pos = hashtb_position(e);
+            if (k >= 10 && pos != prev)
+                break;
+            item = e->data;
+            item->visits++;
+            prev = pos;
+        }
+        pos = hashtb_position(e);
+        hashtb_end(e);
+        pieces++;
+        /* Disturb the table before resuming */
+        hashtb_start(h, e);
+        for (i = 0; i < 2; i++) {
+            resume_item_key(key, "k", (7 * (2 * pieces + i)) % n);
+            if (hashtb_lookup(h, key, strlen(key)) != NULL) {
+                hashtb_seek(e, key, strlen(key), 0);
+                hashtb_delete(e);
+                deleted++;
+            }
+            resume_item_key(key, "new", added++);
+            hashtb_seek(e, key, strlen(key), 0);
+        }
+        hashtb_end(e);
+    }
+    for (hashtb_start(h, e); e->key != NULL; hashtb_next(e)) {
+        item = e->data;
+        if (item->original)
+            survivors++;
+        if (item->original ? item->visits != 1 : item->visits > 1) {
+            fprintf(stderr, "%.*s visited %u times\n",
+                    (int)e->keysize, (const char *)e->key, item->visits);
+            failures++;
+        }
+    }
+    hashtb_end(e);
+    if (survivors != n - deleted) {
+        fprintf(stderr, "%d of %d entries left, expected %d\n",
+                survivors, n, n - deleted);
+        failures++;
+    }
+    printf("resumed walk: %d pieces, %d added, %d deleted, %d failures\n",
+           pieces, added, deleted, failures);
+    hashtb_destroy(&h);
+    return(failures != 0);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -55,6 +146,12 @@ main(int argc, char **argv)
     struct hashtb_enumerator eee2;
     struct hashtb_enumerator *e2 = NULL;
     int nest = 0;
+    
+    if (argc > 2 && strcmp(argv[1], "-r") == 0) {
+        hashtb_end(e);
+        hashtb_destroy(&h);
+        return(resume_test(atoi(argv[2])));
+    }
     while (fgets(buf, sizeof(buf), stdin)) {
         int i = strlen(buf);
         if (i > 0 && buf[i-1] == '\n')
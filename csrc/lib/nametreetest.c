@@ -49,6 +49,22 @@ fatal(const char *fn, int lineno)
     return(0);
 }
 
+static int live_entries = 0;
+
+static void *
+counting_alloc(struct ccn_nametree *h, size_t size)
+{
+    live_entries++;
+    return(malloc(size));
+}
+
+static void
+counting_free(struct ccn_nametree *h, void *p)
+{
+    live_entries--;
+    free(p);
+}
+
 int
 test_inserts_from_stdin(void)
 {
@@ -69,6 +85,8 @@ test_inserts_from_stdin(void)
     
     ntree = ccn_nametree_create(42);
     CHKPTR(ntree);
+    ntree->ccny_alloc = &counting_alloc;
+    ntree->ccny_free = &counting_free;
     ccn_nametree_check(ntree);
     c = ccn_charbuf_create();
     CHKPTR(c);
@@ -109,7 +127,7 @@ test_inserts_from_stdin(void)
             continue;
         }
         /* insert case */
-        node = ccny_create(lrand48(), 0);
+        node = ccny_create_in(ntree, lrand48(), 0);
         ccny_set_key(node, f->buf, f->length);
         if (ntree->n >= ntree->limit) {
             int res = ccn_nametree_grow(ntree);
@@ -140,12 +158,85 @@ test_inserts_from_stdin(void)
         printf(" %u", ccny_cookie(node));
     printf("\n");
     FAILIF(unique - deleted != ntree->n);
+    FAILIF(live_entries != ntree->n);
     ccn_nametree_destroy(&ntree);
+    FAILIF(live_entries != 0);
     ccn_charbuf_destroy(&c);
     ccn_charbuf_destroy(&f);
     return(0);
 }
 
+int
+test_append(void)
+{
+    struct ccn_charbuf *f = NULL;
+    struct ccn_nametree *ntree = NULL;
+    struct ccny *v[1000];
+    struct ccny *w[202];
+    struct ccny *node = NULL;
+    char buf[20];
+    int i;
+    int n;
+    int res;
+    
+    ntree = ccn_nametree_create(42);
+    CHKPTR(ntree);
+    ntree->ccny_alloc = &counting_alloc;
+    ntree->ccny_free = &counting_free;
+    f = ccn_charbuf_create();
+    CHKPTR(f);
+    for (i = 0; i < 1000; i++) {
+        ccn_charbuf_reset(f);
+        snprintf(buf, sizeof(buf), "%06d", 3 * i);
+        ccn_flatname_append_component(f, (const unsigned char *)buf, 6);
+        v[i] = ccny_create_in(ntree, lrand48(), 0);
+        CHKPTR(v[i]);
+        ccny_set_key(v[i], f->buf, f->length);
+    }
+    while (ntree->limit <= 1000) {
+        res = ccn_nametree_grow(ntree);
+        FAILIF(res != 0);
+    }
+    /* Append in pieces */
+    n = ccn_nametree_append(ntree, v, 300);
+    FAILIF(n != 300);
+    ccn_nametree_check(ntree);
+    /* An out of order entry stops the append */
+    ccn_charbuf_reset(f);
+    ccn_flatname_append_component(f, (const unsigned char *)"000002", 6);
+    node = ccny_create_in(ntree, lrand48(), 0);
+    ccny_set_key(node, f->buf, f->length);
+    for (i = 0; i < 200; i++)
+        w[i] = v[300 + i];
+    w[200] = node;
+    w[201] = v[500];
+    n = ccn_nametree_append(ntree, w, 202);
+    FAILIF(n != 200);
+    ccn_nametree_check(ntree);
+    ccny_destroy(ntree, &node);
+    n = ccn_nametree_append(ntree, v + 500, 500);
+    FAILIF(n != 500);
+    ccn_nametree_check(ntree);
+    FAILIF(ntree->n != 1000);
+    for (i = 0, node = ccn_nametree_first(ntree); node != NULL;
+         i++, node = ccny_next(node))
+        FAILIF(node != v[i]);
+    FAILIF(i != 1000);
+    /* Ordinary enrollment still works afterwards */
+    ccn_charbuf_reset(f);
+    ccn_flatname_append_component(f, (const unsigned char *)"000001", 6);
+    node = ccny_create_in(ntree, lrand48(), 0);
+    ccny_set_key(node, f->buf, f->length);
+    FAILIF(ccny_enroll(ntree, node) != 0 || ccny_cookie(node) == 0);
+    ccn_nametree_check(ntree);
+    FAILIF(ccny_prev(node) != v[0] || ccny_next(node) != v[1]);
+    printf("append: %d nodes\n", ntree->n);
+    ccn_nametree_destroy(&ntree);
+    FAILIF(live_entries != 0);
+    ccn_charbuf_destroy(&f);
+    return(0);
+}
+
 int
 nametreetest_main(int argc, char **argv)
 {
@@ -154,6 +245,8 @@ nametreetest_main(int argc, char **argv)
     if (argv[1] && 0 == strcmp(argv[1], "-")) {
         res = test_inserts_from_stdin();
         CHKSYS(res);
+        res = test_append();
+        CHKSYS(res);
         if (0) {
             char buf[40];
             snprintf(buf, sizeof(buf), "leaks %d", (int)getpid());
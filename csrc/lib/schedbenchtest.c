@@ -0,0 +1,214 @@
+/**
+ * @file schedbenchtest.c
+ *
+ * A simple test program to benchmark the event scheduler.
+ *
+ * Runs the same simulated workload against the heap and the timing wheel
+ * implementations of ccn_schedule, checks that they fire the same events
+ * at the same times, and reports the cost of each.
+ *
+ * Copyright (C) 2013 Palo Alto Research Center, Inc.
+ *
+ * This work is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 2 as published by the
+ * Free Software Foundation.
+ * This work is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details. You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <ccn/schedule.h>
+
+#define NEVENTS 500000
+#define TICKS 2000
+#define TICK_MICROS 1000
+#define LIFETIME_MICROS 4000000
+
+struct bench {
+    struct ccn_scheduled_event **ev;    /* live events, by slot */
+    int n;                              /* number of slots */
+    unsigned long long fired;
+    unsigned long long late;            /* total micros fired late */
+    unsigned long long checksum;
+    long long *due;                     /* expected firing time, by slot */
+};
+
+static struct ccn_timeval simclock;
+
+static void
+sim_gettime(const struct ccn_gettime *self, struct ccn_timeval *result)
+{
+    *result = simclock;
+}
+
+static struct ccn_gettime gt = {"sim", &sim_gettime, 1000000, NULL};
+
+static long long
+sim_now(void)
+{
+    return((long long)simclock.s * 1000000 + simclock.micros);
+}
+
+static void
+sim_advance(int micros)
+{
+    long long t = sim_now() + micros;
+    simclock.s = t / 1000000;
+    simclock.micros = t % 1000000;
+}
+
+static int
+expire(struct ccn_schedule *sched, void *clienth,
+       struct ccn_scheduled_event *ev, int flags)
+{
+    struct bench *b = clienth;
+    int i = ev->evint;
+    long long now = sim_now();
+    
+    b->ev[i] = NULL;
+    if ((flags & CCN_SCHEDULE_CANCEL) != 0)
+        return(0);
+    if (now < b->due[i]) {
+        fprintf(stderr, "event %d fired %lld micros early\n", i, b->due[i] - now);
+        exit(1);
+    }
+    b->fired++;
+    b->late += now - b->due[i];
+    b->checksum += (unsigned long long)(i + 1) * now;
+    return(0);
+}
+
+static void
+add_event(struct ccn_schedule *sched, struct bench *b, int i)
+{
+    int micros = random() % LIFETIME_MICROS;
+    
+    b->due[i] = sim_now() + micros;
+    b->ev[i] = ccn_schedule_event(sched, micros, &expire, NULL, i);
+}
+
+static double
+seconds(struct timeval *start, struct timeval *end)
+{
+    return((end->tv_sec - start->tv_sec) +
+           (end->tv_usec - start->tv_usec) / 1e6);
+}
+
+/**
+ * Run the workload, and report timings
+ *
+ * First schedule n events, then cancel half of them.  Then for each tick,
+ * advance the clock, cancel some events, schedule replacements, and run
+ * whatever has come due; this is roughly what a busy ccnd does with its
+ * pending interest table.  Finally run until nothing is left.
+ */
+static void
+run_bench(const char *what, struct bench *b, int n, int ticks)
+{
+    struct ccn_schedule *sched;
+    struct timeval t0, t1, t2, t3, t4;
+    long long ops = 0;
+    int i;
+    int k;
+    int t;
+    int res;
+    
+    memset(b, 0, sizeof(*b));
+    b->n = n;
+    b->ev = calloc(n, sizeof(b->ev[0]));
+    b->due = calloc(n, sizeof(b->due[0]));
+    simclock.s = 1000;
+    simclock.micros = 0;
+    srandom(1);
+    sched = ccn_schedule_create(b, &gt);
+    gettimeofday(&t0, NULL);
+    for (i = 0; i < n; i++)
+        add_event(sched, b, i);
+    gettimeofday(&t1, NULL);
+    for (i = 0; i < n; i += 2)
+        ccn_schedule_cancel(sched, b->ev[i]);
+    gettimeofday(&t2, NULL);
+    for (t = 0; t < ticks; t++) {
+        sim_advance(TICK_MICROS);
+        for (k = 0; k < n / 1000; k++) {
+            i = random() % n;
+            if (b->ev[i] != NULL) {
+                ccn_schedule_cancel(sched, b->ev[i]);
+                ops++;
+            }
+            add_event(sched, b, i);
+            ops++;
+        }
+        ccn_schedule_run(sched);
+    }
+    gettimeofday(&t3, NULL);
+    for (;;) {
+        res = ccn_schedule_run(sched);
+        if (res < 0)
+            break;
+        sim_advance(res > TICK_MICROS ? TICK_MICROS : res);
+    }
+    gettimeofday(&t4, NULL);
+    ccn_schedule_destroy(&sched);
+    printf("%-6s insert %4.0f ns  cancel %4.0f ns  steady %5.0f ns/op  "
+           "drain %6.3f s  fired %llu  late %.1f us avg\n", what,
+           seconds(&t0, &t1) * 1e9 / n,
+           seconds(&t1, &t2) * 1e9 / ((n + 1) / 2),
+           seconds(&t2, &t3) * 1e9 / (ops ? ops : 1),
+           seconds(&t3, &t4),
+           b->fired, b->fired ? (double)b->late / b->fired : 0.0);
+    free(b->ev);
+    free(b->due);
+}
+
+static void
+usage(const char *progname)
+{
+    fprintf(stderr,
+            "%s [-n events] [-t ticks]\n"
+            "Benchmark the heap and timing wheel event schedulers\n",
+            progname);
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct bench heap;
+    struct bench wheel;
+    int n = NEVENTS;
+    int ticks = TICKS;
+    int res;
+    
+    while ((res = getopt(argc, argv, "hn:t:")) != -1) {
+        switch (res) {
+            case 'n':
+                n = atoi(optarg);
+                break;
+            case 't':
+                ticks = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (n < 2 || ticks < 0)
+        usage(argv[0]);
+    unsetenv("CCN_SCHEDULE");
+    run_bench("heap", &heap, n, ticks);
+    setenv("CCN_SCHEDULE", "wheel", 1);
+    run_bench("wheel", &wheel, n, ticks);
+    if (heap.fired != wheel.fired || heap.checksum != wheel.checksum) {
+        fprintf(stderr, "%s: heap and wheel disagree\n", argv[0]);
+        exit(1);
+    }
+    return(0);
+}
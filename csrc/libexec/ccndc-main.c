@@ -38,8 +38,9 @@ usage(const char *progname)
 {
     fprintf(stderr,
             "Usage:\n"
-            "   %s [-h] [-d] [-v] [-t <lifetime>] (-f <configfile> | COMMAND)\n"
+            "   %s [-h] [-b] [-d] [-v] [-t <lifetime>] (-f <configfile> | COMMAND)\n"
             "       -h print usage and exit\n"
+            "       -b send prefix registrations in bulk requests\n"
             "       -d enter dynamic mode and create FIB entries based on DNS SRV records\n"
             "       -f <configfile> add or delete FIB entries based on the content of <configfile>\n"
             "       -t use value in seconds for lifetime of prefix registration\n"
@@ -109,11 +110,12 @@ main(int argc, char **argv)
     int opt, disp_res;
     char *cmd = NULL;
     int dynamic = 0;
+    int bulk = 0;
     int lifetime = -1;
     
     progname = argv[0];
     
-    while ((opt = getopt(argc, argv, "hdvt:f:")) != -1) {
+    while ((opt = getopt(argc, argv, "hbdvt:f:")) != -1) {
         switch (opt) {
             case 'f':
                 configfile = optarg;
@@ -131,6 +133,9 @@ main(int argc, char **argv)
             case 'd':
                 dynamic = 1;
                 break;
+            case 'b':
+                bulk = 1;
+                break;
             case 'h':
             default:
                 usage(progname);
@@ -146,6 +151,7 @@ main(int argc, char **argv)
     ccndc = ccndc_initialize_data();
     if (lifetime > 0)
         ccndc->lifetime = lifetime;
+    ccndc->bulk = bulk;
     if (optind < argc) {
         /* config file cannot be combined with command line */
         if (configfile != NULL) {
@@ -170,6 +176,7 @@ main(int argc, char **argv)
     if (configfile) {
         read_configfile(ccndc, configfile);
     }
+    ccndc_flush_bulk(ccndc);
     if (dynamic) {
         ccndc_daemonize(ccndc);
     }
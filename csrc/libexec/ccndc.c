@@ -47,9 +47,18 @@
 #include <ccn/uri.h>
 #include <ccn/signing.h>
 #include <ccn/face_mgmt.h>
+#include <ccn/hashtb.h>
 #include <ccn/reg_mgmt.h>
 #include <ccn/strategy_mgmt.h>
 
+/**
+ * Size limit for the ForwardingEntries of one bulkreg request
+ *
+ * The request travels as a name component, and the reply repeats the
+ * name, so both must fit within the message size limit of ccnd.
+ */
+#define CCNDC_BULK_BYTES 4000
+
 #define ON_ERROR_CLEANUP(resval) {                                      \
 if ((resval) < 0) {                                                 \
 if (verbose > 0) ccndc_warn(__LINE__, "OnError cleanup\n");    \
@@ -100,6 +109,11 @@ ccndc_initialize_data(void) {
     
     self->lifetime = (~0U) >> 1;
     
+    self->bulk_entries = ccn_charbuf_create();
+    if (self->bulk_entries == NULL) {
+        ON_ERROR_EXIT (-1, msg);
+    }
+    
     return self;
 }
 
@@ -110,6 +124,8 @@ ccndc_destroy_data(struct ccndc_data **data) {
     if (self != NULL) {
         ccn_charbuf_destroy(&self->no_name);
         ccn_charbuf_destroy(&self->local_scope_template);
+        ccn_charbuf_destroy(&self->bulk_entries);
+        hashtb_destroy(&self->face_cache);
         ccn_destroy(&self->ccn_handle);
         free(self);
         *data = NULL;
@@ -123,6 +139,12 @@ ccndc_dispatch_cmd(struct ccndc_data *ccndc,
                    const char *options,
                    int num_options)
 {
+    /* Other commands may depend on the pending prefix actions, or on faces */
+    if (!check_only && strcasecmp(cmd, "add") != 0 &&
+        strcasecmp(cmd, "del") != 0) {
+        ccndc_flush_bulk(ccndc);
+        hashtb_destroy(&ccndc->face_cache);
+    }
     if (strcasecmp(cmd, "add") == 0) {
         if (num_options >= 0 && (num_options < 3 || num_options > 7))
             return INT_MIN;
@@ -183,6 +205,55 @@ ccndc_dispatch_cmd(struct ccndc_data *ccndc,
 }
 
 
+/**
+ * Look up or create a face, and get its faceid
+ *
+ * In bulk mode the faceids are remembered by face parameters, so that
+ * a long configuration file needs only one newface request per face.
+ * A failure is remembered too, rather than waiting it out again.
+ * @returns the faceid, or -1 for failure.
+ */
+static int
+ccndc_lookup_faceid(struct ccndc_data *self,
+                    struct ccn_face_instance *face)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct ccn_face_instance *newface = NULL;
+    struct ccn_charbuf *key = NULL;
+    unsigned *cached = NULL;
+    int res = -1;
+    
+    if (self->bulk) {
+        if (self->face_cache == NULL)
+            self->face_cache = hashtb_create(sizeof(unsigned), NULL);
+        key = ccn_charbuf_create();
+        ccn_charbuf_putf(key, "%d %s %s %s %d", face->descr.ipproto,
+                         face->descr.address, face->descr.port,
+                         face->descr.source_address ? face->descr.source_address : "",
+                         face->descr.mcast_ttl);
+        cached = hashtb_lookup(self->face_cache, key->buf, key->length);
+        if (cached != NULL) {
+            if (*cached != CCN_NO_FACEID)
+                res = *cached;
+            goto Cleanup;
+        }
+    }
+    newface = ccndc_do_face_action(self, "newface", face);
+    if (newface != NULL)
+        res = newface->faceid;
+    if (key != NULL) {
+        hashtb_start(self->face_cache, e);
+        if (hashtb_seek(e, key->buf, key->length, 0) >= 0)
+            *(unsigned *)e->data = (res < 0) ? CCN_NO_FACEID : res;
+        hashtb_end(e);
+    }
+Cleanup:
+    ccn_face_instance_destroy(&newface);
+    ccn_charbuf_destroy(&key);
+    return (res);
+}
+
 #define GET_NEXT_TOKEN(_cmd, _token_var) do {       \
 _token_var = strsep(&_cmd, " \t");             \
 } while (_token_var != NULL && _token_var[0] == 0);
@@ -206,7 +277,6 @@ ccndc_add(struct ccndc_data *self,
     char *cmd_mcastttl = NULL;
     char *cmd_mcastif = NULL;
     struct ccn_face_instance *face = NULL;
-    struct ccn_face_instance *newface = NULL;
     struct ccn_forwarding_entry *prefix = NULL;
     
     if (cmd_orig == NULL) {
@@ -237,17 +307,16 @@ ccndc_add(struct ccndc_data *self,
     
     if (!check_only) {
         if (0 != strcasecmp(cmd_proto, "face")) {
-            newface = ccndc_do_face_action(self, "newface", face);
-            if (newface == NULL) {
+            ret_code = ccndc_lookup_faceid(self, face);
+            if (ret_code < 0) {
                 ccndc_warn(__LINE__, "Cannot create/lookup face\n");
                 goto Cleanup;
             }
-            prefix->faceid = newface->faceid;
-            ccn_face_instance_destroy(&newface);
+            prefix->faceid = ret_code;
         } else {
             prefix->faceid = face->faceid;
         }
-        ret_code = ccndc_do_prefix_action(self, "prefixreg", prefix);
+        ret_code = ccndc_queue_prefix_action(self, "prefixreg", prefix);
         if (ret_code < 0) {
             ccndc_warn(__LINE__, "Cannot register prefix [%s]\n", cmd_uri);
             goto Cleanup;
@@ -277,7 +346,6 @@ ccndc_del(struct ccndc_data *self,
     char *cmd_mcastttl = NULL;
     char *cmd_mcastif = NULL;
     struct ccn_face_instance *face = NULL;
-    struct ccn_face_instance *newface = NULL;
     struct ccn_forwarding_entry *prefix = NULL;
     
     if (cmd_orig == NULL) {
@@ -307,17 +375,16 @@ ccndc_del(struct ccndc_data *self,
     
     if (!check_only) {
         if (0 != strcasecmp(cmd_proto, "face")) {
-            newface = ccndc_do_face_action(self, "newface", face);
-            if (newface == NULL) {
+            ret_code = ccndc_lookup_faceid(self, face);
+            if (ret_code < 0) {
                 ccndc_warn(__LINE__, "Cannot create/lookup face\n");
                 goto Cleanup;
             }
-            prefix->faceid = newface->faceid;
-            ccn_face_instance_destroy(&newface);
+            prefix->faceid = ret_code;
         } else {
             prefix->faceid = face->faceid;
         }
-        ret_code = ccndc_do_prefix_action(self, "unreg", prefix);
+        ret_code = ccndc_queue_prefix_action(self, "unreg", prefix);
         if (ret_code < 0) {
             ccndc_warn(__LINE__, "Cannot unregister prefix [%s]\n", cmd_uri);
             goto Cleanup;
@@ -1303,6 +1370,161 @@ Cleanup:
     return (-1);
 }
 
+int
+ccndc_queue_prefix_action(struct ccndc_data *self,
+                          const char *action,
+                          struct ccn_forwarding_entry *forwarding_entry)
+{
+    struct ccn_charbuf *entry = NULL;
+    size_t ccnd_id_size;
+    int res;
+    
+    if (!self->bulk)
+        return (ccndc_do_prefix_action(self, action, forwarding_entry));
+    forwarding_entry->action = action;
+    /* The request is addressed to our ccnd, so registrations may omit its id */
+    ccnd_id_size = forwarding_entry->ccnd_id_size;
+    if (strcmp(action, "unreg") != 0)
+        forwarding_entry->ccnd_id_size = 0;
+    entry = ccn_charbuf_create();
+    ON_NULL_CLEANUP(entry);
+    res = ccnb_append_forwarding_entry(entry, forwarding_entry);
+    forwarding_entry->ccnd_id_size = ccnd_id_size;
+    ON_ERROR_CLEANUP(res);
+    if (self->bulk_count > 0 &&
+        self->bulk_entries->length + entry->length > CCNDC_BULK_BYTES)
+        ccndc_flush_bulk(self);
+    ON_ERROR_CLEANUP(ccn_charbuf_append_charbuf(self->bulk_entries, entry));
+    self->bulk_count++;
+    ccn_charbuf_destroy(&entry);
+    return (0);
+    
+Cleanup:
+    ccn_charbuf_destroy(&entry);
+    return (-1);
+}
+
+/**
+ * Report a failed entry of a bulkreg request
+ */
+static void
+ccndc_bulk_warn(const unsigned char *entry, size_t entry_size,
+                const unsigned char *status, size_t status_size)
+{
+    struct ccn_forwarding_entry *fe = NULL;
+    struct ccn_charbuf *uri = ccn_charbuf_create();
+    struct ccn_charbuf *msg = ccn_charbuf_create();
+    struct ccn_buf_decoder decoder;
+    struct ccn_buf_decoder *d;
+    int errcode = -1;
+    
+    d = ccn_buf_decoder_start(&decoder, status, status_size);
+    if (ccn_buf_match_dtag(d, CCN_DTAG_StatusResponse)) {
+        ccn_buf_advance(d);
+        errcode = ccn_parse_optional_tagged_nonNegativeInteger(d, CCN_DTAG_StatusCode);
+        ccn_parse_tagged_string(d, CCN_DTAG_StatusText, msg);
+    }
+    if (entry != NULL)
+        fe = ccn_forwarding_entry_parse(entry, entry_size);
+    if (fe != NULL && fe->name_prefix != NULL)
+        ccn_uri_append(uri, fe->name_prefix->buf, fe->name_prefix->length, 1);
+    ccndc_warn(__LINE__, "Cannot %s prefix [%s], status %d: %s\n",
+               (fe != NULL && fe->action != NULL) ? fe->action : "register",
+               ccn_charbuf_as_string(uri),
+               errcode, ccn_charbuf_as_string(msg));
+    ccn_forwarding_entry_destroy(&fe);
+    ccn_charbuf_destroy(&uri);
+    ccn_charbuf_destroy(&msg);
+}
+
+int
+ccndc_flush_bulk(struct ccndc_data *self)
+{
+    struct ccn_charbuf *request = NULL;
+    struct ccn_charbuf *temp = NULL;
+    struct ccn_charbuf *name = NULL;
+    struct ccn_charbuf *resultbuf = NULL;
+    struct ccn_parsed_ContentObject pcobuf = {0};
+    struct ccn_buf_decoder rdecoder;
+    struct ccn_buf_decoder *rd;
+    struct ccn_buf_decoder decoder;
+    struct ccn_buf_decoder *d;
+    const unsigned char *ptr = NULL;
+    size_t length = 0;
+    size_t start;
+    size_t rstart;
+    int count = self->bulk_count;
+    int failed = 0;
+    int i;
+    
+    if (count == 0)
+        return (0);
+    request = ccn_charbuf_create();
+    ON_NULL_CLEANUP(request);
+    ON_ERROR_CLEANUP(ccnb_element_begin(request, CCN_DTAG_Collection));
+    ON_ERROR_CLEANUP(ccn_charbuf_append_charbuf(request, self->bulk_entries));
+    ON_ERROR_CLEANUP(ccnb_element_end(request));
+    self->bulk_entries->length = 0;
+    self->bulk_count = 0;
+    temp = ccn_charbuf_create();
+    ON_NULL_CLEANUP(temp);
+    ON_ERROR_CLEANUP(ccn_sign_content(self->ccn_handle, temp, self->no_name, NULL, request->buf, request->length));
+    resultbuf = ccn_charbuf_create();
+    ON_NULL_CLEANUP(resultbuf);
+    name = ccn_charbuf_create();
+    ON_NULL_CLEANUP(name);
+    ON_ERROR_CLEANUP(ccn_name_init(name));
+    ON_ERROR_CLEANUP(ccn_name_append_str(name, "ccnx"));
+    ON_ERROR_CLEANUP(ccn_name_append(name, self->ccnd_id, self->ccnd_id_size));
+    ON_ERROR_CLEANUP(ccn_name_append_str(name, "bulkreg"));
+    ON_ERROR_CLEANUP(ccn_name_append(name, temp->buf, temp->length));
+    ON_ERROR_CLEANUP(ccn_get(self->ccn_handle, name, self->local_scope_template, 4000, resultbuf, &pcobuf, NULL, 0));
+    ON_ERROR_CLEANUP(ccn_content_get_value(resultbuf->buf, resultbuf->length, &pcobuf, &ptr, &length));
+    /* Walk the request and the reply together */
+    d = ccn_buf_decoder_start(&decoder, ptr, length);
+    rd = ccn_buf_decoder_start(&rdecoder, request->buf, request->length);
+    if (!ccn_buf_match_dtag(d, CCN_DTAG_Collection)) {
+        ccndc_bulk_warn(NULL, 0, ptr, length);
+        goto Cleanup;
+    }
+    ccn_buf_advance(d);
+    ccn_buf_advance(rd);
+    for (i = 0; i < count; i++) {
+        rstart = rd->decoder.token_index;
+        ccn_buf_advance_past_element(rd);
+        start = d->decoder.token_index;
+        if (ccn_buf_match_dtag(d, CCN_DTAG_ForwardingEntry)) {
+            ccn_buf_advance_past_element(d);
+            continue;
+        }
+        if (!ccn_buf_match_dtag(d, CCN_DTAG_StatusResponse))
+            break;
+        ccn_buf_advance_past_element(d);
+        if (d->decoder.state < 0)
+            break;
+        ccndc_bulk_warn(request->buf + rstart, rd->decoder.token_index - rstart,
+                        ptr + start, d->decoder.token_index - start);
+        failed++;
+    }
+    if (i < count) {
+        ccndc_warn(__LINE__, "Incomplete response to bulk prefix request\n");
+        failed += count - i;
+    }
+    ccn_charbuf_destroy(&request);
+    ccn_charbuf_destroy(&temp);
+    ccn_charbuf_destroy(&resultbuf);
+    ccn_charbuf_destroy(&name);
+    return (-failed);
+    
+Cleanup:
+    ccndc_warn(__LINE__, "Bulk prefix request of %d entries failed\n", count);
+    ccn_charbuf_destroy(&request);
+    ccn_charbuf_destroy(&temp);
+    ccn_charbuf_destroy(&resultbuf);
+    ccn_charbuf_destroy(&name);
+    return (-count);
+}
+
 struct ccn_strategy_selection *
 ccndc_do_strategy_action(struct ccndc_data *self,
                      const char *action,
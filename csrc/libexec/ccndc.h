@@ -26,6 +26,7 @@
 struct ccndc_prefix_entry;
 struct ccn_forwarding_entry;
 struct ccn_face_instance;
+struct hashtb;
 
 /**
  * @brief Internal data structure for ccndc
@@ -38,6 +39,10 @@ struct ccndc_data
     int                 lifetime;
     struct ccn_charbuf  *local_scope_template; // scope 1 template
     struct ccn_charbuf  *no_name;   // an empty name
+    int                 bulk;       // batch prefix registrations
+    struct ccn_charbuf  *bulk_entries; // ForwardingEntries not yet sent
+    int                 bulk_count;
+    struct hashtb       *face_cache; // faceids by face parameters, in bulk mode
 };
 
 /**
@@ -241,6 +246,30 @@ ccndc_do_prefix_action(struct ccndc_data *self,
                        const char *action,
                        struct ccn_forwarding_entry *forwarding_entry);
 
+/**
+ * @brief Queue an action using prefix management protocol
+ *
+ * In bulk mode the action is added to the pending batch, which is sent
+ * when it is full or when ccndc_flush_bulk is called; errors are reported
+ * at that time.  Otherwise this is the same as ccndc_do_prefix_action.
+ * @param self          data pointer to "this"
+ * @param action        action string
+ * @param forwarding_entry filled ccn_forwarding_entry structure
+ * @returns 0 on success
+ */
+int
+ccndc_queue_prefix_action(struct ccndc_data *self,
+                          const char *action,
+                          struct ccn_forwarding_entry *forwarding_entry);
+
+/**
+ * @brief Send the pending batch of prefix actions as one bulkreg request
+ * @param self          data pointer to "this"
+ * @returns 0 on success, or the negated number of failed actions
+ */
+int
+ccndc_flush_bulk(struct ccndc_data *self);
+
 
 struct ccn_strategy_selection *
 ccndc_do_strategy_action(struct ccndc_data *self,
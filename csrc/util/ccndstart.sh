@@ -35,10 +35,14 @@ StuffPreload () {
 : ${CCND_CAP:=50000}
 : ${CCND_DEBUG:=''}
 export CCN_LOCAL_PORT CCND_CAP CCND_DEBUG CCND_AUTOREG CCND_LISTEN_ON CCND_MTU
+export CCND_CAP_BYTES CCND_CS_POLICY CCND_CS_ADMIT CCND_CS_TIER CCND_CS_TIER_BYTES
+export CCND_CS_SNAPSHOT
 # The following are rarely used, but include them for completeness
 export CCN_LOCAL_SOCKNAME CCND_DATA_PAUSE_MICROSEC CCND_KEYSTORE_DIRECTORY
+export CCND_PACK_MICROSEC CCND_LINK_ACK CCND_AQM_TARGET_MICROSEC
+export CCND_OVERLOAD_MICROSEC
 export CCND_DEFAULT_TIME_TO_STALE CCND_MAX_TIME_TO_STALE CCND_PREFIX
-export CCND_MAX_RTE_MICROSEC
+export CCND_MAX_RTE_MICROSEC CCN_SCHEDULE
 
 # If a ccnd is already running, try to shut it down cleanly.
 ccndsmoketest kill 2>/dev/null